@@ -0,0 +1,55 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+# Runs the Benchee suites in bench/, or only those named on the command line:
+#
+#     mix bench
+#     mix bench stat humanize
+#
+# BENCH_TAG saves the results of each suite under bench/results, and
+# BENCH_COMPARE adds the saved results of another tag to the report, so that
+# two commits can be compared:
+#
+#     git switch main && BENCH_TAG=main mix bench
+#     git switch my-branch && BENCH_TAG=my-branch BENCH_COMPARE=main mix bench
+#
+# BENCH_NETWORK_PATH adds a directory on a network mount to the latency inputs.
+# The native side has its own benchmarks: `cargo bench` in native/diskspace.
+
+defmodule DiskSpaceBench do
+  @moduledoc false
+
+  def options(suite, opts \\ []) do
+    tag = System.get_env("BENCH_TAG")
+    compare = System.get_env("BENCH_COMPARE")
+
+    [time: 3, warmup: 1, memory_time: 1]
+    |> put_if(tag, :save, path: results_path(tag, suite), tag: tag)
+    |> put_if(compare, :load, results_path(compare, suite))
+    |> Keyword.merge(opts)
+  end
+
+  # %{"local" => path, "tmpfs" => path, "network" => path}, for those that exist here
+  def filesystems do
+    [
+      {"local", File.cwd!()},
+      {"tmpfs", "/dev/shm"},
+      {"network", System.get_env("BENCH_NETWORK_PATH")}
+    ]
+    |> Enum.filter(fn {_kind, path} -> path && File.dir?(path) end)
+    |> Map.new()
+  end
+
+  defp results_path(tag, suite), do: Path.join("bench/results", "#{tag}.#{suite}.benchee")
+
+  defp put_if(opts, nil, _key, _value), do: opts
+  defp put_if(opts, _set, key, value), do: Keyword.put(opts, key, value)
+end
+
+suites =
+  case System.argv() do
+    [] -> Path.wildcard("bench/*_bench.exs")
+    names -> Enum.map(names, &"bench/#{&1}_bench.exs")
+  end
+
+Enum.each(suites, &Code.require_file/1)
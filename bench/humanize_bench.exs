@@ -0,0 +1,18 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+stats = %{available: 52_034_158_592, free: 61_982_322_688, total: 250_790_436_864, used: 1536}
+results = List.duplicate({:ok, stats}, 1000)
+
+Benchee.run(
+  %{
+    "humanize/2, :binary" => fn -> DiskSpace.humanize(stats, :binary) end,
+    "humanize/2, :decimal" => fn -> DiskSpace.humanize(stats, :decimal) end,
+    "humanize/3, precision: 0" => fn -> DiskSpace.humanize(stats, :binary, precision: 0) end,
+    "humanize/2, tuple" => fn ->
+      DiskSpace.humanize({:ok, {stats.available, stats.free, stats.total, stats.used}})
+    end,
+    "humanize_many/2, 1000 results" => fn -> DiskSpace.humanize_many(results) end
+  },
+  DiskSpaceBench.options("humanize")
+)
@@ -0,0 +1,48 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+# Single-path latency per kind of filesystem
+Benchee.run(
+  %{
+    "stat/2" => fn path -> DiskSpace.stat(path) end,
+    "stat/2, validate: false" => fn path -> DiskSpace.stat(path, validate: false) end,
+    "stat/2, adaptive: true" => fn path -> DiskSpace.stat(path, adaptive: true) end,
+    "stat/2, format: :tuple" => fn path -> DiskSpace.stat(path, format: :tuple) end,
+    "stat_async/2" => fn path -> DiskSpace.stat_async(path) end,
+    "stat_handle/2" => {
+      fn {_path, handle} -> DiskSpace.stat_handle(handle) end,
+      before_scenario: fn path ->
+        {:ok, handle} = DiskSpace.open(path)
+        {path, handle}
+      end,
+      after_scenario: fn {_path, handle} -> DiskSpace.close(handle) end
+    }
+  },
+  DiskSpaceBench.options("stat", inputs: DiskSpaceBench.filesystems())
+)
+
+# Batch throughput as the number of paths grows
+path = File.cwd!()
+
+Benchee.run(
+  %{
+    "stat/2 per path" => fn paths -> Enum.map(paths, &DiskSpace.stat/1) end,
+    "stat_many/2" => fn paths -> DiskSpace.stat_many(paths) end,
+    "stat_many/2, dedupe_by_device: true" => fn paths ->
+      DiskSpace.stat_many(paths, dedupe_by_device: true)
+    end
+  },
+  DiskSpaceBench.options("stat_many",
+    inputs: Map.new([1, 10, 100, 1000], &{"#{&1} paths", List.duplicate(path, &1)})
+  )
+)
+
+# Dirty versus regular scheduler under load from one process per scheduler
+Benchee.run(
+  %{
+    "dirty I/O scheduler (default)" => fn -> DiskSpace.stat(path) end,
+    "calling scheduler (adaptive: true)" => fn -> DiskSpace.stat(path, adaptive: true) end,
+    "native worker pool (stat_async/2)" => fn -> DiskSpace.stat_async(path) end
+  },
+  DiskSpaceBench.options("schedulers", parallel: System.schedulers_online())
+)
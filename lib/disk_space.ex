@@ -7,10 +7,41 @@ defmodule DiskSpace do
 
   The main function `stat/2` returns disk space stats for a given filesystem path.
 
+  `stat_many/2` does the same for a list of paths in a single NIF call.
+
+  `stat_async/2` runs the query on a bounded native thread pool instead of a dirty scheduler,
+  and gives up after a timeout, so that hung network mounts cannot starve the VM.
+
+  For paths that are polled repeatedly, `open/1` returns a handle to the directory that
+  `stat_handle/2` can query without resolving the path again.
+
   It also provides a bang variant `stat!/2`, which raises a `DiskSpace.Error` exception on error.
 
   Both functions support optionally humanizing the output into
   strings (`:humanize` and `:base` options).
+
+  ## Telemetry
+
+  `stat/2`, `stat_many/2`, `stat_async/2`, `open/1`, `stat_handle/2`, `mounts/1`, `usage/2`
+  and `usage_async/2` run inside a `:telemetry.span/3`, emitting `[:disk_space, name, :start]`,
+  `[:disk_space, name, :stop]` and `[:disk_space, name, :exception]` where `name` is `:stat`,
+  `:stat_many`, `:stat_async`, `:open`, `:stat_handle`, `:mounts`, `:usage` or `:usage_async`.
+  The metadata has the `:opts` of the call (except for `open/1`) and its `:path` (`:paths`
+  for `stat_many/2`, `:handle` for `stat_handle/2`, none for `mounts/1`); the `:stop`
+  metadata adds the `:result`. `stat/2` with `coalesce: true` runs a `:stat_async` span
+  inside its `:stat` span.
+
+  `DiskSpace.Cache.stat/2` emits `[:disk_space, :cache, :stat, event]` with the `:path`,
+  `:opts` and `:cache` (the cache name), plus `:hit` (whether the entry was fresh) in the
+  `:stop` metadata. `DiskSpace.Cluster.stat/2` emits `[:disk_space, :cluster, :stat, event]`
+  with the `:path`, `:opts` and `:nodes`, plus the `:timed_out` nodes in the `:stop`
+  metadata.
+
+  With `native_timing: true` (or `config :disk_space, native_timing: true`), the `:stop`
+  event of `stat/2` also has the measurements `:check_time` and `:space_time`, the time the
+  NIF spent in the directory check and in the space syscall, in `:native` time units. The
+  rest of `:duration` is the wait for a dirty scheduler and the marshaling of terms. Native
+  timing is off by default, and then no clock is read in the NIF.
   """
 
   # @on_load :load_nifs
@@ -39,7 +70,58 @@ defmodule DiskSpace do
   # end
 
   # stub with minimal arity for NIF binding
-  defp stat_fs(_path), do: :erlang.nif_error(:nif_not_loaded)
+  defp stat_fs(_path, _format, _validate), do: :erlang.nif_error(:nif_not_loaded)
+  defp stat_fs_timed(_path, _format, _validate), do: :erlang.nif_error(:nif_not_loaded)
+  defp stat_fs_local(_path, _format, _validate), do: :erlang.nif_error(:nif_not_loaded)
+  defp stat_fs_classify(_path, _format, _validate), do: :erlang.nif_error(:nif_not_loaded)
+  defp stat_fs_extended(_path, _validate), do: :erlang.nif_error(:nif_not_loaded)
+  defp stat_fs_many(_paths, _format, _validate), do: :erlang.nif_error(:nif_not_loaded)
+  defp stat_fs_many_by_device(_paths, _format), do: :erlang.nif_error(:nif_not_loaded)
+  defp open_dir(_path), do: :erlang.nif_error(:nif_not_loaded)
+  defp stat_handle_fs(_handle, _format), do: :erlang.nif_error(:nif_not_loaded)
+  defp close_dir(_handle), do: :erlang.nif_error(:nif_not_loaded)
+  defp stat_fs_async(_path, _ref, _coalesce, _format, _validate),
+    do: :erlang.nif_error(:nif_not_loaded)
+  defp cancel_async(_ticket), do: :erlang.nif_error(:nif_not_loaded)
+  defp configure_async_pool(_max_workers, _max_queue), do: :erlang.nif_error(:nif_not_loaded)
+  defp list_mounts(_include_pseudo), do: :erlang.nif_error(:nif_not_loaded)
+  defp disk_usage(_path, _threads, _one_file_system, _io_uring, _index, _top, _rank_by),
+    do: :erlang.nif_error(:nif_not_loaded)
+
+  defp usage_scan_start(
+         _path,
+         _threads,
+         _one_file_system,
+         _io_uring,
+         _index,
+         _top,
+         _rank_by,
+         _progress_ms
+       ),
+       do: :erlang.nif_error(:nif_not_loaded)
+
+  defp usage_scan_cancel(_scan), do: :erlang.nif_error(:nif_not_loaded)
+
+  # used by DiskSpace.Snapshot
+  @doc false
+  def snapshot_new(_capacity, _interval_ms, _timeout_ms, _window),
+    do: :erlang.nif_error(:nif_not_loaded)
+  @doc false
+  def snapshot_stop(_table), do: :erlang.nif_error(:nif_not_loaded)
+  @doc false
+  def snapshot_register(_table, _path), do: :erlang.nif_error(:nif_not_loaded)
+  @doc false
+  def snapshot_unregister(_table, _slot, _generation), do: :erlang.nif_error(:nif_not_loaded)
+  @doc false
+  def snapshot_read(_table, _slot, _generation, _format), do: :erlang.nif_error(:nif_not_loaded)
+  @doc false
+  def snapshot_forecast(_table, _slot, _generation), do: :erlang.nif_error(:nif_not_loaded)
+
+  # used by DiskSpace.MountWatcher
+  @doc false
+  def mount_watcher_start(_interval_ms), do: :erlang.nif_error(:nif_not_loaded)
+  @doc false
+  def mount_watcher_stop(_watcher), do: :erlang.nif_error(:nif_not_loaded)
 
   @doc """
   Retrieves disk space statistics for the given `path`.
@@ -56,25 +138,654 @@ defmodule DiskSpace do
 
     * `:used` - the number of bytes currently used (total - free).
 
+  With `extended: true`, the map also has these keys, taken from the same system call:
+
+    * `:inodes_total` and `:inodes_free` - the number of inodes (file slots) on the filesystem
+      and how many of them are free; `nil` on Windows, where volumes have no fixed inode table.
+
+    * `:block_size` - the filesystem's block size (the cluster size on Windows), in bytes.
+
+    * `:fs_type` - the filesystem type as a string, e.g. `"ext4"`, `"apfs"` or `"NTFS"`, or `nil`
+      where the platform does not report it. On Linux it is derived from the `statfs` magic
+      number (ext2 and ext3 report `"ext4"`), with unknown types given as hex, e.g.
+      `"0x65735546"`.
+
+    * `:fsid` - the filesystem ID as an integer (the volume serial number on Windows), the same
+      for all paths on one filesystem and distinct between mounted filesystems.
+
     Returns `{:error, info}` if the operation fails, where `info` is a map with keys `:reason` and `:info`; `:reason` is always an atom, `:info` provides more information or is `nil`, depending on what is reported by the NIF.
 
   ## Options
 
     * `:humanize` (`nil`, `:binary`, or `:decimal`) - whether to convert byte counts into human-readable strings.
       Defaults to `nil`. If non-`nil`, the atom denotes the base used for human-readable formatting. See `humanize/2`.
+
+    * `:coalesce` (boolean) - share one in-flight query among all concurrent callers for the same `path`.
+      Defaults to `false`. If `true`, the query runs through the native worker pool of `stat_async/2`
+      (waiting without a timeout unless `:timeout` is also given), and callers that arrive while a query
+      for `path` is in flight wait for its result instead of issuing their own. See `async_pool_info/0`
+      for the number of coalesced calls.
+
+    * `:extended` (boolean) - add the inode counts, block size, filesystem type and ID described
+      above. Defaults to `false`. `:humanize` only applies to the byte counts. Ignored with
+      `:coalesce`.
+
+    * `:format` - the shape of the stats on success. Defaults to `:map`. One of:
+      * `:map` - the `stats_map` described above
+      * `:tuple` - `{available, free, total, used}`
+      * `{:fields, fields}` - a map with only the listed keys among `:available`, `:free`,
+        `:total` and `:used`, e.g. `{:fields, [:available]}`
+
+      The NIF builds only the requested term, so pollers that read one figure do not pay for
+      the others. Ignored with `:extended`. `:humanize` applies to every format.
+
+    * `:validate` (boolean) - check that `path` is an existing directory before querying its
+      filesystem. Defaults to `true`. With `false`, the space query runs directly and the
+      `:not_directory`/`:invalid_path` errors are derived from its error code, which saves one
+      path lookup (a network round trip on NFS or SMB) per call. Only for paths known to be
+      directories: on Unix, a path to a regular file then reports the filesystem holding it.
+
+    * `:adaptive` (boolean) - query paths on local filesystems on the calling scheduler.
+      Defaults to `false`, where every query runs on a dirty I/O scheduler. For a local disk
+      or tmpfs the space syscall takes microseconds, less than the hand-off to a dirty
+      scheduler. With `true`, each query records whether `path` is on a local filesystem
+      (by filesystem type on Unix, by drive type on Windows; cached per filesystem), and later
+      queries for a path last seen on one run inline. Network filesystems (NFS, SMB, FUSE)
+      and unknown types always go through the dirty scheduler, as does a path after a failed
+      query. The classes are dropped when the mount table changes (detected on Linux, or by a
+      running `DiskSpace.MountWatcher`), and are trusted for at most 10 seconds since the last
+      query of the path on the dirty scheduler. Ignored with `:coalesce` and `:extended`.
+
+    * `:errstr` (boolean) - include the OS error description as `:errstr` in the `:info` of
+      errors. Defaults to `true`. Descriptions are cached per error code; with `false`, `:info`
+      is just `%{errno: code}`, so failing calls cost no more than successful ones. Ignored
+      with `:extended`.
+
+    * `:native_timing` (boolean) - measure the syscalls in the NIF for the `[:disk_space, :stat,
+      :stop]` telemetry event (see the module documentation). Defaults to the `:native_timing`
+      application environment value, or `false`. Ignored with `:coalesce`, `:extended` and
+      `:adaptive`.
+
+  ## Examples
+
+      {:ok, {available, _free, _total, _used}} = DiskSpace.stat("/var", format: :tuple)
+
+      {:ok, %{available: available}} = DiskSpace.stat("/var", format: {:fields, [:available]})
   """
 
+  # the options that take stat/2 off the stat_fs path, and so off native timing
+  @untimed_opts [:coalesce, :extended, :adaptive]
+
   # no point in a guard, as the stub function is replaced and
   # lib.rs already checks the type of the path argument
   def stat(path, opts \\ []) when is_bitstring(path) and is_list(opts) do
+    span(:stat, %{path: path, opts: opts}, fn ->
+      if native_timing?(opts) and not Enum.any?(@untimed_opts, &Keyword.get(opts, &1, false)) do
+        stat_timed(path, opts)
+      else
+        {stat_untimed(path, opts), %{}}
+      end
+    end)
+  end
+
+  defp native_timing?(opts) do
+    Keyword.get_lazy(opts, :native_timing, fn ->
+      Application.get_env(:disk_space, :native_timing, false)
+    end)
+  end
+
+  defp stat_timed(path, opts) do
+    {result, check_ns, space_ns} =
+      stat_fs_timed(path, stat_format(opts), Keyword.get(opts, :validate, true))
+
+    measurements = %{
+      check_time: System.convert_time_unit(check_ns, :nanosecond, :native),
+      space_time: System.convert_time_unit(space_ns, :nanosecond, :native)
+    }
+
+    result = result |> reshape_error_tuple() |> maybe_humanize(Keyword.get(opts, :humanize))
+    {result, measurements}
+  end
+
+  defp stat_untimed(path, opts) do
+    humanize = Keyword.get(opts, :humanize, nil)
+
+    cond do
+      Keyword.get(opts, :coalesce, false) ->
+        path
+        |> stat_async(Keyword.put_new(opts, :timeout, :infinity))
+
+      Keyword.get(opts, :extended, false) ->
+        path
+        |> stat_fs_extended(Keyword.get(opts, :validate, true))
+        |> reshape_error_tuple()
+        |> humanize_keys([:available, :free, :total, :used], humanize)
+
+      Keyword.get(opts, :adaptive, false) ->
+        path
+        |> stat_adaptive(stat_format(opts), Keyword.get(opts, :validate, true))
+        |> reshape_error_tuple()
+        |> maybe_humanize(humanize)
+
+      true ->
+        path
+        |> stat_fs(stat_format(opts), Keyword.get(opts, :validate, true))
+        |> reshape_error_tuple()
+        |> maybe_humanize(humanize)
+    end
+  end
+
+  @doc """
+  Retrieves disk space statistics for each path in `paths`, in a single call to the NIF.
+
+  Returns a list with one `{:ok, stats_map}` or `{:error, info}` entry per path, in the same
+  order as `paths`. Each entry has exactly the shape that `stat/2` returns for that path, so a
+  failing path does not affect the results of the others.
+
+  ## Options
+
+  Same as `stat/2` (except `:coalesce` and `:extended`), plus:
+
+    * `:dedupe_by_device` (boolean) - query each filesystem only once.
+      Defaults to `false`. Paths are grouped by device (`st_dev` on Unix, volume root on Windows)
+      after the directory check, the space syscall runs once per group and its result is
+      shared by every path in the group. The return value then becomes `{results, devices}`,
+      where `results` is the list described above and `devices` is a list of
+      `{device_id, paths}` tuples (in order of first appearance) telling which paths share a device.
+      Paths that fail the directory check are not part of any group.
+      The check is what finds each path's device, so `:validate` is ignored here.
+      On Windows, the volume root of each path is cached natively (for a minute, or until a
+      running `DiskSpace.MountWatcher` sees the volume list change), so repeated batches do
+      not resolve it again, and each volume is queried with `GetDiskSpaceInformationW` where
+      the OS has it.
+
+  ## Examples
+
+      iex> DiskSpace.stat_many([])
+      []
+
+      iex> DiskSpace.stat_many([], dedupe_by_device: true)
+      {[], []}
+
+  """
+  def stat_many(paths, opts \\ []) when is_list(paths) and is_list(opts),
+    do: span(:stat_many, %{paths: paths, opts: opts}, fn -> {do_stat_many(paths, opts), %{}} end)
+
+  defp do_stat_many(paths, opts) do
+    humanize = Keyword.get(opts, :humanize, nil)
+    format = stat_format(opts)
+
+    if Keyword.get(opts, :dedupe_by_device, false) do
+      {results, groups} = stat_fs_many_by_device(paths, format)
+      indexed_paths = List.to_tuple(paths)
+
+      devices =
+        Enum.map(groups, fn {device, indices} ->
+          {device, Enum.map(indices, &elem(indexed_paths, &1))}
+        end)
+
+      {reshape_results(results, humanize), devices}
+    else
+      paths
+      |> stat_fs_many(format, Keyword.get(opts, :validate, true))
+      |> reshape_results(humanize)
+    end
+  end
+
+  @doc """
+  Returns a lazy, infinite stream of the disk space of `paths`, sampled at most once per
+  `:interval`.
+
+  Each element is the result of one native call for all paths: what `stat_many/2` returns for
+  `paths` by default, or a list of `{:ok, stats_map}` / `{:error, info}` entries read from a
+  `DiskSpace.Snapshot` process with `source: :snapshot`.
+
+  Nothing is sampled ahead of demand. An element is taken when the consumer asks for it, after
+  waiting out the rest of the interval since the previous one, so a consumer that falls behind
+  never sees a backlog of stale samples, only the current value.
+
+      DiskSpace.stream(["/var/lib/app", "/tmp"], interval: 5_000)
+      |> Stream.each(&report/1)
+      |> Stream.run()
+
+  ## Options
+
+  Same as `stat_many/2` (or the `:format` option of `DiskSpace.Snapshot.read/3` with
+  `source: :snapshot`), plus:
+
+    * `:interval` (non-negative integer) - the least time between two elements, in
+      milliseconds. Defaults to `1000`.
+    * `:source` - `:stat` (default) to query the paths, or `:snapshot` to read the snapshots
+      of paths registered with a `DiskSpace.Snapshot` process.
+    * `:name` (atom) - the name of the `DiskSpace.Snapshot` process with `source: :snapshot`.
+      Defaults to `DiskSpace.Snapshot`.
+
+  ## Examples
+
+      iex> DiskSpace.stream([], interval: 0) |> Enum.take(2)
+      [[], []]
+
+  """
+  def stream(paths, opts \\ []) when is_list(paths) and is_list(opts) do
+    {interval, opts} = Keyword.pop(opts, :interval, 1000)
+    {source, opts} = Keyword.pop(opts, :source, :stat)
+    sample = stream_source(source, paths, opts)
+
+    Stream.unfold(System.monotonic_time(:millisecond), fn due ->
+      wait = due - System.monotonic_time(:millisecond)
+      if wait > 0, do: Process.sleep(wait)
+      {sample.(), System.monotonic_time(:millisecond) + interval}
+    end)
+  end
+
+  defp stream_source(:stat, paths, opts), do: fn -> stat_many(paths, opts) end
+
+  defp stream_source(:snapshot, paths, opts) do
+    {name, opts} = Keyword.pop(opts, :name, DiskSpace.Snapshot)
+
+    fn ->
+      Enum.map(paths, fn path ->
+        case DiskSpace.Snapshot.read(path, name, opts) do
+          {:ok, stats, _age} -> {:ok, stats}
+          {:error, info, _age} -> {:error, info}
+          {:error, _info} = error -> error
+        end
+      end)
+    end
+  end
+
+  @doc """
+  Same as `stat/2`, but runs the syscalls on a bounded native worker pool and waits at most
+  `:timeout` milliseconds for the result.
+
+  The calling process never occupies a dirty scheduler: the NIF only queues the query and the
+  result arrives as a message. If it does not arrive in time, the query is abandoned and
+  `{:error, %{reason: :timeout, info: nil}}` is returned; a worker that is stuck in the kernel
+  (e.g. on an unreachable NFS server) stays stuck, but is counted in `async_pool_info/0` and
+  never spawns more workers than the configured cap. When the queue is full,
+  `{:error, %{reason: :busy, info: nil}}` is returned immediately.
+
+  ## Options
+
+  `:humanize`, `:format`, `:validate` and `:errstr` as for `stat/2`, plus:
+
+    * `:timeout` (non-negative integer or `:infinity`) - how long to wait for the result, in
+      milliseconds. Defaults to `5000`.
+
+    * `:coalesce` (boolean) - join a query for the same `path` that is already in flight instead of
+      queueing a new one. Defaults to `false`. Only queries with the same `:validate` are joined;
+      each caller still gets the result in its own `:format` and has its own `:timeout`.
+  """
+  def stat_async(path, opts \\ []) when is_bitstring(path) and is_list(opts),
+    do: span(:stat_async, %{path: path, opts: opts}, fn -> {do_stat_async(path, opts), %{}} end)
+
+  defp do_stat_async(path, opts) do
+    humanize = Keyword.get(opts, :humanize, nil)
+    timeout = Keyword.get(opts, :timeout, 5000)
+    coalesce = Keyword.get(opts, :coalesce, false)
+    validate = Keyword.get(opts, :validate, true)
+    ref = make_ref()
+
+    result =
+      case stat_fs_async(path, ref, coalesce, stat_format(opts), validate) do
+        {:ok, ticket} -> await_async(ref, ticket, timeout)
+        error -> error
+      end
+
+    result
+    |> reshape_error_tuple()
+    |> maybe_humanize(humanize)
+  end
+
+  defp stat_adaptive(path, format, validate) do
+    case stat_fs_local(path, format, validate) do
+      :dirty -> stat_fs_classify(path, format, validate)
+      result -> result
+    end
+  end
+
+  defp await_async(ref, ticket, timeout) do
+    receive do
+      {:disk_space_stat, ^ref, result} -> result
+    after
+      timeout ->
+        if cancel_async(ticket) do
+          {:error, :timeout}
+        else
+          # the worker won the race, so its message is already on the way
+          receive do
+            {:disk_space_stat, ^ref, result} -> result
+          end
+        end
+    end
+  end
+
+  @doc """
+  Sets the limits of the native worker pool used by `stat_async/2`.
+
+  ## Options
+
+    * `:max_workers` (positive integer) - the maximum number of OS threads. Defaults to `16`.
+    * `:max_queue` (non-negative integer) - the maximum number of queries waiting for a worker;
+      beyond that, `stat_async/2` fails with `:busy`. Defaults to `1024`.
+  """
+  def configure_async(opts) when is_list(opts) do
+    info = async_pool_info()
+    max_workers = Keyword.get(opts, :max_workers, info.max_workers)
+    max_queue = Keyword.get(opts, :max_queue, info.max_queue)
+    configure_async_pool(max_workers, max_queue)
+  end
+
+  @doc """
+  Returns counters of the native worker pool used by `stat_async/2`, as a map with keys:
+
+    * `:max_workers`, `:max_queue` - the configured limits (see `configure_async/1`).
+    * `:workers` - OS threads currently alive; idle ones exit after 30 seconds.
+    * `:busy` - workers currently running a query.
+    * `:queued` - queries waiting for a worker.
+    * `:stuck` - queries whose caller already timed out but that are still blocked in the OS.
+    * `:rejected` - queries refused with `:busy` since the pool started.
+    * `:coalesced` - calls (with `coalesce: true`) that joined an in-flight query for the same path
+      instead of running their own, since the pool started.
+  """
+  def async_pool_info, do: :erlang.nif_error(:nif_not_loaded)
+
+  @doc """
+  Opens the directory at `path` for repeated queries with `stat_handle/2`.
+
+  The directory check of `stat/2` happens once, here; the returned handle keeps the directory
+  open (a file descriptor on Unix, a directory handle on Windows), so later queries skip path
+  lookup entirely. The handle is released by `close/1` or when it is garbage-collected.
+
+  Returns `{:ok, handle}` or `{:error, info}` with the same `info` shape as `stat/2`.
+  """
+  def open(path) when is_bitstring(path),
+    do: span(:open, %{path: path}, fn -> {path |> open_dir() |> reshape_error_tuple(), %{}} end)
+
+  @doc """
+  Retrieves disk space statistics for the filesystem of a directory opened with `open/1`.
+
+  Returns the same `{:ok, stats_map}` or `{:error, info}` as `stat/2`, and accepts its
+  `:humanize` and `:format` options. Querying a handle after `close/1` returns `{:error, %{reason: :closed, info: nil}}`.
+  """
+  def stat_handle(handle, opts \\ []) when is_reference(handle) and is_list(opts) do
+    span(:stat_handle, %{handle: handle, opts: opts}, fn ->
+      result =
+        handle
+        |> stat_handle_fs(stat_format(opts))
+        |> reshape_error_tuple()
+        |> maybe_humanize(Keyword.get(opts, :humanize, nil))
+
+      {result, %{}}
+    end)
+  end
+
+  @doc """
+  Releases the directory held by a handle from `open/1`. Closing twice is harmless.
+  """
+  def close(handle) when is_reference(handle) do
+    _ = close_dir(handle)
+    :ok
+  end
+
+  @doc """
+  Lists every mounted filesystem and retrieves its disk space statistics, in a single call to
+  the NIF.
+
+  The mount table is read natively (`/proc/self/mountinfo` on Linux, `getmntinfo(3)` on macOS
+  and the BSDs, the volume list on Windows). Returns `{:ok, mounts}`, where each mount is a map
+  with keys:
+
+    * `:mount_point` - the directory the filesystem is mounted on
+    * `:device` - the mounted device or source (e.g. `/dev/sda1`, or a volume GUID path on
+      Windows)
+    * `:fs_type` - the filesystem type (e.g. `ext4`, `apfs`, `NTFS`)
+    * `:result` - `{:ok, stats_map}` or `{:error, info}`, with the same shape as `stat/2`
+
+  If the mount table itself cannot be read, returns `{:error, info}` with reason
+  `:mount_table_failed`.
+
+  ## Options
+
+    * `:include_pseudo` (boolean) - also list pseudo filesystems such as `proc`, `sysfs`,
+      `cgroup` or `overlay`. Defaults to `false`, in which case they are skipped natively and never
+      queried. Has no effect on Windows.
+    * `:humanize` - same as for `stat/2`, applied to each successful `:result`.
+  """
+  def mounts(opts \\ []) when is_list(opts),
+    do: span(:mounts, %{opts: opts}, fn -> {do_mounts(opts), %{}} end)
+
+  defp do_mounts(opts) do
     humanize = Keyword.get(opts, :humanize, nil)
 
+    case list_mounts(Keyword.get(opts, :include_pseudo, false)) do
+      {:ok, entries} ->
+        {:ok,
+         Enum.map(entries, fn {mount_point, device, fs_type, result} ->
+           %{
+             mount_point: mount_point,
+             device: device,
+             fs_type: fs_type,
+             result: result |> reshape_error_tuple() |> maybe_humanize(humanize)
+           }
+         end)}
+
+      error ->
+        reshape_error_tuple(error)
+    end
+  end
+
+  @doc """
+  Walks the directory tree below `path` and returns how much space it uses, like `du -s`.
+
+  Unlike `stat/2`, which reports filesystem-wide figures, this visits every entry below `path`,
+  so it takes time proportional to the size of the tree. The walk runs natively on several
+  threads that steal work from each other. Symbolic links are not followed, and a file with
+  several hard links is counted only once.
+
+  Returns `{:ok, usage_map}` with keys:
+
+    * `:apparent_size` - the sum of the file sizes, in bytes
+    * `:allocated_size` - the space actually allocated on disk (`st_blocks` on Unix, sizes
+      rounded up to the cluster size on Windows), in bytes
+    * `:files` - the number of non-directory entries
+    * `:dirs` - the number of directories, including `path` itself
+    * `:errors` - the number of entries that could not be read; they are skipped
+
+  With the `:top` option, the map also has:
+
+    * `:largest_files` - the largest files as `{path, size}` tuples, largest first
+    * `:largest_dirs` - the largest directories by the size of everything below them
+      (including `path` itself), in the same form
+
+  Paths start with `path` as given. Each walker thread keeps only its own `:top` largest entries
+  and they are merged at the end, so ranking a tree of any size takes memory proportional to
+  `:top`, not to the number of entries.
+
+  Returns `{:error, info}` with the same shape as `stat/2` if `path` is not a readable directory.
+
+  ## Options
+
+    * `:threads` (positive integer) - the number of threads walking the tree. Defaults to
+      `System.schedulers_online/0`.
+    * `:one_file_system` (boolean) - do not descend into directories on other filesystems, like
+      `du -x`. Defaults to `false`.
+    * `:io_uring` (boolean) - on Linux, query the entries of each directory with batches of
+      `IORING_OP_STATX` on a per-thread io_uring instead of one `fstatat` call per entry.
+      Defaults to `false`. Falls back to `fstatat` automatically when io_uring is unavailable
+      (older kernels, seccomp, `kernel.io_uring_disabled`). The kernel runs these `statx` calls
+      on its own worker threads, which costs more than it saves on local filesystems; measure
+      before enabling it, e.g. on high-latency network storage. Ignored on other platforms.
+    * `:top` (non-negative integer) - how many of the largest files and directories to return.
+      Defaults to `0` (none). Every directory is listed when ranking, so `:index` records are
+      written but not reused.
+    * `:rank_by` (`:apparent_size` or `:allocated_size`) - the size to rank by. Defaults to
+      `:apparent_size`.
+    * `:index` (path or `nil`) - a file in which to keep what the walk found in each
+      directory, so that later walks of the same tree only list the directories that changed.
+      See "Incremental walks" below. Defaults to `nil`. Ignored on Windows.
+    * `:humanize` - same as for `stat/2`, applied to `:apparent_size` and `:allocated_size`.
+
+  ## Incremental walks
+
+  With `:index`, the walk reads the index left by the previous walk, if any, and writes a new
+  one when it has finished. For every directory, the index records its inode, mtime and ctime
+  and the totals of its entries. A directory whose mtime and ctime are unchanged is not listed,
+  and its entries are not queried: its recorded totals are used instead. Its subdirectories are
+  still opened, because a change deep in the tree does not touch the timestamps of the
+  directories above it. A rescan of a tree where little has changed then costs about one
+  system call per directory instead of one per entry.
+
+  Because directory timestamps only change when entries are created, removed or renamed, a file
+  that is rewritten in place keeps its recorded size until something in its directory changes.
+  Directories changed less than a second before the walk started are not recorded.
+
+  The index is replaced atomically (written to a temporary file next to it, then renamed), so
+  a walk reading it never sees a partial file. Other processes should not modify it in place.
+  An index that is missing, damaged, left by an incompatible version, or written with a
+  different `:one_file_system` setting is ignored. If the new index cannot be written, the walk
+  returns `{:error, %{reason: :index_write_failed, info: info}}`.
+
+  ## Examples
+
+      DiskSpace.usage("/srv/tenants/acme", index: "/var/cache/acme.usage")
+
+      {:ok, %{largest_files: [{path, size} | _]}} =
+        DiskSpace.usage("/var", top: 100, rank_by: :allocated_size, one_file_system: true)
+
+  """
+  def usage(path, opts \\ []) when is_bitstring(path) and is_list(opts),
+    do: span(:usage, %{path: path, opts: opts}, fn -> {do_usage(path, opts), %{}} end)
+
+  defp do_usage(path, opts) do
+    humanize = Keyword.get(opts, :humanize, nil)
+    threads = Keyword.get(opts, :threads, System.schedulers_online())
+
     path
-    |> stat_fs()
+    |> disk_usage(
+      threads,
+      Keyword.get(opts, :one_file_system, false),
+      Keyword.get(opts, :io_uring, false),
+      index_path(opts),
+      Keyword.get(opts, :top, 0),
+      Keyword.get(opts, :rank_by, :apparent_size)
+    )
     |> reshape_error_tuple()
-    |> then(fn stats -> if not is_nil(humanize), do: humanize(stats, humanize), else: stats end)
+    |> humanize_usage(humanize)
+  end
+
+  @doc """
+  Starts the walk of `usage/2` in the background and returns `{:ok, scan}` right away.
+
+  `scan` is a reference that tags every message sent to the calling process about the walk:
+
+    * `{:disk_space_progress, scan, %{files: files, bytes: bytes, dirs: dirs}}` - running
+      totals so far (`bytes` is the apparent size), sent at most once per `:progress_interval`.
+      The walker threads only update shared counters; a native reporter thread samples them,
+      so the mailbox sees one message per interval however many entries are visited.
+    * `{:disk_space_usage, scan, result}` - sent once when the walk is over, where `result` has
+      exactly the shape `usage/2` returns.
+
+  Stop the walk early with `cancel/1`. If the calling process exits, the walk is cancelled and
+  its threads and resources are released.
+
+  Returns `{:error, info}` only if `path` cannot be passed to the NIF; a path that is not a
+  directory is reported in the `:disk_space_usage` message.
+
+  ## Options
+
+  Same as `usage/2` (except `:humanize`), plus:
+
+    * `:progress_interval` (positive integer or `nil`) - the interval between progress messages,
+      in milliseconds. Defaults to `1000`. If `nil`, only the final message is sent.
+
+  ## Examples
+
+      {:ok, scan} = DiskSpace.usage_async("/srv/tenants/acme", progress_interval: 500)
+
+      receive do
+        {:disk_space_usage, ^scan, {:ok, usage}} -> usage
+      end
+
+  """
+  def usage_async(path, opts \\ []) when is_bitstring(path) and is_list(opts),
+    do: span(:usage_async, %{path: path, opts: opts}, fn -> {do_usage_async(path, opts), %{}} end)
+
+  defp do_usage_async(path, opts) do
+    threads = Keyword.get(opts, :threads, System.schedulers_online())
+    one_file_system = Keyword.get(opts, :one_file_system, false)
+    io_uring = Keyword.get(opts, :io_uring, false)
+    progress_ms = Keyword.get(opts, :progress_interval, 1000) || 0
+
+    top = Keyword.get(opts, :top, 0)
+    rank_by = Keyword.get(opts, :rank_by, :apparent_size)
+
+    path
+    |> usage_scan_start(
+      threads,
+      one_file_system,
+      io_uring,
+      index_path(opts),
+      top,
+      rank_by,
+      progress_ms
+    )
+    |> reshape_error_tuple()
+  end
+
+  defp index_path(opts) do
+    case Keyword.get(opts, :index) do
+      nil -> nil
+      index -> IO.chardata_to_string(index)
+    end
+  end
+
+  @doc """
+  Cancels a walk started with `usage_async/2`.
+
+  The walker threads stop at the next directory entry. No message about `scan` is sent after this
+  returns, and any such messages already in the mailbox of the calling process are removed.
+  Cancelling a finished or already cancelled walk is harmless.
+  """
+  def cancel(scan) when is_reference(scan) do
+    usage_scan_cancel(scan)
+    flush_scan(scan)
+  end
+
+  defp flush_scan(scan) do
+    receive do
+      {:disk_space_progress, ^scan, _} -> flush_scan(scan)
+      {:disk_space_usage, ^scan, _} -> flush_scan(scan)
+    after
+      0 -> :ok
+    end
+  end
+
+  defp humanize_usage(result, base_type),
+    do: humanize_keys(result, [:apparent_size, :allocated_size], base_type)
+
+  # Humanize only the byte counts among other values
+  defp humanize_keys({:ok, map}, keys, base_type) when not is_nil(base_type) do
+    {:ok, Map.merge(map, humanize(Map.take(map, keys), base_type))}
   end
 
+  defp humanize_keys(result, _keys, _base_type), do: result
+
+  @doc """
+  Estimates how fast the filesystem of `path` is filling up and when it will be full.
+
+  The estimate is the least-squares fit of used space over the last samples that a running
+  `DiskSpace.Snapshot` took of `path`, which must be registered with it; see
+  `DiskSpace.Snapshot.forecast/2`.
+
+  ## Options
+
+    * `:name` (atom) - the name of the `DiskSpace.Snapshot` process. Defaults to
+      `DiskSpace.Snapshot`.
+  """
+  def forecast(path, opts \\ []) when is_bitstring(path) and is_list(opts),
+    do: DiskSpace.Snapshot.forecast(path, Keyword.get(opts, :name, DiskSpace.Snapshot))
+
   @doc """
   Same as `stat/2` (and with the same `opts` keyword-list options), but returns the `stats_map` plain Elixir map directly or raises `DiskSpace.Error` on failure.
   """
@@ -85,14 +796,76 @@ defmodule DiskSpace do
     end
   end
 
+  # :telemetry.span/3 under [:disk_space | name], with the result in the :stop metadata;
+  # `fun` returns the result, any measurements to add and optionally more :stop metadata.
+  # Used by DiskSpace.Cache and DiskSpace.Cluster.
+  @doc false
+  def span(name, metadata, fun) do
+    :telemetry.span([:disk_space | List.wrap(name)], metadata, fn ->
+      case fun.() do
+        {result, measurements} ->
+          {result, measurements, Map.put(metadata, :result, result)}
+
+        {result, measurements, stop_metadata} ->
+          {result, measurements, metadata |> Map.merge(stop_metadata) |> Map.put(:result, result)}
+      end
+    end)
+  end
+
   defp reshape_error_tuple({:error, reason}), do: {:error, %{reason: reason, info: nil}}
   defp reshape_error_tuple({:error, reason, info}), do: {:error, %{reason: reason, info: info}}
   defp reshape_error_tuple({:ok, stats_map} = success) when is_map(stats_map), do: success
+  defp reshape_error_tuple({:ok, stats_tuple} = success) when is_tuple(stats_tuple), do: success
+  defp reshape_error_tuple({:ok, handle} = success) when is_reference(handle), do: success
+
+  defp reshape_results(results, humanize) do
+    Enum.map(results, &(&1 |> reshape_error_tuple() |> maybe_humanize(humanize)))
+  end
+
+  defp maybe_humanize(stats, nil), do: stats
+  defp maybe_humanize(stats, base_type), do: humanize(stats, base_type)
+
+  @stat_fields [:available, :free, :total, :used]
+  # the NIF's encoding of `:format` and `:errstr`: bits 0-3 select the map
+  # fields in the order of @stat_fields, bit 4 asks for the tuple, bit 5
+  # leaves the errstr out of error details
+  @format_tuple 0b10000
+  @format_errno_only 0b100000
+
+  # used by DiskSpace.Snapshot
+  @doc false
+  def stat_format(opts) do
+    if Keyword.get(opts, :errstr, true),
+      do: format_bits(opts),
+      else: Bitwise.bor(format_bits(opts), @format_errno_only)
+  end
+
+  defp format_bits(opts) do
+    case Keyword.get(opts, :format, :map) do
+      :map ->
+        0b1111
+
+      :tuple ->
+        @format_tuple
+
+      {:fields, fields} when is_list(fields) ->
+        Enum.reduce(fields, 0, fn field, mask -> Bitwise.bor(mask, field_bit(field)) end)
+
+      other ->
+        raise ArgumentError, "invalid :format option: #{inspect(other)}"
+    end
+  end
+
+  for {field, index} <- Enum.with_index(@stat_fields) do
+    defp field_bit(unquote(field)), do: unquote(Bitwise.bsl(1, index))
+  end
+
+  defp field_bit(field), do: raise(ArgumentError, "unknown stats field: #{inspect(field)}")
 
   @doc """
   Converts disk space statistics coming from `stat/2` and `stat!/2` from raw byte counts to human-readable strings.
 
-  Accepts either a tuple `{:ok, stats_map}` (from `stat/2`) or a `stats_map` plain Elixir map (from a successful `stat!/2`), where the key values of `stats_map` are integer byte counts.  Transparent for `{:error, info}` tuples returned from `stat/2`.
+  Accepts either a tuple `{:ok, stats_map}` (from `stat/2`) or a `stats_map` plain Elixir map (from a successful `stat!/2`), where the key values of `stats_map` are integer byte counts.  Also accepts the `{available, free, total, used}` tuple of `format: :tuple`, with or without `:ok`.  Transparent for `{:error, info}` tuples returned from `stat/2`.
 
   Returns the same structure but with all byte values converted to formatted human-readable strings (e.g., `"10 GiB"`), if the `base_type` argument value is non-`nil` and one of `:binary` (default) or `:decimal`.
 
@@ -100,6 +873,8 @@ defmodule DiskSpace do
 
     * `stats` - either `{:ok, stats_map}` or a `stats_map` with keys like `:available`, `:free`, etc. and integer values representing bytes.
     * `base_type` - formatting base, either `nil` (do not do anything) or `:binary` (default, powers of 1024) or `:decimal` (powers of 1000). If non-`nil`, the atom determines the unit suffixes (`KiB` vs `kB`, etc.).
+    * `opts` - keyword list of options:
+      * `:precision` (non-negative integer) - the number of decimals, rounded half up. Defaults to `2`. Decimals that are all zeros are left out (`"1 MB"`).
 
   ## Examples
       iex> DiskSpace.humanize({:ok, %{free: 123456789}}, nil)
@@ -111,53 +886,105 @@ defmodule DiskSpace do
       iex> DiskSpace.humanize(%{total: 1000000}, :decimal)
       %{total: "1 MB"}
 
+      iex> DiskSpace.humanize(%{free: 123456789}, :binary, precision: 0)
+      %{free: "118 MiB"}
+
       iex> DiskSpace.humanize({:error, :eio}, :binary)
       {:error, :eio}
 
       iex> DiskSpace.stat("/tmp") |> DiskSpace.humanize
 
   """
-  def humanize(_, base_type \\ :binary)
+  def humanize(stats, base_type \\ :binary, opts \\ [])
 
-  def humanize(tagged_tuple, nil) when is_tuple(tagged_tuple), do: tagged_tuple
+  def humanize(tagged_tuple, nil, _opts) when is_tuple(tagged_tuple), do: tagged_tuple
 
-  def humanize({:ok, stats}, base_type)
-      when is_map(stats) and base_type in [:binary, :decimal],
-      do: {:ok, humanize(stats, base_type)}
+  def humanize({:ok, stats}, base_type, opts)
+      when (is_map(stats) or is_tuple(stats)) and base_type in [:binary, :decimal],
+      do: {:ok, humanize(stats, base_type, opts)}
 
-  def humanize(stats, base_type) when is_map(stats) and base_type in [:binary, :decimal],
-    do:
-      Enum.map(
-        stats,
-        fn {k, v} -> {k, humanize_bytes(v, base_type)} end
-      )
-      |> Map.new()
+  def humanize(stats, base_type, opts) when is_map(stats) and base_type in [:binary, :decimal] do
+    precision = precision(opts)
+    Map.new(stats, fn {k, v} -> {k, humanize_bytes(v, base_type, precision)} end)
+  end
 
-  def humanize({:error, _} = failure, _), do: failure
+  def humanize({:error, _} = failure, _, _opts), do: failure
 
-  defp humanize_bytes(bytes, base_type)
-       when is_integer(bytes) and bytes >= 0 and base_type in [:binary, :decimal] do
-    binary_units = ["B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB"]
+  def humanize(stats, base_type, opts)
+      when tuple_size(stats) == 4 and base_type in [:binary, :decimal] do
+    precision = precision(opts)
+
+    stats
+    |> Tuple.to_list()
+    |> Enum.map(&humanize_bytes(&1, base_type, precision))
+    |> List.to_tuple()
+  end
+
+  @doc """
+  Applies `humanize/3` to every result of `stat_many/2`.
 
-    units =
-      case base_type do
-        :binary ->
-          binary_units
+  Accepts the list of results, or the `{results, devices}` tuple returned with
+  `dedupe_by_device: true`, whose `devices` are passed through. Errors are left unchanged.
 
-        :decimal ->
-          Enum.map(binary_units, &(String.replace(&1, "i", "") |> String.replace("K", "k")))
-      end
+  ## Examples
+      iex> DiskSpace.humanize_many([{:ok, %{free: 1536}}, {:error, %{reason: :not_directory, info: nil}}])
+      [{:ok, %{free: "1.50 KiB"}}, {:error, %{reason: :not_directory, info: nil}}]
+
+      iex> DiskSpace.humanize_many([{:ok, %{free: 123456789}}], :decimal, precision: 1)
+      [{:ok, %{free: "123.5 MB"}}]
+  """
+  def humanize_many(results, base_type \\ :binary, opts \\ [])
 
-    base = if base_type == :binary, do: 1024, else: 1000
-    humanize_bytes(bytes, units, base, 0)
+  def humanize_many({results, devices}, base_type, opts) when is_list(results),
+    do: {humanize_many(results, base_type, opts), devices}
+
+  def humanize_many(results, base_type, opts) when is_list(results),
+    do: Enum.map(results, &humanize(&1, base_type, opts))
+
+  defp precision(opts) do
+    case Keyword.get(opts, :precision, 2) do
+      precision when is_integer(precision) and precision >= 0 -> precision
+      other -> raise ArgumentError, "invalid :precision option: #{inspect(other)}"
+    end
+  end
+
+  @binary_units ["B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB"]
+  @decimal_units ["B", "kB", "MB", "GB", "TB", "PB", "EB"]
+  @unit_tables [binary: {1024, @binary_units}, decimal: {1000, @decimal_units}]
+
+  # One clause per unit, largest first, so that picking the unit takes integer
+  # comparisons only; 64-bit byte counts stay below 1024 EiB
+  for {base_type, {base, units}} <- @unit_tables,
+      {unit, exp} <- units |> Enum.with_index() |> Enum.reverse() do
+    divisor = Integer.pow(base, exp)
+
+    defp scale(bytes, unquote(base_type)) when bytes >= unquote(divisor),
+      do: {unquote(divisor), unquote(unit)}
   end
 
-  defp humanize_bytes(bytes, [unit | _], base, _exp) when bytes < base,
-    do: format_number(bytes) <> " " <> unit
+  defp scale(_bytes, _base_type), do: {1, "B"}
 
-  defp humanize_bytes(bytes, [_ | next_units], base, exp),
-    do: humanize_bytes(bytes / base, next_units, base, exp + 1)
+  defp humanize_bytes(bytes, base_type, precision)
+       when is_integer(bytes) and bytes >= 0 and base_type in [:binary, :decimal] do
+    {divisor, unit} = scale(bytes, base_type)
+    IO.iodata_to_binary([format_scaled(bytes, divisor, precision), ?\s, unit])
+  end
+
+  # `bytes / divisor` rounded half up to `precision` decimals, with the
+  # decimals left out when they are all zeros
+  defp format_scaled(bytes, 1, _precision), do: Integer.to_string(bytes)
+
+  defp format_scaled(bytes, divisor, precision) do
+    factor = Integer.pow(10, precision)
+    scaled = div(bytes * factor + div(divisor, 2), divisor)
 
-  defp format_number(number) when is_integer(number) or is_float(number),
-    do: :erlang.float_to_binary(number / 1.0, decimals: 2) |> String.trim_trailing(".00")
+    case rem(scaled, factor) do
+      0 ->
+        Integer.to_string(div(scaled, factor))
+
+      fraction ->
+        digits = fraction |> Integer.to_string() |> String.pad_leading(precision, "0")
+        [Integer.to_string(div(scaled, factor)), ?., digits]
+    end
+  end
 end
@@ -0,0 +1,218 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.Cache do
+  @moduledoc """
+  A TTL cache in front of `DiskSpace.stat/2`, for callers that can tolerate slightly stale data.
+
+  Results are kept in an ETS table with `read_concurrency: true`; a cache hit is a single
+  `:ets.lookup/2` in the calling process, with no NIF call and no message passing. On a miss,
+  the cache process refreshes the entry, and concurrent misses for the same path share that one
+  refresh. Error results are cached too, so an unmounted path is not queried on every call.
+
+  Add it to a supervision tree:
+
+      children = [
+        {DiskSpace.Cache, ttl: 1_000, ttls: %{"/mnt/uploads" => 250}}
+      ]
+
+  ## Options
+
+    * `:name` (atom) - the name of the process and of its ETS table. Defaults to `DiskSpace.Cache`.
+    * `:ttl` (non-negative integer) - how long a result stays fresh, in milliseconds. Defaults to `1000`.
+    * `:ttls` (map) - per-path overrides of `:ttl`, as `%{path => milliseconds}`. Defaults to `%{}`.
+    * `:stat_opts` (keyword list) - options passed to `DiskSpace.stat/2` on refresh, e.g.
+      `[coalesce: true, timeout: 2_000]`. Defaults to `[]`.
+  """
+
+  use GenServer
+
+  @hits 1
+  @misses 2
+  @refreshes 3
+  @waits 4
+
+  def start_link(opts \\ []) when is_list(opts) do
+    name = Keyword.get(opts, :name, __MODULE__)
+    GenServer.start_link(__MODULE__, Keyword.put(opts, :name, name), name: name)
+  end
+
+  @doc """
+  Same as `DiskSpace.stat/2`, but answers from the cache while the entry is fresh.
+
+  ## Options
+
+    * `:name` (atom) - the cache to use. Defaults to `DiskSpace.Cache`.
+    * `:ttl` (non-negative integer) - overrides the configured TTL for this call, in milliseconds.
+    * `:humanize` - as in `DiskSpace.stat/2`; applied to the cached raw byte counts.
+    * `:timeout` (non-negative integer or `:infinity`) - how long to wait for a refresh, in
+      milliseconds. Defaults to `5000`.
+  """
+  def stat(path, opts \\ []) when is_bitstring(path) and is_list(opts) do
+    name = Keyword.get(opts, :name, __MODULE__)
+
+    DiskSpace.span([:cache, :stat], %{path: path, opts: opts, cache: name}, fn ->
+      {result, hit?} = lookup(name, path, opts)
+
+      result =
+        case Keyword.get(opts, :humanize, nil) do
+          nil -> result
+          base_type -> DiskSpace.humanize(result, base_type)
+        end
+
+      {result, %{}, %{hit: hit?}}
+    end)
+  end
+
+  defp lookup(name, path, opts) do
+    %{counters: counters} = config = config(name)
+    ttl = Keyword.get_lazy(opts, :ttl, fn -> Map.get(config.ttls, path, config.ttl) end)
+    now = System.monotonic_time(:millisecond)
+
+    case :ets.lookup(name, path) do
+      [{^path, result, fetched_at}] when now - fetched_at <= ttl ->
+        :counters.add(counters, @hits, 1)
+        {result, true}
+
+      _ ->
+        :counters.add(counters, @misses, 1)
+        {GenServer.call(name, {:refresh, path, ttl}, Keyword.get(opts, :timeout, 5000)), false}
+    end
+  end
+
+  @doc """
+  Same as `stat/2`, but returns the stats map directly or raises `DiskSpace.Error` on failure.
+  """
+  def stat!(path, opts \\ []) do
+    case stat(path, opts) do
+      {:ok, stats} -> stats
+      {:error, info} -> raise DiskSpace.Error, info
+    end
+  end
+
+  @doc """
+  Returns the cached results of all entries (fresh or not) as a list of `{path, result}` tuples,
+  without refreshing anything.
+  """
+  def entries(name \\ __MODULE__) do
+    name
+    |> :ets.tab2list()
+    |> Enum.map(fn {path, result, _fetched_at} -> {path, result} end)
+  end
+
+  @doc """
+  Drops the cached entry for `path`, so that the next `stat/2` refreshes it.
+  """
+  def invalidate(path, name \\ __MODULE__) when is_bitstring(path),
+    do: GenServer.call(name, {:invalidate, path})
+
+  @doc """
+  Returns the counters of the cache as a map with keys `:hits`, `:misses`, `:refreshes` (the
+  number of `DiskSpace.stat/2` calls made on a miss), `:waits` (the number of misses that joined a
+  refresh already in flight) and `:size` (the number of cached entries).
+  """
+  def info(name \\ __MODULE__) do
+    %{counters: counters} = config(name)
+
+    %{
+      hits: :counters.get(counters, @hits),
+      misses: :counters.get(counters, @misses),
+      refreshes: :counters.get(counters, @refreshes),
+      waits: :counters.get(counters, @waits),
+      size: :ets.info(name, :size)
+    }
+  end
+
+  defp config(name), do: :persistent_term.get({__MODULE__, name})
+
+  @impl true
+  def init(opts) do
+    name = Keyword.fetch!(opts, :name)
+    :ets.new(name, [:named_table, :set, :protected, read_concurrency: true])
+
+    config = %{
+      counters: :counters.new(4, [:write_concurrency]),
+      ttl: Keyword.get(opts, :ttl, 1000),
+      ttls: Keyword.get(opts, :ttls, %{})
+    }
+
+    :persistent_term.put({__MODULE__, name}, config)
+    Process.flag(:trap_exit, true)
+
+    state = %{
+      name: name,
+      stat_opts: Keyword.get(opts, :stat_opts, []),
+      refreshing: %{},
+      tasks: %{}
+    }
+
+    {:ok, state}
+  end
+
+  @impl true
+  def handle_call({:refresh, path, ttl}, from, state) do
+    now = System.monotonic_time(:millisecond)
+
+    case :ets.lookup(state.name, path) do
+      # refreshed by another caller while this request was in the mailbox
+      [{^path, result, fetched_at}] when now - fetched_at <= ttl ->
+        {:reply, result, state}
+
+      _ ->
+        {:noreply, enqueue_refresh(state, path, from)}
+    end
+  end
+
+  def handle_call({:invalidate, path}, _from, state) do
+    :ets.delete(state.name, path)
+    {:reply, :ok, state}
+  end
+
+  @impl true
+  def handle_info({ref, result}, %{tasks: tasks} = state) when is_map_key(tasks, ref) do
+    Process.demonitor(ref, [:flush])
+    {path, tasks} = Map.pop(state.tasks, ref)
+    :ets.insert(state.name, {path, result, System.monotonic_time(:millisecond)})
+    {waiters, refreshing} = Map.pop(state.refreshing, path, [])
+    Enum.each(waiters, &GenServer.reply(&1, result))
+    {:noreply, %{state | tasks: tasks, refreshing: refreshing}}
+  end
+
+  def handle_info({:DOWN, ref, :process, _pid, reason}, %{tasks: tasks} = state)
+      when is_map_key(tasks, ref) do
+    {path, tasks} = Map.pop(state.tasks, ref)
+    {waiters, refreshing} = Map.pop(state.refreshing, path, [])
+    result = {:error, %{reason: :refresh_failed, info: reason}}
+    Enum.each(waiters, &GenServer.reply(&1, result))
+    {:noreply, %{state | tasks: tasks, refreshing: refreshing}}
+  end
+
+  def handle_info({:EXIT, _pid, _reason}, state), do: {:noreply, state}
+
+  @impl true
+  def terminate(_reason, state) do
+    :persistent_term.erase({__MODULE__, state.name})
+    :ok
+  end
+
+  defp enqueue_refresh(state, path, from) do
+    %{counters: counters} = config(state.name)
+
+    case state.refreshing do
+      %{^path => waiters} ->
+        :counters.add(counters, @waits, 1)
+        %{state | refreshing: Map.put(state.refreshing, path, [from | waiters])}
+
+      _ ->
+        :counters.add(counters, @refreshes, 1)
+        stat_opts = state.stat_opts
+        task = Task.async(fn -> DiskSpace.stat(path, stat_opts) end)
+
+        %{
+          state
+          | refreshing: Map.put(state.refreshing, path, [from]),
+            tasks: Map.put(state.tasks, task.ref, path)
+        }
+    end
+  end
+end
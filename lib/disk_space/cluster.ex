@@ -0,0 +1,126 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.Cluster do
+  @moduledoc """
+  Disk space of one path across the nodes of a cluster, in one call.
+
+  `stat/2` asks every node in parallel with `:erpc.multicall/5` under a single deadline. Each
+  node answers from its own `DiskSpace.Cache` or `DiskSpace.Snapshot` process rather than
+  with a fresh query, so nodes that are slow to answer are reported as timed out without
+  holding up the rest. The library and the chosen process must be running on every node.
+
+  The aggregate adds up each filesystem once. A network filesystem mounted on many nodes is
+  recognized by its filesystem type and ID, which the results carry when the cache queries with
+  `extended: true`:
+
+      children = [
+        {DiskSpace.Cache, ttl: 5_000, stat_opts: [extended: true]}
+      ]
+
+  Results without them (including snapshots) are counted once per node.
+  """
+
+  @byte_keys [:available, :free, :total, :used]
+  @shared_fs_types ["nfs", "nfs4", "cifs", "smb2", "smbfs", "ceph", "afpfs", "webdav"]
+
+  @doc """
+  Queries `path` on every node and adds up the results.
+
+  Returns a map with:
+
+    * `:results` - `%{node => {:ok, stats} | {:error, info}}` for every node that answered
+      in time; `info` is `%{reason: :rpc_failed, info: {class, reason}}` if the call itself
+      failed, e.g. because the node is down or the process is not running there
+    * `:timed_out` - the nodes that did not answer before `:timeout`
+    * `:aggregate` - `%{available: _, free: _, total: _, used: _, filesystems: count}`, the
+      byte counts of the successful results summed over distinct filesystems
+
+  ## Options
+
+    * `:nodes` (list of atoms) - the nodes to ask. Defaults to `[node() | Node.list()]`.
+    * `:source` - where each node answers from: `:cache` (default, `DiskSpace.Cache.stat/2`)
+      or `:snapshot` (`DiskSpace.Snapshot.read/3`, which needs `path` registered).
+    * `:name` (atom) - the name of the cache or snapshot process on each node. Defaults to
+      `DiskSpace.Cache` or `DiskSpace.Snapshot`.
+    * `:timeout` (non-negative integer) - the deadline for all nodes together, in
+      milliseconds. Defaults to `5000`.
+    * `:shared_fs_types` (list of strings) - filesystem types that are counted once per
+      filesystem ID rather than once per node. Defaults to the common network filesystems
+      (`#{Enum.join(@shared_fs_types, ", ")}`).
+  """
+  def stat(path, opts \\ []) when is_bitstring(path) and is_list(opts) do
+    nodes = Keyword.get_lazy(opts, :nodes, fn -> [node() | Node.list()] end)
+    source = Keyword.get(opts, :source, :cache)
+    name = Keyword.get(opts, :name, default_name(source))
+    timeout = Keyword.get(opts, :timeout, 5000)
+    shared = Keyword.get(opts, :shared_fs_types, @shared_fs_types)
+
+    DiskSpace.span([:cluster, :stat], %{path: path, opts: opts, nodes: nodes}, fn ->
+      result = do_stat(path, nodes, source, name, timeout, shared)
+      {result, %{}, %{timed_out: result.timed_out}}
+    end)
+  end
+
+  defp do_stat(path, nodes, source, name, timeout, shared) do
+    replies = :erpc.multicall(nodes, __MODULE__, :local_stat, [path, source, name], timeout)
+
+    {results, timed_out} =
+      nodes
+      |> Enum.zip(replies)
+      |> Enum.reduce({%{}, []}, fn
+        {node, {:error, {:erpc, :timeout}}}, {results, timed_out} ->
+          {results, [node | timed_out]}
+
+        {node, reply}, {results, timed_out} ->
+          {Map.put(results, node, node_result(reply)), timed_out}
+      end)
+
+    %{
+      results: results,
+      timed_out: Enum.reverse(timed_out),
+      aggregate: aggregate(results, shared)
+    }
+  end
+
+  # runs on each node
+  @doc false
+  def local_stat(path, :cache, name), do: DiskSpace.Cache.stat(path, name: name)
+
+  def local_stat(path, :snapshot, name) do
+    case DiskSpace.Snapshot.read(path, name) do
+      {:ok, stats, _age} -> {:ok, stats}
+      {:error, info, _age} -> {:error, info}
+      {:error, _info} = error -> error
+    end
+  end
+
+  defp default_name(:cache), do: DiskSpace.Cache
+  defp default_name(:snapshot), do: DiskSpace.Snapshot
+
+  defp node_result({:ok, {:ok, _stats} = success}), do: success
+  defp node_result({:ok, {:error, _info} = failure}), do: failure
+  defp node_result({class, reason}), do: {:error, %{reason: :rpc_failed, info: {class, reason}}}
+
+  defp aggregate(results, shared) do
+    zero = Map.new(@byte_keys, &{&1, 0})
+
+    filesystems =
+      for {node, {:ok, stats}} <- results, into: %{} do
+        {filesystem_key(node, stats, shared), stats}
+      end
+
+    filesystems
+    |> Map.values()
+    |> Enum.reduce(zero, fn stats, sums ->
+      Map.new(sums, fn {key, sum} -> {key, sum + Map.get(stats, key, 0)} end)
+    end)
+    |> Map.put(:filesystems, map_size(filesystems))
+  end
+
+  defp filesystem_key(node, %{fs_type: fs_type, fsid: fsid}, shared) do
+    if fs_type in shared, do: {fs_type, fsid}, else: node
+  end
+
+  defp filesystem_key(node, _stats, _shared), do: node
+end
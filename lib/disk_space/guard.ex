@@ -0,0 +1,190 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.Guard do
+  @moduledoc """
+  A low-space admission flag for hot write paths.
+
+  A guard polls one path in the background and keeps a single "writes allowed" flag in
+  `:atomics`. `ok?/1` reads that flag directly from the calling process: it is a constant-time
+  check with no message passing and no NIF call, cheap enough to run for every message.
+
+  The flag has hysteresis: it turns off as soon as the watched value drops below `:threshold`,
+  but only turns on again once the value is back above `:threshold` plus `:hysteresis`, so
+  it does not flap when usage hovers around the boundary.
+
+  Add one guard per path to a supervision tree:
+
+      children = [
+        {DiskSpace.Guard, name: :ingest_disk, path: "/var/lib/ingest", threshold: {:percent, 5}}
+      ]
+
+  ## Options
+
+    * `:name` (atom, required) - the name of the guard, used with `ok?/1`.
+    * `:path` (string, required) - the directory to watch.
+    * `:threshold` (required) - either `{:bytes, n}` (at least `n` bytes of `:available` space)
+      or `{:percent, p}` (`:available` is at least `p` percent of `:total`).
+    * `:hysteresis` (number) - how far above `:threshold` the value must climb before writes are
+      allowed again, in the unit of `:threshold`. Defaults to 5% of the threshold value.
+    * `:interval` (positive integer) - the polling interval, in milliseconds. Defaults to `1000`.
+    * `:on_error` (`:block` or `:allow`) - the state of the flag while the path cannot be queried.
+      Defaults to `:block`.
+
+  Polls run in a task, through `DiskSpace.stat_async/2` with a timeout of one `:interval`, so a
+  hung mount delays the guard but never blocks a scheduler, its start-up or its callers; the
+  flag keeps its last state until a poll completes. Until the first poll completes, the flag
+  is set as if the path could not be queried (see `:on_error`).
+  """
+
+  use GenServer
+
+  @flag 1
+
+  def start_link(opts) when is_list(opts) do
+    name = Keyword.fetch!(opts, :name)
+    GenServer.start_link(__MODULE__, opts, name: name)
+  end
+
+  def child_spec(opts) do
+    %{id: {__MODULE__, Keyword.fetch!(opts, :name)}, start: {__MODULE__, :start_link, [opts]}}
+  end
+
+  @doc """
+  Returns `true` if writes are currently allowed by the guard `name`.
+  """
+  def ok?(name), do: :atomics.get(:persistent_term.get({__MODULE__, name}), @flag) == 1
+
+  @doc """
+  Returns the state of the guard `name` as a map with keys `:ok?` (`nil` before the first poll
+  completes), `:value` (the last measured value, in the unit of the threshold, or `nil` if the
+  last poll failed), `:threshold` and `:hysteresis`.
+  """
+  def status(name), do: GenServer.call(name, :status)
+
+  @doc """
+  Polls the path right away instead of waiting for the next interval, and returns `ok?/1` once
+  the poll completes. If a poll is already running, waits for that one instead.
+
+  A poll gives up after one `:interval`, so this waits at most about that long.
+  """
+  def check(name), do: GenServer.call(name, :check, :infinity)
+
+  @impl true
+  def init(opts) do
+    name = Keyword.fetch!(opts, :name)
+    threshold = Keyword.fetch!(opts, :threshold)
+    limit = threshold_limit!(threshold)
+    on_error = Keyword.get(opts, :on_error, :block)
+    flag = :atomics.new(1, signed: false)
+    :atomics.put(flag, @flag, if(on_error == :allow, do: 1, else: 0))
+    :persistent_term.put({__MODULE__, name}, flag)
+    Process.flag(:trap_exit, true)
+
+    state = %{
+      name: name,
+      path: Keyword.fetch!(opts, :path),
+      threshold: threshold,
+      hysteresis: Keyword.get(opts, :hysteresis, limit * 0.05),
+      interval: Keyword.get(opts, :interval, 1000),
+      on_error: on_error,
+      flag: flag,
+      ok?: nil,
+      value: nil,
+      timer: nil,
+      poll: nil,
+      waiters: []
+    }
+
+    {:ok, state, {:continue, :poll}}
+  end
+
+  defp threshold_limit!({kind, limit}) when kind in [:bytes, :percent] and is_number(limit),
+    do: limit
+
+  defp threshold_limit!(threshold) do
+    raise ArgumentError,
+          "expected :threshold to be {:bytes, n} or {:percent, p}, got: #{inspect(threshold)}"
+  end
+
+  @impl true
+  def handle_continue(:poll, state), do: {:noreply, start_poll(state)}
+
+  @impl true
+  def handle_call(:status, _from, state) do
+    {:reply, Map.take(state, [:ok?, :value, :threshold, :hysteresis]), state}
+  end
+
+  def handle_call(:check, from, state) do
+    state = start_poll(state)
+    {:noreply, %{state | waiters: [from | state.waiters]}}
+  end
+
+  @impl true
+  def handle_info(:poll, state), do: {:noreply, start_poll(state)}
+
+  def handle_info({ref, result}, %{poll: ref} = state) do
+    Process.demonitor(ref, [:flush])
+    {:noreply, state |> apply_result(result) |> finish_poll()}
+  end
+
+  # a poll that crashed leaves the flag as it was
+  def handle_info({:DOWN, ref, :process, _pid, _reason}, %{poll: ref} = state),
+    do: {:noreply, finish_poll(state)}
+
+  # the reply of a poll that is no longer tracked
+  def handle_info({ref, _reply}, state) when is_reference(ref) do
+    Process.demonitor(ref, [:flush])
+    {:noreply, state}
+  end
+
+  def handle_info({:EXIT, _pid, _reason}, state), do: {:noreply, state}
+
+  @impl true
+  def terminate(_reason, state) do
+    :persistent_term.erase({__MODULE__, state.name})
+    :ok
+  end
+
+  # Start a poll unless one is running, which also covers a timer that fired late
+  defp start_poll(%{poll: nil} = state) do
+    if state.timer, do: Process.cancel_timer(state.timer)
+    %{path: path, interval: interval} = state
+    task = Task.async(fn -> DiskSpace.stat_async(path, timeout: interval) end)
+    %{state | poll: task.ref, timer: nil}
+  end
+
+  defp start_poll(state), do: state
+
+  defp apply_result(state, {:ok, stats}) do
+    value = measure(state.threshold, stats)
+    set_flag(%{state | value: value}, admit?(state, value))
+  end
+
+  defp apply_result(state, {:error, %{reason: :timeout}}), do: state
+
+  defp apply_result(state, {:error, _info}),
+    do: set_flag(%{state | value: nil}, state.on_error == :allow)
+
+  defp finish_poll(state) do
+    ok? = :atomics.get(state.flag, @flag) == 1
+    Enum.each(state.waiters, &GenServer.reply(&1, ok?))
+    timer = Process.send_after(self(), :poll, state.interval)
+    %{state | poll: nil, waiters: [], timer: timer}
+  end
+
+  defp measure({:bytes, _}, stats), do: stats.available
+  defp measure({:percent, _}, %{total: 0}), do: 0.0
+  defp measure({:percent, _}, stats), do: stats.available * 100 / stats.total
+
+  # turn off below the threshold, but only back on above threshold + hysteresis
+  defp admit?(%{ok?: false, threshold: {_, limit}, hysteresis: hysteresis}, value),
+    do: value >= limit + hysteresis
+
+  defp admit?(%{threshold: {_, limit}}, value), do: value >= limit
+
+  defp set_flag(state, ok?) do
+    :atomics.put(state.flag, @flag, if(ok?, do: 1, else: 0))
+    %{state | ok?: ok?}
+  end
+end
@@ -0,0 +1,131 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.Metrics do
+  @moduledoc """
+  OpenMetrics (Prometheus) exposition of the results held by a `DiskSpace.Cache` or
+  `DiskSpace.Snapshot` process.
+
+  `render/1` writes the scrape body as iodata straight from the stored results, without
+  querying any path. Each path is labelled with `path` and, when the results carry it (with
+  `stat_opts: [extended: true]` for the cache), `fstype`:
+
+      # TYPE disk_space_available_bytes gauge
+      # UNIT disk_space_available_bytes bytes
+      # HELP disk_space_available_bytes Bytes available to unprivileged users.
+      disk_space_available_bytes{path="/var/lib/app",fstype="ext4"} 52034158592
+
+  The families are `disk_space_available_bytes`, `disk_space_free_bytes`,
+  `disk_space_size_bytes` and `disk_space_used_bytes`, plus `disk_space_inodes` and
+  `disk_space_inodes_free` for extended results with inode counts, and `disk_space_up`, which
+  is `1` for a path whose last query succeeded and `0` otherwise.
+
+  In a Plug router:
+
+      get "/metrics" do
+        conn
+        |> put_resp_content_type("application/openmetrics-text; version=1.0.0")
+        |> send_resp(200, DiskSpace.Metrics.render())
+      end
+  """
+
+  @families [
+    {:available, "disk_space_available_bytes", "bytes", "Bytes available to unprivileged users."},
+    {:free, "disk_space_free_bytes", "bytes", "Free bytes, including reserved ones."},
+    {:total, "disk_space_size_bytes", "bytes", "Size of the filesystem."},
+    {:used, "disk_space_used_bytes", "bytes", "Used bytes."},
+    {:inodes_total, "disk_space_inodes", nil, "Inodes on the filesystem."},
+    {:inodes_free, "disk_space_inodes_free", nil, "Free inodes on the filesystem."}
+  ]
+
+  @up_help "Whether the last query of the path succeeded."
+
+  @doc """
+  Renders the stored results as an OpenMetrics text exposition, ending with `# EOF`.
+
+  Every result is visited once and formatted into iodata that shares the label set of its
+  path across all families, so the cost grows linearly with the number of paths and no
+  binary of the whole body is built.
+
+  ## Options
+
+    * `:source` - `:cache` (default) to render the entries of a `DiskSpace.Cache`, which is a
+      traversal of its ETS table with no NIF call, or `:snapshot` to render the paths
+      registered with a `DiskSpace.Snapshot`, each read from its slot by the lock-free NIF
+      without a syscall.
+    * `:name` (atom) - the name of the cache or snapshot process. Defaults to
+      `DiskSpace.Cache` or `DiskSpace.Snapshot`.
+  """
+  def render(opts \\ []) when is_list(opts) do
+    rows =
+      case Keyword.get(opts, :source, :cache) do
+        :cache -> cache_rows(Keyword.get(opts, :name, DiskSpace.Cache))
+        :snapshot -> snapshot_rows(Keyword.get(opts, :name, DiskSpace.Snapshot))
+      end
+
+    families = Enum.map(@families, &family(&1, rows))
+    up = for {labels, stats} <- rows, do: sample("disk_space_up", labels, up(stats))
+    [families, header("disk_space_up", nil, @up_help), up, "# EOF\n"]
+  end
+
+  # a family without any sample is left out, header and all
+  defp family({key, metric, unit, help}, rows) do
+    samples =
+      for {labels, %{^key => value}} <- rows,
+          is_integer(value),
+          do: sample(metric, labels, value)
+
+    if samples == [], do: [], else: [header(metric, unit, help) | samples]
+  end
+
+  defp cache_rows(name) do
+    :ets.foldl(fn {path, result, _fetched_at}, rows -> [row(path, result) | rows] end, [], name)
+  end
+
+  defp snapshot_rows(name) do
+    for path <- DiskSpace.Snapshot.paths(name) do
+      case DiskSpace.Snapshot.read(path, name) do
+        {:ok, stats, _age} -> row(path, {:ok, stats})
+        _ -> row(path, :error)
+      end
+    end
+  end
+
+  # {labels, stats}, with the label set rendered once for all families; failed queries
+  # (and snapshots not yet taken) keep no stats
+  defp row(path, {:ok, {available, free, total, used}}),
+    do: {labels(path, nil), %{available: available, free: free, total: total, used: used}}
+
+  defp row(path, {:ok, stats}) when is_map(stats),
+    do: {labels(path, Map.get(stats, :fs_type)), stats}
+
+  defp row(path, _failure), do: {labels(path, nil), nil}
+
+  defp up(nil), do: 0
+  defp up(_stats), do: 1
+
+  defp labels(path, nil), do: [~s({path="), escape(path), ~s("})]
+
+  defp labels(path, fs_type),
+    do: [~s({path="), escape(path), ~s(",fstype="), escape(fs_type), ~s("})]
+
+  defp escape(value) do
+    case :binary.match(value, ["\\", "\"", "\n"]) do
+      :nomatch ->
+        value
+
+      _ ->
+        value
+        |> String.replace("\\", "\\\\")
+        |> String.replace("\"", "\\\"")
+        |> String.replace("\n", "\\n")
+    end
+  end
+
+  defp sample(metric, labels, value), do: [metric, labels, ?\s, Integer.to_string(value), ?\n]
+
+  defp header(metric, unit, help) do
+    unit = if unit, do: ["# UNIT ", metric, ?\s, unit, ?\n], else: []
+    ["# TYPE ", metric, " gauge\n", unit, "# HELP ", metric, ?\s, help, ?\n]
+  end
+end
@@ -0,0 +1,333 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.Monitor do
+  @moduledoc """
+  One supervised poller for many paths, with threshold alerts for any number of subscribers.
+
+  Every registered path is polled by this one process, however many processes subscribe.
+  The paths that are due are grouped by the filesystem they were last seen on, and each group
+  is queried in a task of its own through `DiskSpace.stat_many/2` with
+  `dedupe_by_device: true`, so paths on the same filesystem cost one syscall. Each path is
+  classified into the most severe of the configured `:levels` whose threshold it is below,
+  or `:ok`.
+
+  A poll has a deadline of `:timeout`: the tasks that have not answered by then are killed and
+  their paths report `{:error, %{reason: :timeout, info: nil}}`, so a hung mount (e.g. an
+  unreachable NFS server) does not hold up the other paths. Paths that time out are queried
+  on their own from then on.
+
+  Polling adapts to the headroom: a path at twice its nearest threshold or more is polled
+  every `:max_interval`, and the interval shrinks linearly towards `:min_interval` as the path
+  approaches that threshold (and stays at `:min_interval` beyond the last one).
+
+  Subscribers receive `{:disk_space_alert, path, level, stats}` only when the level of `path`
+  changes (every path starts at `:ok`), and `{:disk_space_alert, path, :error, info}` when it
+  cannot be queried. Subscribers are monitored and dropped when they exit.
+
+      children = [
+        {DiskSpace.Monitor,
+         paths: ["/var/lib/app", "/tmp"], levels: [warning: {:percent, 15}, critical: {:percent, 5}]}
+      ]
+
+      # in a subscriber
+      DiskSpace.Monitor.subscribe()
+
+      def handle_info({:disk_space_alert, path, level, _stats}, state) do
+        Logger.warning("disk space on \#{path} is now \#{level}")
+        {:noreply, state}
+      end
+
+  ## Options
+
+    * `:name` (atom) - the name of the process. Defaults to `DiskSpace.Monitor`.
+    * `:paths` (list of strings) - paths to register at startup. Defaults to `[]`.
+    * `:levels` (keyword list) - the alert levels from least to most severe, each with a
+      threshold of `{:bytes, n}` (`:available` is below `n` bytes) or `{:percent, p}`
+      (`:available` is below `p` percent of `:total`). Defaults to
+      `[warning: {:percent, 10}, critical: {:percent, 5}]`.
+    * `:min_interval` (positive integer) - the polling interval near or beyond a threshold,
+      in milliseconds. Defaults to `1000`.
+    * `:max_interval` (positive integer) - the polling interval with plenty of headroom, in
+      milliseconds. Defaults to `60_000`.
+    * `:timeout` (positive integer) - the deadline of each poll, in milliseconds. Defaults to
+      `5000`.
+    * `:stat_many` (function) - the query of a group of paths, which must return the same
+      `{results, devices}` as `DiskSpace.stat_many/2` with `dedupe_by_device: true`. Defaults
+      to that call; meant for tests.
+  """
+
+  use GenServer
+
+  def start_link(opts \\ []) when is_list(opts) do
+    name = Keyword.get(opts, :name, __MODULE__)
+    GenServer.start_link(__MODULE__, Keyword.put(opts, :name, name), name: name)
+  end
+
+  @doc """
+  Adds `path` to the polled set and polls it right away. Registering a path twice is a no-op.
+  """
+  def register(path, name \\ __MODULE__) when is_bitstring(path),
+    do: GenServer.call(name, {:register, path})
+
+  @doc """
+  Removes `path` from the polled set.
+  """
+  def unregister(path, name \\ __MODULE__) when is_bitstring(path),
+    do: GenServer.call(name, {:unregister, path})
+
+  @doc """
+  Subscribes the calling process to `{:disk_space_alert, path, level, stats}` messages for all
+  registered paths. Subscribing twice is a no-op.
+  """
+  def subscribe(name \\ __MODULE__), do: GenServer.call(name, {:subscribe, self()})
+
+  @doc """
+  Unsubscribes the calling process.
+  """
+  def unsubscribe(name \\ __MODULE__), do: GenServer.call(name, {:unsubscribe, self()})
+
+  @doc """
+  Returns `%{path => %{level: level, interval: ms, result: result}}` for every registered path,
+  where `result` is the last `{:ok, stats}` or `{:error, info}`, or `nil` before the first poll.
+  """
+  def status(name \\ __MODULE__), do: GenServer.call(name, :status)
+
+  @impl true
+  def init(opts) do
+    levels = Keyword.get(opts, :levels, warning: {:percent, 10}, critical: {:percent, 5})
+    Enum.each(levels, &validate_level!/1)
+    Process.flag(:trap_exit, true)
+
+    state = %{
+      levels: levels,
+      min_interval: Keyword.get(opts, :min_interval, 1000),
+      max_interval: Keyword.get(opts, :max_interval, 60_000),
+      timeout: Keyword.get(opts, :timeout, 5000),
+      stat_many: Keyword.get(opts, :stat_many, &DiskSpace.stat_many(&1, dedupe_by_device: true)),
+      paths: %{},
+      devices: %{},
+      subscribers: %{},
+      timer: nil,
+      poll: nil
+    }
+
+    state = Enum.reduce(Keyword.get(opts, :paths, []), state, &add_path(&2, &1))
+    {:ok, schedule(state)}
+  end
+
+  defp validate_level!({level, {kind, limit}})
+       when is_atom(level) and kind in [:bytes, :percent] and is_number(limit) and limit > 0,
+       do: :ok
+
+  defp validate_level!(level) do
+    raise ArgumentError,
+          "expected each of :levels to be {level, {:bytes, n}} or {level, {:percent, p}} " <>
+            "with a positive limit, got: #{inspect(level)}"
+  end
+
+  @impl true
+  def handle_call({:register, path}, _from, %{paths: paths} = state)
+      when is_map_key(paths, path),
+      do: {:reply, :ok, state}
+
+  def handle_call({:register, path}, _from, state),
+    do: {:reply, :ok, state |> add_path(path) |> schedule()}
+
+  def handle_call({:unregister, path}, _from, state),
+    do: {:reply, :ok, %{state | paths: Map.delete(state.paths, path)}}
+
+  def handle_call({:subscribe, pid}, _from, %{subscribers: subscribers} = state)
+      when is_map_key(subscribers, pid),
+      do: {:reply, :ok, state}
+
+  def handle_call({:subscribe, pid}, _from, state) do
+    ref = Process.monitor(pid)
+    {:reply, :ok, put_in(state.subscribers[pid], ref)}
+  end
+
+  def handle_call({:unsubscribe, pid}, _from, state) do
+    {ref, subscribers} = Map.pop(state.subscribers, pid)
+    if ref, do: Process.demonitor(ref, [:flush])
+    {:reply, :ok, %{state | subscribers: subscribers}}
+  end
+
+  def handle_call(:status, _from, state) do
+    status = Map.new(state.paths, fn {path, entry} -> {path, Map.delete(entry, :due)} end)
+    {:reply, status, state}
+  end
+
+  @impl true
+  def handle_info(:poll, %{poll: nil} = state), do: {:noreply, start_poll(%{state | timer: nil})}
+
+  # a timer that fired before it could be cancelled; the running poll reschedules
+  def handle_info(:poll, state), do: {:noreply, state}
+
+  def handle_info({ref, reply}, %{poll: %{tasks: tasks}} = state)
+      when is_map_key(tasks, ref) do
+    Process.demonitor(ref, [:flush])
+    {{_task, group}, tasks} = Map.pop(tasks, ref)
+    state = apply_reply(state, group, reply)
+    {:noreply, finish_task(state, tasks)}
+  end
+
+  # the reply of a poll that is no longer tracked
+  def handle_info({ref, _reply}, state) when is_reference(ref) do
+    Process.demonitor(ref, [:flush])
+    {:noreply, state}
+  end
+
+  # the groups that have not answered in time report a timeout
+  def handle_info({:deadline, id}, %{poll: %{id: id, tasks: tasks}} = state) do
+    state =
+      Enum.reduce(tasks, state, fn {_ref, {task, group}}, state ->
+        case Task.shutdown(task, :brutal_kill) do
+          {:ok, reply} -> apply_reply(state, group, reply)
+          _ -> time_out(state, group)
+        end
+      end)
+
+    {:noreply, schedule(%{state | poll: nil})}
+  end
+
+  def handle_info({:deadline, _id}, state), do: {:noreply, state}
+
+  # a group whose task crashed is retried with the next schedule
+  def handle_info({:DOWN, ref, :process, _pid, _reason}, %{poll: %{tasks: tasks}} = state)
+      when is_map_key(tasks, ref),
+      do: {:noreply, finish_task(state, Map.delete(tasks, ref))}
+
+  def handle_info({:DOWN, _ref, :process, pid, _reason}, state),
+    do: {:noreply, %{state | subscribers: Map.delete(state.subscribers, pid)}}
+
+  def handle_info({:EXIT, _pid, _reason}, state), do: {:noreply, state}
+
+  defp add_path(state, path) do
+    due = System.monotonic_time(:millisecond)
+    entry = %{level: :ok, interval: state.min_interval, result: nil, due: due}
+    put_in(state.paths[path], entry)
+  end
+
+  # Arm the timer for the earliest due path, unless a poll is running
+  defp schedule(%{poll: nil} = state) do
+    if state.timer, do: Process.cancel_timer(state.timer)
+
+    case Enum.map(state.paths, fn {_path, entry} -> entry.due end) do
+      [] ->
+        %{state | timer: nil}
+
+      dues ->
+        delay = max(Enum.min(dues) - System.monotonic_time(:millisecond), 0)
+        %{state | timer: Process.send_after(self(), :poll, delay)}
+    end
+  end
+
+  defp schedule(state), do: state
+
+  defp start_poll(state) do
+    now = System.monotonic_time(:millisecond)
+    due = for {path, %{due: due}} <- state.paths, due <= now, do: path
+
+    if due == [] do
+      schedule(state)
+    else
+      stat_many = state.stat_many
+
+      # paths on no known device are queried on their own
+      tasks =
+        due
+        |> Enum.group_by(&Map.get(state.devices, &1, {:path, &1}))
+        |> Map.new(fn {_device, group} ->
+          task = Task.async(fn -> stat_many.(group) end)
+          {task.ref, {task, group}}
+        end)
+
+      id = make_ref()
+      deadline = Process.send_after(self(), {:deadline, id}, state.timeout)
+      %{state | poll: %{id: id, tasks: tasks, deadline: deadline}}
+    end
+  end
+
+  defp finish_task(state, tasks) when map_size(tasks) == 0 do
+    Process.cancel_timer(state.poll.deadline)
+    schedule(%{state | poll: nil})
+  end
+
+  defp finish_task(state, tasks), do: put_in(state.poll.tasks, tasks)
+
+  defp apply_reply(state, group, {results, devices}) do
+    now = System.monotonic_time(:millisecond)
+    state = %{state | devices: Map.drop(state.devices, group)}
+
+    state =
+      for {device, paths} <- devices, path <- paths, reduce: state do
+        state -> put_in(state.devices[path], device)
+      end
+
+    group
+    |> Enum.zip(results)
+    |> Enum.reduce(state, &apply_result(&2, &1, now))
+  end
+
+  defp time_out(state, group) do
+    now = System.monotonic_time(:millisecond)
+    state = %{state | devices: Map.drop(state.devices, group)}
+    timeout = {:error, %{reason: :timeout, info: nil}}
+    Enum.reduce(group, state, &apply_result(&2, {&1, timeout}, now))
+  end
+
+  defp apply_result(state, {path, result}, now) do
+    case state.paths do
+      %{^path => entry} ->
+        {level, interval, payload} = classify(state, result)
+        if level != entry.level, do: notify(state, path, level, payload)
+        entry = %{entry | level: level, interval: interval, result: result, due: now + interval}
+        put_in(state.paths[path], entry)
+
+      # unregistered while the poll was running
+      _ ->
+        state
+    end
+  end
+
+  defp classify(state, {:error, info}), do: {:error, state.min_interval, info}
+
+  defp classify(state, {:ok, stats}) do
+    {crossed, clear} =
+      Enum.split_with(state.levels, fn {_level, {_, limit} = threshold} ->
+        measure(threshold, stats) < limit
+      end)
+
+    level =
+      case List.last(crossed) do
+        nil -> :ok
+        {level, _threshold} -> level
+      end
+
+    {level, interval(state, stats, clear), stats}
+  end
+
+  defp interval(state, _stats, []), do: state.min_interval
+
+  # linear in the relative headroom to the nearest threshold still clear, capped at 100%
+  defp interval(state, stats, clear) do
+    headroom =
+      clear
+      |> Enum.map(fn {_level, {_, limit} = threshold} ->
+        (measure(threshold, stats) - limit) / limit
+      end)
+      |> Enum.min()
+      |> min(1.0)
+
+    round(state.min_interval + (state.max_interval - state.min_interval) * headroom)
+  end
+
+  defp measure({:bytes, _}, stats), do: stats.available
+  defp measure({:percent, _}, %{total: 0}), do: 0.0
+  defp measure({:percent, _}, stats), do: stats.available * 100 / stats.total
+
+  defp notify(state, path, level, payload) do
+    message = {:disk_space_alert, path, level, payload}
+    Enum.each(Map.keys(state.subscribers), &send(&1, message))
+  end
+end
@@ -0,0 +1,98 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.MountWatcher do
+  @moduledoc """
+  Notifies subscribers when the mount table changes, so that mount lists from
+  `DiskSpace.mounts/1` and device groupings from `DiskSpace.stat_many/2` can be rebuilt only
+  when something was actually mounted or unmounted.
+
+  A native thread waits for the kernel's change notification (`POLLPRI` on
+  `/proc/self/mountinfo` on Linux, a kqueue `EVFILT_FS` filter on macOS) without re-reading the
+  mount table. On the other platforms it re-reads the mount table, without querying any space,
+  once per `:interval` and reports differences.
+
+  Every change sends `{:disk_space, :mounts_changed}` to each subscriber. Several mounts in a
+  row may produce several messages; subscribers are monitored and dropped when they exit.
+
+      children = [DiskSpace.MountWatcher]
+
+      # in a subscriber
+      DiskSpace.MountWatcher.subscribe()
+
+      def handle_info({:disk_space, :mounts_changed}, state) do
+        {:ok, mounts} = DiskSpace.mounts()
+        {:noreply, %{state | mounts: mounts}}
+      end
+
+  The process owns the native thread: when it stops, the thread is stopped and joined.
+
+  ## Options
+
+    * `:name` (atom) - the name of the process. Defaults to `DiskSpace.MountWatcher`.
+    * `:interval` (positive integer) - how often, in milliseconds, the thread re-reads the
+      mount table where no change notification is available; elsewhere the upper bound on how
+      long stopping the thread takes. Defaults to `1000`.
+  """
+
+  use GenServer
+
+  def start_link(opts \\ []) when is_list(opts) do
+    name = Keyword.get(opts, :name, __MODULE__)
+    GenServer.start_link(__MODULE__, Keyword.put(opts, :name, name), name: name)
+  end
+
+  @doc """
+  Subscribes the calling process to `{:disk_space, :mounts_changed}` messages. Subscribing twice
+  is a no-op.
+  """
+  def subscribe(name \\ __MODULE__), do: GenServer.call(name, {:subscribe, self()})
+
+  @doc """
+  Unsubscribes the calling process.
+  """
+  def unsubscribe(name \\ __MODULE__), do: GenServer.call(name, {:unsubscribe, self()})
+
+  @impl true
+  def init(opts) do
+    case DiskSpace.mount_watcher_start(Keyword.get(opts, :interval, 1000)) do
+      {:ok, watcher} ->
+        Process.flag(:trap_exit, true)
+        {:ok, %{watcher: watcher, subscribers: %{}}}
+
+      {:error, reason} ->
+        {:stop, reason}
+    end
+  end
+
+  @impl true
+  def handle_call({:subscribe, pid}, _from, %{subscribers: subscribers} = state)
+      when is_map_key(subscribers, pid),
+      do: {:reply, :ok, state}
+
+  def handle_call({:subscribe, pid}, _from, state) do
+    ref = Process.monitor(pid)
+    {:reply, :ok, put_in(state.subscribers[pid], ref)}
+  end
+
+  def handle_call({:unsubscribe, pid}, _from, state) do
+    {ref, subscribers} = Map.pop(state.subscribers, pid)
+    if ref, do: Process.demonitor(ref, [:flush])
+    {:reply, :ok, %{state | subscribers: subscribers}}
+  end
+
+  @impl true
+  def handle_info({:disk_space, :mounts_changed} = message, state) do
+    Enum.each(Map.keys(state.subscribers), &send(&1, message))
+    {:noreply, state}
+  end
+
+  def handle_info({:DOWN, _ref, :process, pid, _reason}, state),
+    do: {:noreply, %{state | subscribers: Map.delete(state.subscribers, pid)}}
+
+  @impl true
+  def terminate(_reason, state) do
+    DiskSpace.mount_watcher_stop(state.watcher)
+    :ok
+  end
+end
@@ -0,0 +1,197 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.Snapshot do
+  @moduledoc """
+  Disk space snapshots refreshed in the background by native threads, for hot paths that
+  cannot afford a syscall.
+
+  Each registered path gets a slot in a fixed-size native table. Once per `:interval`, a native
+  thread queues a query of every registered path on the worker pool of
+  `DiskSpace.stat_async/2`, and each result is published into the slot of its path; `read/2`
+  copies the latest result out of the slot with a regular (non-dirty) NIF that takes no lock
+  and makes no syscall, and also reports how old the result is.
+
+  Paths are queried independently, so a hung mount (e.g. an unreachable NFS server) only holds
+  up its own slot and one pool worker. A path is not queried again while its last query is
+  still running; once that query has run for `:timeout`, the slot reads
+  `{:error, %{reason: :timeout, info: nil}, age_ms}` until the query returns. The queries
+  count towards the limits set with `DiskSpace.configure_async/1` and show up in
+  `DiskSpace.async_pool_info/0`; with the queue full, a path is queried on the next interval.
+
+  Each refresh of a path is also kept in a fixed window of its last `:window` samples, from
+  which `forecast/2` estimates the fill rate in constant time.
+
+  The process owns the native table: when it stops, the refresher thread is stopped and joined,
+  and the queries it queued that have not started yet are skipped.
+
+  Add it to a supervision tree:
+
+      children = [
+        {DiskSpace.Snapshot, interval: 500, paths: ["/var/lib/app", "/tmp"]}
+      ]
+
+  ## Options
+
+    * `:name` (atom) - the name of the process. Defaults to `DiskSpace.Snapshot`.
+    * `:interval` (positive integer) - the refresh interval, in milliseconds. Defaults to `1000`.
+    * `:timeout` (non-negative integer) - how long the query of a path may run before its slot
+      reports a timeout, in milliseconds. Checked once per `:interval`. Defaults to `:interval`.
+    * `:capacity` (positive integer) - the maximum number of registered paths. Defaults to `1024`.
+    * `:paths` (list of strings) - paths to register at startup. Defaults to `[]`.
+    * `:window` (integer, 2 to 1024) - the number of samples per path that `forecast/2` fits.
+      Defaults to `60`.
+  """
+
+  use GenServer
+
+  def start_link(opts \\ []) when is_list(opts) do
+    name = Keyword.get(opts, :name, __MODULE__)
+    GenServer.start_link(__MODULE__, Keyword.put(opts, :name, name), name: name)
+  end
+
+  @doc """
+  Adds `path` to the set refreshed in the background. Registering a path twice is a no-op.
+
+  Returns `:ok`, or `{:error, %{reason: :full, info: nil}}` when all slots are taken.
+  """
+  def register(path, name \\ __MODULE__) when is_bitstring(path),
+    do: GenServer.call(name, {:register, path})
+
+  @doc """
+  Removes `path` from the set refreshed in the background.
+  """
+  def unregister(path, name \\ __MODULE__) when is_bitstring(path),
+    do: GenServer.call(name, {:unregister, path})
+
+  @doc """
+  Returns the paths currently registered.
+  """
+  def paths(name \\ __MODULE__) do
+    name
+    |> table_name()
+    |> :ets.select([{{:"$1", :_}, [], [:"$1"]}])
+  end
+
+  @doc """
+  Returns the latest snapshot of `path` without any syscall.
+
+  Returns `{:ok, stats_map, age_ms}` or `{:error, info, age_ms}`, where the stats map and `info`
+  have the same shape as in `DiskSpace.stat/2` and `age_ms` is the age of the snapshot in
+  milliseconds. Returns `{:error, %{reason: :pending, info: nil}}` if the path was registered
+  but not yet refreshed, and `{:error, %{reason: :not_registered, info: nil}}` if it is not
+  registered.
+
+  Accepts the `:format` option of `DiskSpace.stat/2`; the NIF builds only the requested term.
+  """
+  def read(path, name \\ __MODULE__, opts \\ []) when is_bitstring(path) and is_list(opts) do
+    case :ets.lookup(table_name(name), path) do
+      [{^path, {slot, generation}}] ->
+        name
+        |> native_table()
+        |> DiskSpace.snapshot_read(slot, generation, DiskSpace.stat_format(opts))
+        |> reshape_reading()
+
+      [] ->
+        {:error, %{reason: :not_registered, info: nil}}
+    end
+  end
+
+  @doc """
+  Returns the fill rate of `path`, fitted to its samples in the window without any syscall.
+
+  Returns `{:ok, forecast}` where `forecast` is a map with:
+
+    * `:rate` - the growth of used space in bytes per second (a float, negative while space is
+      being freed)
+    * `:time_to_full` - the seconds until `:available` reaches zero at that rate (a float), or
+      `:infinity` unless the rate is positive
+    * `:samples` - the number of samples fitted
+    * `:window` - the milliseconds between the oldest and the newest of them
+
+  Returns `{:error, %{reason: :pending, info: nil}}` until two samples have been taken, and
+  `{:error, %{reason: :not_registered, info: nil}}` if the path is not registered. Failed
+  refreshes are not sampled.
+  """
+  def forecast(path, name \\ __MODULE__) when is_bitstring(path) do
+    case :ets.lookup(table_name(name), path) do
+      [{^path, {slot, generation}}] ->
+        case DiskSpace.snapshot_forecast(native_table(name), slot, generation) do
+          {:ok, _forecast} = success -> success
+          {:error, reason} -> {:error, %{reason: reason, info: nil}}
+        end
+
+      [] ->
+        {:error, %{reason: :not_registered, info: nil}}
+    end
+  end
+
+  defp reshape_reading({{:ok, stats}, age}), do: {:ok, stats, age}
+  defp reshape_reading({{:error, reason}, age}), do: {:error, %{reason: reason, info: nil}, age}
+
+  defp reshape_reading({{:error, reason, info}, age}),
+    do: {:error, %{reason: reason, info: info}, age}
+
+  defp reshape_reading({:error, reason}), do: {:error, %{reason: reason, info: nil}}
+
+  defp table_name(name), do: :"#{name}.Paths"
+  defp native_table(name), do: :persistent_term.get({__MODULE__, name})
+
+  @impl true
+  def init(opts) do
+    name = Keyword.fetch!(opts, :name)
+    interval = Keyword.get(opts, :interval, 1000)
+    timeout = Keyword.get(opts, :timeout, interval)
+    capacity = Keyword.get(opts, :capacity, 1024)
+    window = Keyword.get(opts, :window, 60)
+
+    case DiskSpace.snapshot_new(capacity, interval, timeout, window) do
+      {:ok, table} ->
+        Process.flag(:trap_exit, true)
+        :ets.new(table_name(name), [:named_table, :set, :protected, read_concurrency: true])
+        :persistent_term.put({__MODULE__, name}, table)
+        state = %{name: name, table: table}
+        Enum.each(Keyword.get(opts, :paths, []), &do_register(state, &1))
+        {:ok, state}
+
+      {:error, reason} ->
+        {:stop, reason}
+    end
+  end
+
+  @impl true
+  def handle_call({:register, path}, _from, state),
+    do: {:reply, do_register(state, path), state}
+
+  def handle_call({:unregister, path}, _from, state) do
+    case :ets.take(table_name(state.name), path) do
+      [{^path, {slot, generation}}] ->
+        DiskSpace.snapshot_unregister(state.table, slot, generation)
+
+      [] ->
+        false
+    end
+
+    {:reply, :ok, state}
+  end
+
+  @impl true
+  def terminate(_reason, state) do
+    DiskSpace.snapshot_stop(state.table)
+    :persistent_term.erase({__MODULE__, state.name})
+    :ok
+  end
+
+  defp do_register(state, path) do
+    table_name = table_name(state.name)
+
+    with [] <- :ets.lookup(table_name, path),
+         {:ok, slot, generation} <- DiskSpace.snapshot_register(state.table, path) do
+      :ets.insert(table_name, {path, {slot, generation}})
+      :ok
+    else
+      [_] -> :ok
+      {:error, reason} -> {:error, %{reason: reason, info: nil}}
+    end
+  end
+end
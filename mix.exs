@@ -64,9 +64,11 @@ defmodule DiskSpace.MixProject do
 
   defp deps do
     [
+      {:benchee, "~> 1.3", only: :dev, runtime: false},
       {:credo, "~> 1.7", only: [:dev, :test], runtime: false},
       {:ex_doc, "~> 0.38.2", only: :dev, runtime: false},
-      {:rustler, "~> 0.36.2", runtime: false}
+      {:rustler, "~> 0.36.2", runtime: false},
+      {:telemetry, "~> 1.1"}
     ]
   end
 
@@ -81,6 +83,7 @@ defmodule DiskSpace.MixProject do
 
   defp aliases do
     [
+      bench: "run bench/bench.exs",
       fmt: [
         "format",
         "cmd cargo fmt --manifest-path native/diskspace/Cargo.toml"
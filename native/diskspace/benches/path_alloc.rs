@@ -0,0 +1,115 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Heap allocations and time per path conversion, before and after the stack
+//! and thread-local buffers of `src/path.rs`. Run with
+//! `cargo bench --bench path_alloc` from `native/diskspace`.
+//!
+//! The NIF crate is a cdylib that only links inside the VM, so the module is
+//! compiled in directly instead of through the crate.
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::ffi::CString;
+use std::hint::black_box;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::Instant;
+
+#[allow(dead_code)]
+#[path = "../src/path.rs"]
+mod path;
+
+struct Counting;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for Counting {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: Counting = Counting;
+
+const ITERATIONS: usize = 1_000_000;
+
+fn report(label: &str, mut f: impl FnMut()) {
+    // warm up thread-local buffers so that only steady-state calls count
+    f();
+    let before = ALLOCATIONS.load(Ordering::Relaxed);
+    let start = Instant::now();
+    for _ in 0..ITERATIONS {
+        f();
+    }
+    let elapsed = start.elapsed();
+    let allocations = ALLOCATIONS.load(Ordering::Relaxed) - before;
+    println!(
+        "{label:<46} {:>6.2} allocs/call {:>8.1} ns/call",
+        allocations as f64 / ITERATIONS as f64,
+        elapsed.as_nanos() as f64 / ITERATIONS as f64
+    );
+}
+
+// The conversions as they were before `src/path.rs`
+fn cstring_before(bytes: &[u8]) -> CString {
+    CString::new(bytes).expect("no NUL in the sample paths")
+}
+
+fn long_wide_before(path: &str) -> Vec<u16> {
+    let long_path = if path.starts_with("\\\\") && !path.starts_with("\\\\?\\") {
+        format!("\\\\?\\UNC{}", &path[2..])
+    } else if !path.starts_with("\\\\?\\") {
+        format!("\\\\?\\{}", path)
+    } else {
+        path.to_string()
+    };
+    let mut wide: Vec<u16> = long_path.encode_utf16().collect();
+    wide.push(0);
+    wide
+}
+
+fn main() {
+    let short = "/var/lib/postgresql/16/main";
+    let long = format!("/srv/{}", "deeply-nested-directory/".repeat(12));
+    for (name, sample) in [("short", short), ("long", long.as_str())] {
+        println!("{name} path ({} bytes)", sample.len());
+        let bytes = sample.as_bytes();
+        report("  CString::new (before)", || {
+            black_box(cstring_before(black_box(bytes)));
+        });
+        report("  path::with_cstr (after)", || {
+            black_box(path::with_cstr(black_box(bytes), |cstr| {
+                black_box(cstr.as_ptr());
+            }));
+        });
+        report("  format! + UTF-16 Vec (before)", || {
+            black_box(long_wide_before(black_box(sample)));
+        });
+        let mut wide = Vec::new();
+        report("  path::push_long_wide, reused buffer (after)", || {
+            wide.clear();
+            path::push_long_wide(black_box(sample), &mut wide);
+            wide.push(0);
+            black_box(wide.as_ptr());
+        });
+        #[cfg(windows)]
+        {
+            let cstring = CString::new(bytes).expect("no NUL in the sample paths");
+            report("  path::with_long_wide (after)", || {
+                black_box(path::with_long_wide(black_box(&cstring), |wide| {
+                    black_box(wide.as_ptr());
+                }));
+            });
+        }
+    }
+}
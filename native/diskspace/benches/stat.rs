@@ -0,0 +1,103 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Latency of the space queries of `src/stat.rs` per kind of filesystem,
+//! batch throughput as the number of paths grows, and the path conversions of
+//! `src/path.rs` for the NIFs that borrow their path (`with_cstr`) and those
+//! that keep it (`to_cstring`, behind `get_path_from_term`). Run with
+//! `cargo bench --bench stat` from `native/diskspace`; criterion keeps the
+//! last run under `target/criterion` and reports the change against it.
+//!
+//! The local disk is this crate's directory and tmpfs is `/dev/shm` where it
+//! exists. Set `DISK_SPACE_BENCH_NETWORK` to a directory on a network mount
+//! to include one. Like `path_alloc`, the modules are compiled in directly, as
+//! the NIF crate only links inside the VM.
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use std::ffi::CString;
+use std::hint::black_box;
+use std::path::Path;
+
+#[allow(dead_code)]
+#[path = "../src/path.rs"]
+mod path;
+#[allow(dead_code)]
+#[path = "../src/stat.rs"]
+mod stat;
+#[allow(dead_code)]
+#[cfg(windows)]
+#[path = "../src/volumes.rs"]
+mod volumes;
+
+fn local_path() -> CString {
+    CString::new(env!("CARGO_MANIFEST_DIR")).expect("no NUL in the crate path")
+}
+
+fn targets() -> Vec<(&'static str, CString)> {
+    let mut targets = vec![("local", local_path())];
+    if Path::new("/dev/shm").is_dir() {
+        targets.push(("tmpfs", CString::new("/dev/shm").unwrap()));
+    }
+    if let Ok(network) = std::env::var("DISK_SPACE_BENCH_NETWORK") {
+        let network = CString::new(network).expect("no NUL in DISK_SPACE_BENCH_NETWORK");
+        targets.push(("network", network));
+    }
+    targets
+}
+
+fn single(c: &mut Criterion) {
+    let mut group = c.benchmark_group("stat_path");
+    for (kind, path) in targets() {
+        group.bench_with_input(BenchmarkId::new("validate", kind), &path, |b, path| {
+            b.iter(|| stat::stat_path_with(black_box(path), true))
+        });
+        group.bench_with_input(BenchmarkId::new("no_validate", kind), &path, |b, path| {
+            b.iter(|| stat::stat_path_with(black_box(path), false))
+        });
+        group.bench_with_input(BenchmarkId::new("timed", kind), &path, |b, path| {
+            b.iter(|| stat::stat_path_timed(black_box(path), true))
+        });
+    }
+    group.finish();
+}
+
+// What stat_fs_many and stat_fs_many_by_device do per batch, minus the terms
+fn batch(c: &mut Criterion) {
+    let local = local_path();
+    let mut group = c.benchmark_group("batch");
+    for count in [1, 10, 100, 1000] {
+        let paths = vec![Some(local.clone()); count];
+        group.throughput(Throughput::Elements(count as u64));
+        group.bench_with_input(BenchmarkId::new("per_path", count), &paths, |b, paths| {
+            b.iter(|| {
+                paths
+                    .iter()
+                    .flatten()
+                    .map(|path| stat::stat_path_with(black_box(path), true))
+                    .collect::<Vec<_>>()
+            })
+        });
+        group.bench_with_input(BenchmarkId::new("by_device", count), &paths, |b, paths| {
+            b.iter(|| stat::stat_many_by_device(black_box(paths)))
+        });
+    }
+    group.finish();
+}
+
+fn path_conversion(c: &mut Criterion) {
+    let long = format!("/srv/{}", "deeply-nested-directory/".repeat(12));
+    let mut group = c.benchmark_group("path");
+    for (kind, sample) in [("short", "/var/lib/postgresql/16/main"), ("long", &long)] {
+        let bytes = sample.as_bytes();
+        group.bench_with_input(BenchmarkId::new("with_cstr", kind), bytes, |b, bytes| {
+            b.iter(|| path::with_cstr(black_box(bytes), |cstr| black_box(cstr.as_ptr()).is_null()))
+        });
+        group.bench_with_input(BenchmarkId::new("to_cstring", kind), bytes, |b, bytes| {
+            b.iter(|| path::to_cstring(black_box(bytes)))
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, single, batch, path_conversion);
+criterion_main!(benches);
@@ -0,0 +1,217 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! NIFs that run space queries on the bounded worker pool in `pool.rs` and
+//! deliver each result to the caller as `{disk_space_stat, Ref, Result}`.
+//!
+//! With coalescing, concurrent queries for the same path (and the same
+//! directory check) share one in-flight job: later callers only register as
+//! waiters and get the same result, each encoded in its own format.
+
+use crate::pool::{Pool, Ticket};
+use crate::stat::StatResult;
+use crate::{atoms, encode_stat_result_as, get_path_from_term, make_error_tuple, stat, Format};
+use rustler::{Encoder, Env, LocalPid, NifResult, OwnedEnv, ResourceArc, SavedTerm, Term};
+use std::collections::HashMap;
+use std::ffi::CString;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex, OnceLock};
+
+#[rustler::resource_impl]
+impl rustler::Resource for Ticket {}
+
+struct Waiter {
+    ticket: ResourceArc<Ticket>,
+    pid: LocalPid,
+    owned_env: OwnedEnv,
+    saved_ref: SavedTerm,
+    format: Format,
+}
+
+impl Waiter {
+    fn new(
+        env: Env<'_>,
+        ref_term: Term<'_>,
+        ticket: ResourceArc<Ticket>,
+        format: Format,
+    ) -> Waiter {
+        let owned_env = OwnedEnv::new();
+        let saved_ref = owned_env.save(ref_term);
+        Waiter {
+            ticket,
+            pid: env.pid(),
+            owned_env,
+            saved_ref,
+            format,
+        }
+    }
+
+    fn deliver(self, pool: &Pool, result: &StatResult) {
+        let format = self.format;
+        self.send(pool, |env| {
+            match encode_stat_result_as(env, result, format) {
+                Ok(term) => term,
+                Err(_) => atoms::error().encode(env),
+            }
+        });
+    }
+
+    // Send {disk_space_stat, Ref, Result} unless the caller gave up
+    fn send(mut self, pool: &Pool, result: impl for<'a> FnOnce(Env<'a>) -> Term<'a>) {
+        if !self.ticket.finish(pool) {
+            return;
+        }
+        let saved_ref = self.saved_ref;
+        let _ = self.owned_env.send_and_clear(&self.pid, |env| {
+            (atoms::disk_space_stat(), saved_ref.load(env), result(env)).encode(env)
+        });
+    }
+}
+
+// Waiters of one in-flight query, keyed by path and directory check in
+// `in_flight()`
+type Flight = Arc<Mutex<Vec<Waiter>>>;
+
+fn in_flight() -> &'static Mutex<HashMap<Vec<u8>, Flight>> {
+    static IN_FLIGHT: OnceLock<Mutex<HashMap<Vec<u8>, Flight>>> = OnceLock::new();
+    IN_FLIGHT.get_or_init(|| Mutex::new(HashMap::new()))
+}
+
+static COALESCED: AtomicU64 = AtomicU64::new(0);
+
+fn lock<T>(mutex: &Mutex<T>) -> std::sync::MutexGuard<'_, T> {
+    mutex.lock().unwrap_or_else(|e| e.into_inner())
+}
+
+fn run_single(
+    pool: &'static Pool,
+    path_cstr: CString,
+    validate: bool,
+    waiter: Waiter,
+) -> Result<(), ()> {
+    let job = Box::new(move || {
+        if !waiter.ticket.start() {
+            return;
+        }
+        let result = stat::stat_path_with(&path_cstr, validate);
+        waiter.deliver(pool, &result);
+    });
+    pool.submit(job).map_err(|_| ())
+}
+
+fn run_coalesced(
+    pool: &'static Pool,
+    path_cstr: CString,
+    validate: bool,
+    waiter: Waiter,
+) -> Result<(), ()> {
+    let mut key = path_cstr.as_bytes_with_nul().to_vec();
+    key.push(validate as u8);
+    let flight: Flight = {
+        let mut flights = lock(in_flight());
+        if let Some(flight) = flights.get(&key) {
+            lock(flight).push(waiter);
+            COALESCED.fetch_add(1, Ordering::Relaxed);
+            return Ok(());
+        }
+        let flight = Arc::new(Mutex::new(vec![waiter]));
+        flights.insert(key.clone(), flight.clone());
+        flight
+    };
+    let job_flight = flight.clone();
+    let job_key = key.clone();
+    let job = Box::new(move || {
+        // skip the syscall if every caller gave up while the job was queued
+        let started = lock(&job_flight)
+            .iter()
+            .fold(false, |any, waiter| waiter.ticket.start() || any);
+        let mut result = if started {
+            Some(stat::stat_path_with(&path_cstr, validate))
+        } else {
+            None
+        };
+        // no new waiters can join once the flight is out of the map
+        lock(in_flight()).remove(&job_key);
+        let waiters = std::mem::take(&mut *lock(&job_flight));
+        // callers that joined after the check above still need an answer
+        if result.is_none() && waiters.iter().fold(false, |any, w| w.ticket.start() || any) {
+            result = Some(stat::stat_path_with(&path_cstr, validate));
+        }
+        if let Some(result) = result {
+            for waiter in waiters {
+                waiter.deliver(pool, &result);
+            }
+        }
+    });
+    if pool.submit(job).is_err() {
+        // callers that joined while the job was being refused wait for a
+        // message, as if it had been queued; the first one is this caller
+        let waiters = {
+            let mut flights = lock(in_flight());
+            flights.remove(&key);
+            std::mem::take(&mut *lock(&flight))
+        };
+        for waiter in waiters.into_iter().skip(1) {
+            waiter.send(pool, |env| (atoms::error(), atoms::busy()).encode(env));
+        }
+        return Err(());
+    }
+    Ok(())
+}
+
+// Queue a query without blocking the calling scheduler; returns {ok, Ticket}
+#[rustler::nif]
+fn stat_fs_async<'a>(
+    env: Env<'a>,
+    path_term: Term<'a>,
+    ref_term: Term<'a>,
+    coalesce: bool,
+    format: Format,
+    validate: bool,
+) -> NifResult<Term<'a>> {
+    let path_cstr = match get_path_from_term(env, path_term) {
+        Ok(path) => path,
+        Err(_) => return make_error_tuple(env, atoms::invalid_path()),
+    };
+    let pool = Pool::global();
+    let ticket = ResourceArc::new(Ticket::new());
+    let waiter = Waiter::new(env, ref_term, ticket.clone(), format);
+    let submitted = if coalesce {
+        run_coalesced(pool, path_cstr, validate, waiter)
+    } else {
+        run_single(pool, path_cstr, validate, waiter)
+    };
+    match submitted {
+        Ok(()) => Ok((atoms::ok(), ticket).encode(env)),
+        Err(()) => make_error_tuple(env, atoms::busy()),
+    }
+}
+
+// Give up on a queued query; false means its result is already on the way
+#[rustler::nif]
+fn cancel_async(ticket: ResourceArc<Ticket>) -> bool {
+    ticket.cancel(Pool::global())
+}
+
+#[rustler::nif]
+fn configure_async_pool(max_workers: usize, max_queue: usize) -> rustler::Atom {
+    Pool::global().configure(max_workers, max_queue);
+    atoms::ok()
+}
+
+#[rustler::nif]
+fn async_pool_info<'a>(env: Env<'a>) -> NifResult<Term<'a>> {
+    let info = Pool::global().info();
+    rustler::types::map::map_new(env)
+        .map_put(atoms::max_workers().to_term(env), info.max_workers)?
+        .map_put(atoms::max_queue().to_term(env), info.max_queue)?
+        .map_put(atoms::workers().to_term(env), info.workers)?
+        .map_put(atoms::busy().to_term(env), info.busy)?
+        .map_put(atoms::queued().to_term(env), info.queued)?
+        .map_put(atoms::stuck().to_term(env), info.stuck)?
+        .map_put(atoms::rejected().to_term(env), info.rejected)?
+        .map_put(
+            atoms::coalesced().to_term(env),
+            COALESCED.load(Ordering::Relaxed),
+        )
+}
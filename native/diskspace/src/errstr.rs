@@ -0,0 +1,96 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Descriptions of OS error codes for the `errstr` of error tuples, looked up
+//! once per code: through `io::Error` (`strerror`) on Unix and `FormatMessageW`
+//! on Windows. A path that stays unmounted fails the same way on every poll,
+//! so after the first failure the lookup is a read-locked map hit.
+
+use std::collections::HashMap;
+#[cfg(unix)]
+use std::io;
+#[cfg(windows)]
+use std::ptr;
+use std::sync::{Arc, OnceLock, RwLock};
+#[cfg(windows)]
+use widestring::U16Str;
+#[cfg(windows)]
+use windows::core::PWSTR;
+#[cfg(windows)]
+use windows::Win32::Foundation::{LocalFree, HLOCAL};
+#[cfg(windows)]
+use windows::Win32::System::Diagnostics::Debug::{
+    FormatMessageW, FORMAT_MESSAGE_ALLOCATE_BUFFER, FORMAT_MESSAGE_FROM_SYSTEM,
+    FORMAT_MESSAGE_IGNORE_INSERTS,
+};
+
+// Far more than the codes the space queries fail with; bounds the map if a
+// caller keeps hitting new ones
+const MAX_CACHED: usize = 256;
+
+fn cache() -> &'static RwLock<HashMap<i64, Arc<str>>> {
+    static CACHE: OnceLock<RwLock<HashMap<i64, Arc<str>>>> = OnceLock::new();
+    CACHE.get_or_init(|| RwLock::new(HashMap::new()))
+}
+
+/// The description of OS error `code`, from the cache when it has been seen.
+pub(crate) fn describe(code: i64) -> Arc<str> {
+    let cached = cache()
+        .read()
+        .unwrap_or_else(|e| e.into_inner())
+        .get(&code)
+        .cloned();
+    if let Some(description) = cached {
+        return description;
+    }
+    let description: Arc<str> = lookup(code).into();
+    let mut cache = cache().write().unwrap_or_else(|e| e.into_inner());
+    if cache.len() >= MAX_CACHED {
+        return description;
+    }
+    cache.entry(code).or_insert(description).clone()
+}
+
+#[cfg(unix)]
+fn lookup(code: i64) -> String {
+    io::Error::from_raw_os_error(code as i32).to_string()
+}
+
+#[cfg(windows)]
+fn lookup(code: i64) -> String {
+    let mut buffer_ptr: *mut u16 = ptr::null_mut();
+    let flags =
+        FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS;
+    let lang: u32 = 0; // Use system default for better localization
+    let len = unsafe {
+        FormatMessageW(
+            flags,
+            None,
+            code as u32,
+            lang,
+            PWSTR(&mut buffer_ptr as *mut *mut u16 as *mut u16),
+            0,
+            None,
+        )
+    };
+    let errstr = if len == 0 {
+        "Unknown WinAPI error".to_string()
+    } else {
+        // Create a slice with the exact length returned by FormatMessageW (excluding the null terminator).
+        let message_slice = unsafe { std::slice::from_raw_parts(buffer_ptr, len as usize) };
+        // Convert this UTF-16 slice to a Rust String.
+        let wide_str = U16Str::from_slice(message_slice);
+        // FormatMessageW often adds \r\n, so trim the end.
+        wide_str.to_string_lossy().trim_end().to_string()
+    };
+    if !buffer_ptr.is_null() {
+        // The memory allocated by FormatMessageW with FORMAT_MESSAGE_ALLOCATE_BUFFER
+        // must be freed with LocalFree.
+        unsafe {
+            // Construct an HLOCAL from the pointer. The `windows-rs` crate
+            // will automatically convert HLOCAL into the Option<HLOCAL> the function expects.
+            let _ = LocalFree(Some(HLOCAL(buffer_ptr as *mut ::core::ffi::c_void)));
+        }
+    }
+    errstr
+}
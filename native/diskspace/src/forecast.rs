@@ -0,0 +1,96 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Fill-rate estimation over a fixed window of `(time, used)` samples.
+//!
+//! Each path keeps a ring buffer of its last samples together with the sums a
+//! least-squares line needs (Σt, Σu, Σt², Σtu). A new sample adds its terms and
+//! subtracts those of the sample it evicts, so both updating and forecasting
+//! are O(1) however long the window is. The sums are exact `i128`s, which
+//! avoids the cancellation that makes running float sums drift.
+
+use crate::stat::FsStats;
+
+/// The most samples a window may keep; bounds the sums well inside `i128`
+/// for times in milliseconds and 64-bit byte counts.
+pub const MAX_WINDOW: usize = 1024;
+
+/// Growth of used space, from the least-squares line through the window.
+pub struct Forecast {
+    /// Bytes per second, negative while space is being freed.
+    pub rate: f64,
+    /// Seconds until `available` reaches zero at `rate`; `None` unless growing.
+    pub time_to_full: Option<f64>,
+    pub samples: usize,
+    /// Milliseconds between the oldest and the newest sample.
+    pub window_ms: u64,
+}
+
+pub struct FillRate {
+    // (milliseconds, used bytes), oldest at `next` once full
+    samples: Box<[(u64, u64)]>,
+    next: usize,
+    len: usize,
+    sum_t: i128,
+    sum_u: i128,
+    sum_tt: i128,
+    sum_tu: i128,
+    available: u64,
+}
+
+impl FillRate {
+    pub fn new(window: usize) -> FillRate {
+        FillRate {
+            samples: vec![(0, 0); window.clamp(2, MAX_WINDOW)].into_boxed_slice(),
+            next: 0,
+            len: 0,
+            sum_t: 0,
+            sum_u: 0,
+            sum_tt: 0,
+            sum_tu: 0,
+            available: 0,
+        }
+    }
+
+    fn add(&mut self, (t, u): (u64, u64), sign: i128) {
+        let (t, u) = (t as i128, u as i128);
+        self.sum_t += sign * t;
+        self.sum_u += sign * u;
+        self.sum_tt += sign * t * t;
+        self.sum_tu += sign * t * u;
+    }
+
+    /// Record the stats measured at `at_ms`.
+    pub fn push(&mut self, at_ms: u64, stats: &FsStats) {
+        if self.len == self.samples.len() {
+            self.add(self.samples[self.next], -1);
+        } else {
+            self.len += 1;
+        }
+        let sample = (at_ms, stats.used);
+        self.samples[self.next] = sample;
+        self.add(sample, 1);
+        self.next = (self.next + 1) % self.samples.len();
+        self.available = stats.available;
+    }
+
+    /// `None` until the window holds two samples taken at different times.
+    pub fn forecast(&self) -> Option<Forecast> {
+        let n = self.len as i128;
+        let denominator = n * self.sum_tt - self.sum_t * self.sum_t;
+        if self.len < 2 || denominator == 0 {
+            return None;
+        }
+        let numerator = n * self.sum_tu - self.sum_t * self.sum_u;
+        let rate = numerator as f64 / denominator as f64 * 1000.0;
+        let capacity = self.samples.len();
+        let newest = self.samples[(self.next + capacity - 1) % capacity].0;
+        let oldest = self.samples[(self.next + capacity - self.len) % capacity].0;
+        Some(Forecast {
+            rate,
+            time_to_full: (rate > 0.0).then(|| self.available as f64 / rate),
+            samples: self.len,
+            window_ms: newest.saturating_sub(oldest),
+        })
+    }
+}
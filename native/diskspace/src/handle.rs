@@ -0,0 +1,154 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Open directory handles for repeated space queries without path resolution.
+//!
+//! On Unix the directory is opened once with `O_DIRECTORY` (which is also the
+//! directory check) and then queried with `fstatfs`/`fstatvfs`. Windows has no
+//! handle-based `GetDiskFreeSpaceExW`, so the handle pins the directory while
+//! its volume root, resolved once at open time, is what gets queried.
+
+use crate::stat::{Reason, StatError, StatResult};
+#[cfg(unix)]
+use nix::fcntl::{open, OFlag};
+#[cfg(unix)]
+use nix::sys::stat::Mode;
+#[cfg(all(unix, target_os = "linux"))]
+use nix::sys::statfs::fstatfs;
+#[cfg(all(unix, not(target_os = "linux")))]
+use nix::sys::statvfs::fstatvfs;
+use std::ffi::CStr;
+#[cfg(unix)]
+use std::os::fd::OwnedFd;
+use std::sync::{Arc, Mutex};
+#[cfg(windows)]
+use windows::core::PCWSTR;
+#[cfg(windows)]
+use windows::Win32::Foundation::{CloseHandle, HANDLE};
+#[cfg(windows)]
+use windows::Win32::Storage::FileSystem::{
+    CreateFileW, FILE_FLAG_BACKUP_SEMANTICS, FILE_READ_ATTRIBUTES, FILE_SHARE_DELETE,
+    FILE_SHARE_READ, FILE_SHARE_WRITE, OPEN_EXISTING,
+};
+
+#[cfg(unix)]
+struct Inner {
+    fd: OwnedFd,
+}
+
+#[cfg(windows)]
+struct Inner {
+    handle: HANDLE,
+    // null-terminated
+    volume_root: Vec<u16>,
+}
+
+// HANDLE is a raw pointer; the handle itself may be used from any thread.
+#[cfg(windows)]
+unsafe impl Send for Inner {}
+#[cfg(windows)]
+unsafe impl Sync for Inner {}
+
+#[cfg(windows)]
+impl Drop for Inner {
+    fn drop(&mut self) {
+        let _ = unsafe { CloseHandle(self.handle) };
+    }
+}
+
+/// An open directory. Queries take a reference to the OS handle, so `close`
+/// never waits for (or breaks) a query that is already in flight.
+pub struct DirHandle {
+    inner: Mutex<Option<Arc<Inner>>>,
+}
+
+impl DirHandle {
+    /// Open the directory at `path_cstr`; fails the same way `stat_path` does
+    /// for paths that are missing or not directories.
+    #[cfg(unix)]
+    pub fn open(path_cstr: &CStr) -> Result<DirHandle, StatError> {
+        let flags = OFlag::O_RDONLY | OFlag::O_DIRECTORY | OFlag::O_CLOEXEC;
+        match open(path_cstr, flags, Mode::empty()) {
+            Ok(fd) => Ok(DirHandle::wrap(Inner { fd })),
+            Err(err) => Err(StatError::os(Reason::NotDirectory, err as i64)),
+        }
+    }
+
+    /// Open the directory at `path_cstr`; fails the same way `stat_path` does
+    /// for paths that are missing or not directories.
+    #[cfg(windows)]
+    pub fn open(path_cstr: &CStr) -> Result<DirHandle, StatError> {
+        let wide_str = crate::stat::long_wide_path(path_cstr)?;
+        let long_wpath = PCWSTR::from_raw(wide_str.as_ptr());
+        crate::stat::check_dir_wide(long_wpath)?;
+        let mut volume_root = crate::stat::volume_root_wide(long_wpath)?;
+        volume_root.push(0);
+        let handle = unsafe {
+            CreateFileW(
+                long_wpath,
+                FILE_READ_ATTRIBUTES.0,
+                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                None,
+                OPEN_EXISTING,
+                FILE_FLAG_BACKUP_SEMANTICS,
+                None,
+            )
+        };
+        match handle {
+            Ok(handle) => Ok(DirHandle::wrap(Inner {
+                handle,
+                volume_root,
+            })),
+            Err(e) => {
+                let err_code = (e.code().0 & 0xFFFF) as u32;
+                Err(StatError::os(Reason::WinapiFailed, err_code as i64))
+            }
+        }
+    }
+
+    fn wrap(inner: Inner) -> DirHandle {
+        DirHandle {
+            inner: Mutex::new(Some(Arc::new(inner))),
+        }
+    }
+
+    fn current(&self) -> Result<Arc<Inner>, StatError> {
+        let guard = self.inner.lock().unwrap_or_else(|e| e.into_inner());
+        guard
+            .clone()
+            .ok_or_else(|| StatError::new(Reason::HandleClosed))
+    }
+
+    /// Query the filesystem the directory lives on.
+    #[cfg(all(unix, target_os = "linux"))]
+    pub fn stat(&self) -> StatResult {
+        let inner = self.current()?;
+        match fstatfs(&inner.fd) {
+            Ok(buf) => Ok(crate::stat::stats_from_statfs(&buf)),
+            Err(err) => Err(StatError::os(Reason::StatfsFailed, err as i64)),
+        }
+    }
+
+    /// Query the filesystem the directory lives on.
+    #[cfg(all(unix, not(target_os = "linux")))]
+    pub fn stat(&self) -> StatResult {
+        let inner = self.current()?;
+        match fstatvfs(&inner.fd) {
+            Ok(buf) => Ok(crate::stat::stats_from_statvfs(&buf)),
+            Err(err) => Err(StatError::os(Reason::StatvfsFailed, err as i64)),
+        }
+    }
+
+    /// Query the filesystem the directory lives on.
+    #[cfg(windows)]
+    pub fn stat(&self) -> StatResult {
+        let inner = self.current()?;
+        crate::stat::disk_free_wide(PCWSTR::from_raw(inner.volume_root.as_ptr()))
+    }
+
+    /// Release the OS handle; returns `false` if it was already closed.
+    pub fn close(&self) -> bool {
+        let mut guard = self.inner.lock().unwrap_or_else(|e| e.into_inner());
+        guard.take().is_some()
+    }
+}
@@ -0,0 +1,429 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! The on-disk index that lets a usage walk reuse what an earlier walk found
+//! in directories that have not changed since.
+//!
+//! One record per directory, keyed by `(st_dev, st_ino)` and stamped with the
+//! directory's mtime and ctime: the totals of its entries other than the
+//! subdirectories that were descended into, the names of those
+//! subdirectories and the hard-linked files it contains (kept apart so that
+//! they are still counted only once per walk). A directory's timestamps
+//! change whenever an entry is created, removed or renamed in it, so a
+//! matching stamp means the same names are still there; the walker then skips
+//! listing it and querying its entries, but still visits its subdirectories,
+//! which carry their own records. A file that is rewritten in place does not
+//! touch its directory and keeps its recorded size until the directory
+//! changes.
+//!
+//! The file is read through a read-only `mmap`. It is laid out as a header,
+//! the fixed-size records sorted by key (for binary search) and the names
+//! and links they refer to, all in native byte order:
+//!
+//! ```text
+//! header:  magic "DSUSAGE\0", version u32, flags u32, records u64, reserved u64
+//! record:  dev, ino, mtime, mtime_nsec, ctime, ctime_nsec,
+//!          apparent, allocated, files, dirs, data_offset, data_len: u64;
+//!          subdirs u32, links u32
+//! data:    subdirs x { len u32, name }, links x { dev, ino, size, blocks: u64 }
+//! ```
+//!
+//! A new index is written to a temporary file next to the old one and
+//! renamed over it, so readers (including the walk that is writing it) keep
+//! seeing a complete file. Files with another magic, version, byte order or
+//! `one_file_system` setting, and records whose data is out of bounds, are
+//! ignored, which makes the next walk list those directories again.
+
+use nix::sys::stat::FileStat;
+use std::ffi::{CStr, OsStr};
+use std::fs::File;
+use std::io::{self, BufWriter, Write};
+use std::os::fd::AsRawFd;
+use std::os::unix::ffi::OsStrExt;
+use std::path::Path;
+use std::ptr;
+use std::time::{SystemTime, UNIX_EPOCH};
+
+const MAGIC: &[u8; 8] = b"DSUSAGE\0";
+const VERSION: u32 = 1;
+const FLAG_ONE_FILE_SYSTEM: u32 = 1;
+const HEADER_LEN: usize = 32;
+const RECORD_LEN: usize = 104;
+const LINK_LEN: usize = 32;
+
+/// Identifies a directory and the state it was recorded in.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Stamp {
+    pub dev: u64,
+    pub ino: u64,
+    mtime: (i64, i64),
+    ctime: (i64, i64),
+}
+
+impl From<&FileStat> for Stamp {
+    fn from(stat: &FileStat) -> Stamp {
+        Stamp {
+            dev: stat.st_dev as u64,
+            ino: stat.st_ino as u64,
+            mtime: (stat.st_mtime as i64, stat.st_mtime_nsec as i64),
+            ctime: (stat.st_ctime as i64, stat.st_ctime_nsec as i64),
+        }
+    }
+}
+
+impl Stamp {
+    /// Whether the directory was last changed before `cutoff` (seconds since
+    /// the epoch). A change made right after it was listed can carry the
+    /// same coarse timestamp as the listing saw, so only directories that
+    /// have been left alone for a while are recorded.
+    pub fn settled(&self, cutoff: i64) -> bool {
+        self.mtime.0 < cutoff && self.ctime.0 < cutoff
+    }
+}
+
+/// The cutoff for `Stamp::settled` for a walk starting now.
+pub fn cutoff() -> i64 {
+    let now = SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |since| since.as_secs() as i64);
+    now - 1
+}
+
+/// A hard-linked file, counted only if no other link was counted yet.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Link {
+    pub dev: u64,
+    pub ino: u64,
+    pub size: u64,
+    pub blocks: u64,
+}
+
+/// Sizes and counts of a directory's entries, except descended subdirectories
+/// and hard links.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct Totals {
+    pub apparent: u64,
+    pub allocated: u64,
+    pub files: u64,
+    pub dirs: u64,
+}
+
+/// A record of the index being built.
+pub struct Record {
+    stamp: Stamp,
+    totals: Totals,
+    subdirs: u32,
+    links: u32,
+    names: Vec<u8>,
+    linked: Vec<u8>,
+}
+
+impl Record {
+    pub fn new(stamp: Stamp) -> Record {
+        Record {
+            stamp,
+            totals: Totals::default(),
+            subdirs: 0,
+            links: 0,
+            names: Vec::new(),
+            linked: Vec::new(),
+        }
+    }
+
+    pub fn set_totals(&mut self, totals: Totals) {
+        self.totals = totals;
+    }
+
+    pub fn push_subdir(&mut self, name: &CStr) {
+        let name = name.to_bytes();
+        self.names
+            .extend_from_slice(&(name.len() as u32).to_ne_bytes());
+        self.names.extend_from_slice(name);
+        self.subdirs += 1;
+    }
+
+    pub fn push_link(&mut self, link: &Link) {
+        for field in [link.dev, link.ino, link.size, link.blocks] {
+            self.linked.extend_from_slice(&field.to_ne_bytes());
+        }
+        self.links += 1;
+    }
+
+    fn key(&self) -> (u64, u64) {
+        (self.stamp.dev, self.stamp.ino)
+    }
+}
+
+/// A record found in the index, its data already checked.
+pub struct Cached<'a> {
+    pub totals: Totals,
+    subdirs: usize,
+    links: usize,
+    data: &'a [u8],
+}
+
+impl<'a> Cached<'a> {
+    /// The names of the subdirectories to visit, without terminators.
+    pub fn subdirs(&self) -> impl Iterator<Item = &'a [u8]> {
+        let mut rest = self.data;
+        (0..self.subdirs).map(move |_| {
+            let len = u32_at(rest, 0) as usize;
+            let name = &rest[4..4 + len];
+            rest = &rest[4 + len..];
+            name
+        })
+    }
+
+    pub fn links(&self) -> impl Iterator<Item = Link> + 'a {
+        let links = &self.data[self.data.len() - self.links * LINK_LEN..];
+        links.chunks_exact(LINK_LEN).map(|link| Link {
+            dev: u64_at(link, 0),
+            ino: u64_at(link, 8),
+            size: u64_at(link, 16),
+            blocks: u64_at(link, 24),
+        })
+    }
+
+    /// The same record, for the index being built.
+    pub fn to_record(&self, stamp: Stamp) -> Record {
+        let split = self.data.len() - self.links * LINK_LEN;
+        Record {
+            stamp,
+            totals: self.totals,
+            subdirs: self.subdirs as u32,
+            links: self.links as u32,
+            names: self.data[..split].to_vec(),
+            linked: self.data[split..].to_vec(),
+        }
+    }
+}
+
+fn u32_at(bytes: &[u8], at: usize) -> u32 {
+    u32::from_ne_bytes(bytes[at..at + 4].try_into().expect("4 bytes"))
+}
+
+fn u64_at(bytes: &[u8], at: usize) -> u64 {
+    u64::from_ne_bytes(bytes[at..at + 8].try_into().expect("8 bytes"))
+}
+
+fn i64_at(bytes: &[u8], at: usize) -> i64 {
+    u64_at(bytes, at) as i64
+}
+
+struct Mapping {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        unsafe { libc::munmap(self.ptr, self.len) };
+    }
+}
+
+/// The index written by an earlier walk, if any.
+pub struct Index {
+    mapping: Option<Mapping>,
+    records: usize,
+}
+
+// The mapping is read-only and private to this process
+unsafe impl Send for Index {}
+unsafe impl Sync for Index {}
+
+fn path_of(path: &CStr) -> &Path {
+    Path::new(OsStr::from_bytes(path.to_bytes()))
+}
+
+fn flags(one_file_system: bool) -> u32 {
+    if one_file_system {
+        FLAG_ONE_FILE_SYSTEM
+    } else {
+        0
+    }
+}
+
+impl Index {
+    fn empty() -> Index {
+        Index {
+            mapping: None,
+            records: 0,
+        }
+    }
+
+    /// Map the index at `path`; an index that is missing, unreadable or was
+    /// written by an incompatible walk is treated as empty.
+    pub fn open(path: &CStr, one_file_system: bool) -> Index {
+        let Ok(file) = File::open(path_of(path)) else {
+            return Index::empty();
+        };
+        let len = match file.metadata() {
+            Ok(metadata) if metadata.len() >= HEADER_LEN as u64 => metadata.len() as usize,
+            _ => return Index::empty(),
+        };
+        let ptr = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Index::empty();
+        }
+        let mut index = Index {
+            mapping: Some(Mapping { ptr, len }),
+            records: 0,
+        };
+        let bytes = index.bytes();
+        let records = u64_at(bytes, 16) as usize;
+        let valid = &bytes[..8] == MAGIC
+            && u32_at(bytes, 8) == VERSION
+            && u32_at(bytes, 12) == flags(one_file_system)
+            && records
+                .checked_mul(RECORD_LEN)
+                .and_then(|len| len.checked_add(HEADER_LEN))
+                .is_some_and(|end| end <= bytes.len());
+        if !valid {
+            return Index::empty();
+        }
+        index.records = records;
+        index
+    }
+
+    fn bytes(&self) -> &[u8] {
+        match &self.mapping {
+            Some(mapping) => unsafe {
+                std::slice::from_raw_parts(mapping.ptr as *const u8, mapping.len)
+            },
+            None => &[],
+        }
+    }
+
+    fn record(&self, i: usize) -> &[u8] {
+        let start = HEADER_LEN + i * RECORD_LEN;
+        &self.bytes()[start..start + RECORD_LEN]
+    }
+
+    /// The record for the directory `stamp` identifies, if it was recorded
+    /// with the same timestamps.
+    pub fn lookup(&self, stamp: &Stamp) -> Option<Cached<'_>> {
+        let key = (stamp.dev, stamp.ino);
+        let (mut low, mut high) = (0, self.records);
+        while low < high {
+            let mid = low + (high - low) / 2;
+            let record = self.record(mid);
+            match (u64_at(record, 0), u64_at(record, 8)).cmp(&key) {
+                std::cmp::Ordering::Less => low = mid + 1,
+                std::cmp::Ordering::Greater => high = mid,
+                std::cmp::Ordering::Equal => return self.cached(record, stamp),
+            }
+        }
+        None
+    }
+
+    fn cached<'a>(&'a self, record: &'a [u8], stamp: &Stamp) -> Option<Cached<'a>> {
+        let mtime = (i64_at(record, 16), i64_at(record, 24));
+        let ctime = (i64_at(record, 32), i64_at(record, 40));
+        if mtime != stamp.mtime || ctime != stamp.ctime {
+            return None;
+        }
+        let offset = u64_at(record, 80) as usize;
+        let len = u64_at(record, 88) as usize;
+        let data = self.bytes().get(offset..offset.checked_add(len)?)?;
+        let subdirs = u32_at(record, 96) as usize;
+        let links = u32_at(record, 100) as usize;
+        // names must fill the data up to the links exactly and be valid
+        // C strings, or none of the record is used
+        let names_len = len.checked_sub(links.checked_mul(LINK_LEN)?)?;
+        let mut at = 0;
+        for _ in 0..subdirs {
+            let name_len = u32_at(data.get(at..at + 4)?, 0) as usize;
+            let name = data.get(at + 4..(at + 4).checked_add(name_len)?)?;
+            if name.is_empty() || name.contains(&0) {
+                return None;
+            }
+            at += 4 + name_len;
+        }
+        if at != names_len {
+            return None;
+        }
+        Some(Cached {
+            totals: Totals {
+                apparent: u64_at(record, 48),
+                allocated: u64_at(record, 56),
+                files: u64_at(record, 64),
+                dirs: u64_at(record, 72),
+            },
+            subdirs,
+            links,
+            data,
+        })
+    }
+}
+
+/// Replace the index at `path` with `records`.
+pub fn write(path: &CStr, one_file_system: bool, mut records: Vec<Record>) -> io::Result<()> {
+    records.sort_unstable_by_key(Record::key);
+    // a directory reachable twice (e.g. through a bind mount) needs one record
+    records.dedup_by_key(|record| record.key());
+    let path = path_of(path);
+    let mut temporary = path.as_os_str().to_owned();
+    let nanos = SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |since| since.subsec_nanos());
+    temporary.push(format!(".{}.{}.tmp", std::process::id(), nanos));
+    let written = write_file(Path::new(&temporary), one_file_system, &records)
+        .and_then(|()| std::fs::rename(&temporary, path));
+    if written.is_err() {
+        let _ = std::fs::remove_file(&temporary);
+    }
+    written
+}
+
+fn write_file(path: &Path, one_file_system: bool, records: &[Record]) -> io::Result<()> {
+    let file = std::fs::OpenOptions::new()
+        .write(true)
+        .create_new(true)
+        .open(path)?;
+    let mut out = BufWriter::new(file);
+    out.write_all(MAGIC)?;
+    out.write_all(&VERSION.to_ne_bytes())?;
+    out.write_all(&flags(one_file_system).to_ne_bytes())?;
+    out.write_all(&(records.len() as u64).to_ne_bytes())?;
+    out.write_all(&0u64.to_ne_bytes())?;
+    let mut offset = (HEADER_LEN + records.len() * RECORD_LEN) as u64;
+    for record in records {
+        let stamp = &record.stamp;
+        let totals = &record.totals;
+        let len = (record.names.len() + record.linked.len()) as u64;
+        for field in [
+            stamp.dev,
+            stamp.ino,
+            stamp.mtime.0 as u64,
+            stamp.mtime.1 as u64,
+            stamp.ctime.0 as u64,
+            stamp.ctime.1 as u64,
+            totals.apparent,
+            totals.allocated,
+            totals.files,
+            totals.dirs,
+            offset,
+            len,
+        ] {
+            out.write_all(&field.to_ne_bytes())?;
+        }
+        out.write_all(&record.subdirs.to_ne_bytes())?;
+        out.write_all(&record.links.to_ne_bytes())?;
+        offset += len;
+    }
+    for record in records {
+        out.write_all(&record.names)?;
+        out.write_all(&record.linked)?;
+    }
+    out.into_inner().map_err(|e| e.into_error())?;
+    Ok(())
+}
@@ -4,42 +4,31 @@
 // according to the warnings/errors of the GitHub Actions workflow 
 // across Linux, macOS, and Windows
 
-use rustler::{Atom, Binary, Env, Error, NifResult, Term};
-use std::ffi::CString;
+use rustler::types::ListIterator;
+use rustler::{Atom, Binary, Encoder, Env, Error, NifResult, OwnedBinary, Term};
+use std::ffi::{CStr, CString};
+mod async_stat;
+mod errstr;
+mod forecast;
+mod handle;
 #[cfg(unix)]
-use std::io;
-// Unix-specific imports
-#[cfg(unix)]
-use std::ffi::OsStr;
-#[cfg(unix)]
-use std::os::unix::ffi::OsStrExt;
-#[cfg(unix)]
-use std::path::Path;
-// Windows-specific imports
-#[cfg(windows)]
-use std::ptr;
-#[cfg(windows)]
-use widestring::{U16Str, WideCString};
-#[cfg(windows)]
-use windows::core::{PCWSTR, PWSTR};
-#[cfg(windows)]
-use windows::Win32::Foundation::{
-    GetLastError, LocalFree, ERROR_FILE_NOT_FOUND, ERROR_PATH_NOT_FOUND, HLOCAL,
-};
+mod index;
+mod local;
+mod mounts;
+mod path;
+mod pool;
+mod scan;
+mod snapshot;
+mod stat;
+#[cfg(target_os = "linux")]
+mod uring;
+mod usage;
 #[cfg(windows)]
-use windows::Win32::Storage::FileSystem::{
-    GetDiskFreeSpaceExW, GetFileAttributesW, FILE_ATTRIBUTE_DIRECTORY, INVALID_FILE_ATTRIBUTES,
-};
-#[cfg(windows)]
-use windows::Win32::System::Diagnostics::Debug::{
-    FormatMessageW, FORMAT_MESSAGE_ALLOCATE_BUFFER, FORMAT_MESSAGE_FROM_SYSTEM,
-    FORMAT_MESSAGE_IGNORE_INSERTS,
-};
-// nix imports with proper cfg to avoid unused warnings
-#[cfg(all(unix, target_os = "linux"))]
-use nix::sys::statfs::{statfs, Statfs};
-#[cfg(all(unix, not(target_os = "linux")))]
-use nix::sys::statvfs::{statvfs, Statvfs};
+mod volumes;
+mod watcher;
+use handle::DirHandle;
+use rustler::ResourceArc;
+use stat::{DeviceKey, FsDetails, FsStats, Reason, StatError, StatResult};
 mod atoms {
     rustler::atoms! {
         ok,
@@ -52,12 +41,55 @@ mod atoms {
         winapi_failed,
         statvfs_failed,
         statfs_failed,
+        closed,
+        busy,
+        disk_space_stat,
+        max_workers,
+        max_queue,
+        workers,
+        queued,
+        stuck,
+        rejected,
+        coalesced,
+        full,
+        pending,
+        not_registered,
+        thread_spawn_failed,
+        mount_table_failed,
+        disk_space,
+        mounts_changed,
+        apparent_size,
+        allocated_size,
+        files,
+        dirs,
+        errors,
+        cancelled,
+        index_write_failed,
+        timeout,
+        largest_files,
+        largest_dirs,
+        inodes_total,
+        inodes_free,
+        block_size,
+        fs_type,
+        fsid,
+        disk_space_progress,
+        disk_space_usage,
+        bytes,
+        reason,
+        info,
         available,
         free,
         total,
         used,
         errno,
-        errstr
+        errstr,
+        dirty,
+        rate,
+        time_to_full,
+        samples,
+        window,
+        infinity
     }
 }
 // Helper: Create {error, Reason} tuple
@@ -74,207 +106,451 @@ fn make_error_tuple3<'a>(env: Env<'a>, reason: Atom, detail: Term<'a>) -> NifRes
         &[atoms::error().to_term(env), reason.to_term(env), detail],
     ))
 }
-#[cfg(unix)]
-// Helper: Create error tuple with errno details
-fn make_errno_error_tuple<'a>(env: Env<'a>, reason: Atom, err: io::Error) -> NifResult<Term<'a>> {
-    let errnum = err.raw_os_error().unwrap_or(0);
-    let errstr = err.to_string();
-    let detail = rustler::types::map::map_new(env)
-        .map_put(atoms::errno().to_term(env), errnum)?
-        .map_put(atoms::errstr().to_term(env), errstr)?;
-    make_error_tuple3(env, reason, detail)
-}
-#[cfg(windows)]
-// Helper: Create error tuple with WinAPI error details
-fn make_winapi_error_tuple<'a>(env: Env<'a>, reason: Atom, errnum: u32) -> NifResult<Term<'a>> {
-    let mut buffer_ptr: *mut u16 = ptr::null_mut();
-    let flags =
-        FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS;
-    let lang: u32 = 0; // Use system default for better localization
-    let len = unsafe {
-        FormatMessageW(
-            flags,
-            None,
-            errnum,
-            lang,
-            PWSTR(&mut buffer_ptr as *mut *mut u16 as *mut u16),
-            0,
-            None,
-        )
-    };
-    let errstr = if len == 0 {
-        "Unknown WinAPI error".to_string()
+// Helper: Create {error, Reason, Detail} with the OS error code and, when
+// `with_errstr`, its (cached) description
+fn make_os_error_tuple<'a>(
+    env: Env<'a>,
+    reason: Atom,
+    code: i64,
+    with_errstr: bool,
+) -> NifResult<Term<'a>> {
+    #[cfg(unix)]
+    let errnum = (code as i32).encode(env);
+    #[cfg(windows)]
+    let errnum = (code as u32).encode(env);
+    let detail = if with_errstr {
+        let errstr = errstr::describe(code);
+        Term::map_from_term_arrays(
+            env,
+            &[atoms::errno().to_term(env), atoms::errstr().to_term(env)],
+            &[errnum, errstr.as_ref().encode(env)],
+        )?
     } else {
-        // Create a slice with the exact length returned by FormatMessageW (excluding the null terminator).
-        let message_slice = unsafe { std::slice::from_raw_parts(buffer_ptr, len as usize) };
-        // Convert this UTF-16 slice to a Rust String.
-        let wide_str = U16Str::from_slice(message_slice);
-        // FormatMessageW often adds \r\n, so trim the end.
-        wide_str.to_string_lossy().trim_end().to_string()
+        Term::map_from_term_arrays(env, &[atoms::errno().to_term(env)], &[errnum])?
     };
-    if !buffer_ptr.is_null() {
-        // The memory allocated by FormatMessageW with FORMAT_MESSAGE_ALLOCATE_BUFFER
-        // must be freed with LocalFree.
-        unsafe {
-            // Corrected: Construct an HLOCAL from the pointer. The `windows-rs` crate
-            // will automatically convert HLOCAL into the Option<HLOCAL> the function expects.
-            let _ = LocalFree(Some(HLOCAL(buffer_ptr as *mut ::core::ffi::c_void)));
-        }
-    }
-    let detail = rustler::types::map::map_new(env)
-        .map_put(atoms::errno().to_term(env), errnum)?
-        .map_put(atoms::errstr().to_term(env), errstr)?;
     make_error_tuple3(env, reason, detail)
 }
-// Helper: Convert Elixir term to a path
+// Helper: Convert Elixir term to a path, owned by callers that keep it
 fn get_path_from_term<'a>(_env: Env<'a>, term: Term<'a>) -> NifResult<CString> {
-    // Try binary first
-    let binary = match term.decode::<Binary>() {
-        Ok(b) => b,
+    match term.decode::<Binary>() {
+        Ok(binary) => path::to_cstring(binary.as_slice()).ok_or(Error::BadArg),
         Err(_) => {
             // Fallback to string (list of chars)
-            let path_str: String = match term.decode() {
-                Ok(s) => s,
-                Err(_) => return Err(Error::BadArg),
-            };
-            match CString::new(path_str) {
-                Ok(cstr) => return Ok(cstr),
-                Err(_) => return Err(Error::BadArg),
-            }
+            let path_str: String = term.decode().map_err(|_| Error::BadArg)?;
+            CString::new(path_str).map_err(|_| Error::BadArg)
+        }
+    }
+}
+// Helper: Decode a path and run `f` on it, copied to the stack instead of a
+// CString when short; for callers that do not keep the path
+fn with_path_term<'a, R>(term: Term<'a>, f: impl FnOnce(&CStr) -> R) -> NifResult<R> {
+    match term.decode::<Binary>() {
+        Ok(binary) => path::with_cstr(binary.as_slice(), f).ok_or(Error::BadArg),
+        Err(_) => {
+            let path_str: String = term.decode().map_err(|_| Error::BadArg)?;
+            let path_cstr = CString::new(path_str).map_err(|_| Error::BadArg)?;
+            Ok(f(&path_cstr))
+        }
+    }
+}
+// Helper: Decode an optional path, where nil stands for none
+fn get_optional_path_from_term<'a>(env: Env<'a>, term: Term<'a>) -> NifResult<Option<CString>> {
+    if term.is_atom() {
+        return Ok(None);
+    }
+    get_path_from_term(env, term).map(Some)
+}
+// Which stats fields to encode and how, as passed from Elixir: bits 0-3 pick
+// available, free, total and used for a map; TUPLE asks for the
+// {Available, Free, Total, Used} tuple instead; ERRNO_ONLY leaves the errstr
+// out of error details
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub(crate) struct Format(u32);
+
+impl Format {
+    const MAP: Format = Format(0b1111);
+    const TUPLE: u32 = 1 << 4;
+    const ERRNO_ONLY: u32 = 1 << 5;
+
+    fn with_errstr(self) -> bool {
+        self.0 & Format::ERRNO_ONLY == 0
+    }
+}
+
+impl<'a> rustler::Decoder<'a> for Format {
+    fn decode(term: Term<'a>) -> NifResult<Format> {
+        Ok(Format(term.decode()?))
+    }
+}
+// Helper: Encode stats in the requested format, building the map in one go
+fn encode_stats<'a>(env: Env<'a>, stats: &FsStats, format: Format) -> NifResult<Term<'a>> {
+    if format.0 & Format::TUPLE != 0 {
+        return Ok((stats.available, stats.free, stats.total, stats.used).encode(env));
+    }
+    let fields = [
+        (atoms::available(), stats.available),
+        (atoms::free(), stats.free),
+        (atoms::total(), stats.total),
+        (atoms::used(), stats.used),
+    ];
+    let nil = rustler::types::atom::nil().to_term(env);
+    let mut keys = [nil; 4];
+    let mut values = [nil; 4];
+    let mut count = 0;
+    for (bit, (key, value)) in fields.iter().enumerate() {
+        if format.0 & (1 << bit) != 0 {
+            keys[count] = key.to_term(env);
+            values[count] = value.encode(env);
+            count += 1;
         }
+    }
+    Term::map_from_term_arrays(env, &keys[..count], &values[..count])
+}
+// Helper: Create {ok, Stats} tuple in the requested format
+fn make_ok_stats_as<'a>(env: Env<'a>, stats: &FsStats, format: Format) -> NifResult<Term<'a>> {
+    Ok((atoms::ok(), encode_stats(env, stats, format)?).encode(env))
+}
+// Helper: Create {ok, StatsMap} tuple with the filesystem details added
+fn make_ok_stats_extended<'a>(
+    env: Env<'a>,
+    stats: &FsStats,
+    details: &FsDetails,
+) -> NifResult<Term<'a>> {
+    let nil = rustler::types::atom::nil().to_term(env);
+    let fs_type = if details.fs_type.is_empty() {
+        nil
+    } else {
+        make_binary(env, &details.fs_type)?
+    };
+    let map = rustler::types::map::map_new(env)
+        .map_put(atoms::available().to_term(env), stats.available)?
+        .map_put(atoms::free().to_term(env), stats.free)?
+        .map_put(atoms::total().to_term(env), stats.total)?
+        .map_put(atoms::used().to_term(env), stats.used)?
+        .map_put(
+            atoms::inodes_total().to_term(env),
+            details.inodes_total.map_or(nil, |n| n.encode(env)),
+        )?
+        .map_put(
+            atoms::inodes_free().to_term(env),
+            details.inodes_free.map_or(nil, |n| n.encode(env)),
+        )?
+        .map_put(atoms::block_size().to_term(env), details.block_size)?
+        .map_put(atoms::fs_type().to_term(env), fs_type)?
+        .map_put(atoms::fsid().to_term(env), details.fsid)?;
+    Ok((atoms::ok(), map).encode(env))
+}
+// Helper: Copy raw bytes into a new binary term
+fn make_binary<'a>(env: Env<'a>, bytes: &[u8]) -> NifResult<Term<'a>> {
+    let mut binary =
+        OwnedBinary::new(bytes.len()).ok_or(Error::Term(Box::new(atoms::alloc_failed())))?;
+    binary.as_mut_slice().copy_from_slice(bytes);
+    Ok(binary.release(env).encode(env))
+}
+// Helper: Map a stat::Reason to its atom
+fn reason_atom(reason: Reason) -> Atom {
+    match reason {
+        Reason::InvalidPath => atoms::invalid_path(),
+        Reason::PathConversionFailed => atoms::path_conversion_failed(),
+        Reason::NotDirectory => atoms::not_directory(),
+        Reason::WinapiFailed => atoms::winapi_failed(),
+        Reason::StatvfsFailed => atoms::statvfs_failed(),
+        Reason::StatfsFailed => atoms::statfs_failed(),
+        Reason::HandleClosed => atoms::closed(),
+        Reason::MountTableFailed => atoms::mount_table_failed(),
+        Reason::Cancelled => atoms::cancelled(),
+        Reason::IndexWriteFailed => atoms::index_write_failed(),
+        Reason::Timeout => atoms::timeout(),
+    }
+}
+// Helper: Create the error tuple for a failed query, with OS details if any
+fn make_stat_error_tuple<'a>(env: Env<'a>, err: &StatError) -> NifResult<Term<'a>> {
+    make_stat_error_tuple_as(env, err, Format::MAP)
+}
+// Helper: Same as make_stat_error_tuple, with the errstr only if `format` keeps it
+fn make_stat_error_tuple_as<'a>(
+    env: Env<'a>,
+    err: &StatError,
+    format: Format,
+) -> NifResult<Term<'a>> {
+    let reason = reason_atom(err.reason);
+    match err.os_error {
+        Some(code) => make_os_error_tuple(env, reason, code, format.with_errstr()),
+        None => make_error_tuple(env, reason),
+    }
+}
+// Helper: Encode a device key as st_dev (Unix) or volume root string (Windows)
+fn encode_device_key<'a>(env: Env<'a>, device: &DeviceKey) -> Term<'a> {
+    #[cfg(unix)]
+    {
+        device.encode(env)
+    }
+    #[cfg(windows)]
+    {
+        String::from_utf16_lossy(device).encode(env)
+    }
+}
+// Helper: Encode a stat::StatResult as {ok, Map} or an error tuple
+fn encode_stat_result<'a>(env: Env<'a>, result: &StatResult) -> NifResult<Term<'a>> {
+    encode_stat_result_as(env, result, Format::MAP)
+}
+// Helper: Encode a stat::StatResult as {ok, Stats} in the requested format or an error tuple
+fn encode_stat_result_as<'a>(
+    env: Env<'a>,
+    result: &StatResult,
+    format: Format,
+) -> NifResult<Term<'a>> {
+    match result {
+        Ok(stats) => make_ok_stats_as(env, stats, format),
+        Err(err) => make_stat_error_tuple_as(env, err, format),
+    }
+}
+#[rustler::nif(schedule = "DirtyIo")]
+fn stat_fs<'a>(
+    env: Env<'a>,
+    path_term: Term<'a>,
+    format: Format,
+    validate: bool,
+) -> NifResult<Term<'a>> {
+    match with_path_term(path_term, |path_cstr| {
+        stat::stat_path_with(path_cstr, validate)
+    }) {
+        Ok(result) => encode_stat_result_as(env, &result, format),
+        Err(_) => make_error_tuple(env, atoms::invalid_path()),
+    }
+}
+// stat_fs returning {Result, CheckNs, SpaceNs}, the nanoseconds spent in the
+// directory check and in the space syscall
+#[rustler::nif(schedule = "DirtyIo")]
+fn stat_fs_timed<'a>(
+    env: Env<'a>,
+    path_term: Term<'a>,
+    format: Format,
+    validate: bool,
+) -> NifResult<Term<'a>> {
+    let (result, timing) = match with_path_term(path_term, |path_cstr| {
+        stat::stat_path_timed(path_cstr, validate)
+    }) {
+        Ok(timed) => timed,
+        Err(_) => (
+            Err(StatError::new(Reason::InvalidPath)),
+            stat::Timing::default(),
+        ),
     };
-    if binary.is_empty() {
-        return Err(Error::BadArg);
+    let nanos = |duration: std::time::Duration| duration.as_nanos() as u64;
+    Ok((
+        encode_stat_result_as(env, &result, format)?,
+        nanos(timing.check),
+        nanos(timing.space),
+    )
+        .encode(env))
+}
+
+// Regular-scheduler stat_fs for paths last seen on a local filesystem;
+// returns `dirty` when the caller has to use stat_fs_classify instead
+#[rustler::nif]
+fn stat_fs_local<'a>(
+    env: Env<'a>,
+    path_term: Term<'a>,
+    format: Format,
+    validate: bool,
+) -> NifResult<Term<'a>> {
+    match with_path_term(path_term, |path_cstr| {
+        local::stat_if_local(path_cstr, validate)
+    }) {
+        Ok(Some(result)) => encode_stat_result_as(env, &result, format),
+        Ok(None) => Ok(atoms::dirty().encode(env)),
+        Err(_) => make_error_tuple(env, atoms::invalid_path()),
     }
-    match CString::new(binary.as_slice()) {
-        Ok(cstr) => Ok(cstr),
-        Err(_) => Err(Error::BadArg),
+}
+// Same as stat_fs, recording whether the path is on a local filesystem
+#[rustler::nif(schedule = "DirtyIo")]
+fn stat_fs_classify<'a>(
+    env: Env<'a>,
+    path_term: Term<'a>,
+    format: Format,
+    validate: bool,
+) -> NifResult<Term<'a>> {
+    match with_path_term(path_term, |path_cstr| {
+        local::stat_and_classify(path_cstr, validate)
+    }) {
+        Ok(result) => encode_stat_result_as(env, &result, format),
+        Err(_) => make_error_tuple(env, atoms::invalid_path()),
+    }
+}
+// Same syscall as stat_fs, with inode counts, block size, fs type and fsid added
+#[rustler::nif(schedule = "DirtyIo")]
+fn stat_fs_extended<'a>(env: Env<'a>, path_term: Term<'a>, validate: bool) -> NifResult<Term<'a>> {
+    match with_path_term(path_term, |path_cstr| {
+        stat::stat_path_extended(path_cstr, validate)
+    }) {
+        Ok(Ok((stats, details))) => make_ok_stats_extended(env, &stats, &details),
+        Ok(Err(err)) => make_stat_error_tuple(env, &err),
+        Err(_) => make_error_tuple(env, atoms::invalid_path()),
     }
 }
+// Batch variant: one dirty call for the whole list; results keep input order
 #[rustler::nif(schedule = "DirtyIo")]
-fn stat_fs<'a>(env: Env<'a>, path_term: Term<'a>) -> NifResult<Term<'a>> {
+fn stat_fs_many<'a>(
+    env: Env<'a>,
+    paths_term: Term<'a>,
+    format: Format,
+    validate: bool,
+) -> NifResult<Term<'a>> {
+    let path_terms: ListIterator<'a> = paths_term.decode()?;
+    let mut results: Vec<Term<'a>> = Vec::with_capacity(paths_term.list_length()?);
+    for path_term in path_terms {
+        let result = with_path_term(path_term, |path_cstr| {
+            stat::stat_path_with(path_cstr, validate)
+        })
+        .unwrap_or_else(|_| Err(StatError::new(Reason::InvalidPath)));
+        results.push(encode_stat_result_as(env, &result, format)?);
+    }
+    Ok(results.encode(env))
+}
+// Batch variant that queries each device once; returns {Results, [{Device, [Index]}]}
+#[rustler::nif(schedule = "DirtyIo")]
+fn stat_fs_many_by_device<'a>(
+    env: Env<'a>,
+    paths_term: Term<'a>,
+    format: Format,
+) -> NifResult<Term<'a>> {
+    let path_terms: Vec<Term<'a>> = paths_term.decode()?;
+    let paths: Vec<Option<CString>> = path_terms
+        .into_iter()
+        .map(|path_term| get_path_from_term(env, path_term).ok())
+        .collect();
+    let (stat_results, groups) = stat::stat_many_by_device(&paths);
+    let mut results: Vec<Term<'a>> = Vec::with_capacity(stat_results.len());
+    for result in &stat_results {
+        results.push(encode_stat_result_as(env, result, format)?);
+    }
+    let groups: Vec<Term<'a>> = groups
+        .iter()
+        .map(|group| (encode_device_key(env, &group.device), &group.members).encode(env))
+        .collect();
+    Ok((results, groups).encode(env))
+}
+#[rustler::resource_impl]
+impl rustler::Resource for DirHandle {}
+// Open a directory once for repeated queries; returns {ok, Handle}
+#[rustler::nif(schedule = "DirtyIo")]
+fn open_dir<'a>(env: Env<'a>, path_term: Term<'a>) -> NifResult<Term<'a>> {
     let path_cstr = match get_path_from_term(env, path_term) {
         Ok(path) => path,
         Err(_) => return make_error_tuple(env, atoms::invalid_path()),
     };
-    #[cfg(windows)]
-    {
-        let path_str = match path_cstr.to_str() {
-            Ok(s) => s,
-            Err(_) => return make_error_tuple(env, atoms::path_conversion_failed()),
-        };
-        let is_unc = path_str.starts_with("\\\\") && !path_str.starts_with("\\\\?\\");
-        let long_path_str = if is_unc {
-            format!("\\\\?\\UNC{}", &path_str[2..])
-        } else if !path_str.starts_with("\\\\?\\") {
-            format!("\\\\?\\{}", path_str)
-        } else {
-            path_str.to_string()
-        };
-        let wide_str = match WideCString::from_str(&long_path_str) {
-            Ok(ws) => ws,
-            Err(_) => return make_error_tuple(env, atoms::path_conversion_failed()),
-        };
-        let long_wpath = PCWSTR::from_raw(wide_str.as_ptr());
-        let attr = unsafe { GetFileAttributesW(long_wpath) };
-        if attr == INVALID_FILE_ATTRIBUTES {
-            let err = unsafe { GetLastError() };
-            let err_code = err.0;
-            let reason = if err_code == ERROR_FILE_NOT_FOUND.0 || err_code == ERROR_PATH_NOT_FOUND.0
-            {
-                atoms::invalid_path()
-            } else {
-                atoms::winapi_failed()
-            };
-            return make_winapi_error_tuple(env, reason, err_code);
-        }
-        if (attr & FILE_ATTRIBUTE_DIRECTORY.0) == 0 {
-            return make_error_tuple(env, atoms::not_directory());
-        }
-        let mut avail: u64 = 0;
-        let mut total: u64 = 0;
-        let mut free: u64 = 0;
-        let result = unsafe {
-            GetDiskFreeSpaceExW(
-                long_wpath,
-                Some(&mut avail),
-                Some(&mut total),
-                Some(&mut free),
+    match DirHandle::open(&path_cstr) {
+        Ok(handle) => Ok((atoms::ok(), ResourceArc::new(handle)).encode(env)),
+        Err(err) => make_stat_error_tuple(env, &err),
+    }
+}
+#[rustler::nif(schedule = "DirtyIo")]
+fn stat_handle_fs<'a>(
+    env: Env<'a>,
+    handle: ResourceArc<DirHandle>,
+    format: Format,
+) -> NifResult<Term<'a>> {
+    encode_stat_result_as(env, &handle.stat(), format)
+}
+#[rustler::nif]
+fn close_dir(handle: ResourceArc<DirHandle>) -> bool {
+    handle.close()
+}
+// Every mounted filesystem with its stats; returns {ok, [{MountPoint, Device, FsType, Result}]}
+#[rustler::nif(schedule = "DirtyIo")]
+fn list_mounts<'a>(env: Env<'a>, include_pseudo: bool) -> NifResult<Term<'a>> {
+    let mounts = match mounts::list_mounts(include_pseudo) {
+        Ok(mounts) => mounts,
+        Err(err) => return make_stat_error_tuple(env, &err),
+    };
+    let mut entries: Vec<Term<'a>> = Vec::with_capacity(mounts.len());
+    for mount in &mounts {
+        entries.push(
+            (
+                make_binary(env, &mount.mount_point)?,
+                make_binary(env, &mount.device)?,
+                make_binary(env, &mount.fs_type)?,
+                encode_stat_result(env, &mount.stats)?,
             )
-        };
-        if let Err(e) = result {
-            let err_code = (e.code().0 & 0xFFFF) as u32;
-            return make_winapi_error_tuple(env, atoms::winapi_failed(), err_code);
-        }
-        let used = total.saturating_sub(free);
-        let map = rustler::types::map::map_new(env)
-            .map_put(atoms::available().to_term(env), avail)?
-            .map_put(atoms::free().to_term(env), free)?
-            .map_put(atoms::total().to_term(env), total)?
-            .map_put(atoms::used().to_term(env), used)?;
-        Ok(rustler::types::tuple::make_tuple(
-            env,
-            &[atoms::ok().to_term(env), map],
-        ))
+                .encode(env),
+        );
     }
-    #[cfg(unix)]
-    {
-        let os_path = Path::new(OsStr::from_bytes(path_cstr.as_bytes()));
-        let metadata = match std::fs::metadata(&os_path) {
-            Ok(m) => m,
-            Err(e) => return make_errno_error_tuple(env, atoms::not_directory(), e),
-        };
-        if !metadata.is_dir() {
-            return make_error_tuple(env, atoms::not_directory());
-        }
-        #[cfg(target_os = "linux")]
-        {
-            let statfs_buf: Statfs = match statfs(os_path) {
-                Ok(buf) => buf,
-                Err(err) => {
-                    let io_err = io::Error::from_raw_os_error(err as i32);
-                    return make_errno_error_tuple(env, atoms::statfs_failed(), io_err);
-                }
-            };
-            let block_size = statfs_buf.block_size() as u64;
-            let avail = statfs_buf.blocks_available() as u64 * block_size;
-            let free = statfs_buf.blocks_free() as u64 * block_size;
-            let total = statfs_buf.blocks() as u64 * block_size;
-            let used = total.saturating_sub(free);
-            let map = rustler::types::map::map_new(env)
-                .map_put(atoms::available().to_term(env), avail)?
-                .map_put(atoms::free().to_term(env), free)?
-                .map_put(atoms::total().to_term(env), total)?
-                .map_put(atoms::used().to_term(env), used)?;
-            Ok(rustler::types::tuple::make_tuple(
-                env,
-                &[atoms::ok().to_term(env), map],
-            ))
-        }
-        #[cfg(not(target_os = "linux"))]
-        {
-            let statvfs_buf: Statvfs = match statvfs(os_path) {
-                Ok(buf) => buf,
-                Err(err) => {
-                    let io_err = io::Error::from_raw_os_error(err as i32);
-                    return make_errno_error_tuple(env, atoms::statvfs_failed(), io_err);
-                }
-            };
-            let frag_size = statvfs_buf.fragment_size() as u64;
-            let avail = statvfs_buf.blocks_available() as u64 * frag_size;
-            let free = statvfs_buf.blocks_free() as u64 * frag_size;
-            let total = statvfs_buf.blocks() as u64 * frag_size;
-            let used = total.saturating_sub(free);
-            let map = rustler::types::map::map_new(env)
-                .map_put(atoms::available().to_term(env), avail)?
-                .map_put(atoms::free().to_term(env), free)?
-                .map_put(atoms::total().to_term(env), total)?
-                .map_put(atoms::used().to_term(env), used)?;
-            Ok(rustler::types::tuple::make_tuple(
-                env,
-                &[atoms::ok().to_term(env), map],
-            ))
-        }
+    Ok((atoms::ok(), entries).encode(env))
+}
+// Helper: Encode ranked entries as [{Path, Size}], largest first
+fn encode_ranked<'a>(env: Env<'a>, entries: &[usage::Ranked]) -> NifResult<Term<'a>> {
+    let mut terms: Vec<Term<'a>> = Vec::with_capacity(entries.len());
+    for entry in entries {
+        terms.push((make_binary(env, &entry.path)?, entry.size).encode(env));
+    }
+    Ok(terms.encode(env))
+}
+// Helper: Create {ok, UsageMap} tuple
+fn make_ok_usage<'a>(env: Env<'a>, report: &usage::Report) -> NifResult<Term<'a>> {
+    let usage = &report.usage;
+    let mut map = rustler::types::map::map_new(env)
+        .map_put(atoms::apparent_size().to_term(env), usage.apparent)?
+        .map_put(atoms::allocated_size().to_term(env), usage.allocated)?
+        .map_put(atoms::files().to_term(env), usage.files)?
+        .map_put(atoms::dirs().to_term(env), usage.dirs)?
+        .map_put(atoms::errors().to_term(env), usage.errors)?;
+    if let Some(largest) = &report.largest {
+        map = map
+            .map_put(
+                atoms::largest_files().to_term(env),
+                encode_ranked(env, &largest.files)?,
+            )?
+            .map_put(
+                atoms::largest_dirs().to_term(env),
+                encode_ranked(env, &largest.dirs)?,
+            )?;
+    }
+    Ok((atoms::ok(), map).encode(env))
+}
+// Helper: The ranking requested by Top (0 for none) and RankBy
+fn top_option(count: usize, rank_by: Atom) -> Option<usage::Top> {
+    let by = if rank_by == atoms::allocated_size() {
+        usage::Rank::Allocated
+    } else {
+        usage::Rank::Apparent
+    };
+    (count > 0).then_some(usage::Top { count, by })
+}
+// Recursive usage of the tree below a directory, walked by Threads workers;
+// Index is nil or the path of the index to reuse and rewrite; Top > 0 ranks
+// that many of the largest files and directories by RankBy
+#[rustler::nif(schedule = "DirtyIo")]
+fn disk_usage<'a>(
+    env: Env<'a>,
+    path_term: Term<'a>,
+    threads: usize,
+    one_file_system: bool,
+    io_uring: bool,
+    index_term: Term<'a>,
+    top: usize,
+    rank_by: Atom,
+) -> NifResult<Term<'a>> {
+    let path_cstr = match get_path_from_term(env, path_term) {
+        Ok(path) => path,
+        Err(_) => return make_error_tuple(env, atoms::invalid_path()),
+    };
+    let index = match get_optional_path_from_term(env, index_term) {
+        Ok(index) => index,
+        Err(_) => return make_error_tuple(env, atoms::invalid_path()),
+    };
+    let options = usage::Options {
+        threads,
+        one_file_system,
+        cancel: None,
+        reporter: None,
+        io_uring,
+        index: index.as_deref(),
+        top: top_option(top, rank_by),
+    };
+    match usage::usage(&path_cstr, &options) {
+        Ok(report) => make_ok_usage(env, &report),
+        Err(err) => make_stat_error_tuple(env, &err),
     }
 }
 rustler::init!("Elixir.DiskSpace");
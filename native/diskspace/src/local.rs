@@ -0,0 +1,220 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Which paths are safe to query on a normal scheduler.
+//!
+//! A space query on a local disk or tmpfs returns in microseconds, less than
+//! the hand-off to a dirty scheduler costs; on NFS, SMB or FUSE it takes as
+//! long as the server does. Each query made through here records which
+//! filesystem the path is on and whether that filesystem is local: by type
+//! name on Unix (the `statfs` magic on Linux), by drive type on Windows. Later
+//! queries for a path that was last seen on a local filesystem may then run
+//! inline. Unknown types count as remote, and a failed query forgets the
+//! path, so it goes back through a dirty scheduler.
+//!
+//! A directory that was classified local can later be mounted over (an autofs
+//! or NFS mountpoint used before its mount), so the classes are dropped
+//! whenever the mount table changes: on Linux each inline query first polls
+//! `/proc/self/mountinfo` for a change without blocking, and a running mount
+//! watcher drops them on every platform. Where neither sees the change, a
+//! class is trusted for at most `CLASS_TTL` since the query on a dirty
+//! scheduler that made it; inline queries do not renew it.
+
+use crate::stat::{self, FsStats, StatResult};
+use std::collections::HashMap;
+use std::ffi::CStr;
+use std::sync::{OnceLock, RwLock};
+use std::time::{Duration, Instant};
+#[cfg(windows)]
+use windows::core::PCWSTR;
+#[cfg(windows)]
+use windows::Win32::Storage::FileSystem::GetDriveTypeW;
+#[cfg(windows)]
+use windows::Win32::System::WindowsProgramming::{DRIVE_FIXED, DRIVE_RAMDISK};
+
+/// Identifies a filesystem: its fsid and type name on Unix (some types report
+/// a zero fsid), its volume root on Windows.
+#[cfg(unix)]
+type FsKey = (u64, Vec<u8>);
+#[cfg(windows)]
+type FsKey = Vec<u16>;
+
+// Types whose space queries never leave the machine
+// (Linux names as given by `stat::linux_fs_type_name`, then macOS and the BSDs)
+#[cfg(unix)]
+const LOCAL_FS_TYPES: &[&[u8]] = &[
+    b"ext4",
+    b"xfs",
+    b"btrfs",
+    b"zfs",
+    b"f2fs",
+    b"bcachefs",
+    b"vfat",
+    b"exfat",
+    b"ntfs3",
+    b"iso9660",
+    b"squashfs",
+    b"tmpfs",
+    b"ramfs",
+    b"overlay",
+    b"apfs",
+    b"hfs",
+    b"ufs",
+    b"ffs",
+    b"msdos",
+    b"msdosfs",
+    b"cd9660",
+    b"devfs",
+    b"mfs",
+    b"hammer",
+    b"hammer2",
+];
+
+// Bounds the path map; it is rebuilt from scratch when full
+const MAX_PATHS: usize = 4096;
+/// How long the class of a path is trusted for inline queries.
+const CLASS_TTL: Duration = Duration::from_secs(10);
+
+struct PathClass {
+    key: FsKey,
+    classified_at: Instant,
+}
+
+#[derive(Default)]
+struct Classes {
+    local: HashMap<FsKey, bool>,
+    paths: HashMap<Vec<u8>, PathClass>,
+}
+
+fn classes() -> &'static RwLock<Classes> {
+    static CLASSES: OnceLock<RwLock<Classes>> = OnceLock::new();
+    CLASSES.get_or_init(|| RwLock::new(Classes::default()))
+}
+
+fn known_local(path: &[u8]) -> bool {
+    let classes = classes().read().unwrap_or_else(|e| e.into_inner());
+    classes
+        .paths
+        .get(path)
+        .filter(|class| class.classified_at.elapsed() < CLASS_TTL)
+        .and_then(|class| classes.local.get(&class.key))
+        .copied()
+        .unwrap_or(false)
+}
+
+// `renew` for queries made on a dirty scheduler, which alone may (re)start
+// the trust in a class
+fn remember(path: &[u8], key: FsKey, local: bool, renew: bool) {
+    let mut classes = classes().write().unwrap_or_else(|e| e.into_inner());
+    if renew {
+        if classes.paths.len() >= MAX_PATHS && !classes.paths.contains_key(path) {
+            classes.paths.clear();
+        }
+        let class = PathClass {
+            key: key.clone(),
+            classified_at: Instant::now(),
+        };
+        classes.paths.insert(path.to_vec(), class);
+    } else if classes.paths.get(path).map(|class| &class.key) != Some(&key) {
+        // found on another filesystem inline: classify it again off the scheduler
+        classes.paths.remove(path);
+    }
+    if classes.local.get(&key) != Some(&local) {
+        classes.local.insert(key, local);
+    }
+}
+
+fn forget(path: &[u8]) {
+    let mut classes = classes().write().unwrap_or_else(|e| e.into_inner());
+    classes.paths.remove(path);
+}
+
+/// Forget every class, e.g. after a filesystem was mounted or removed.
+pub fn invalidate() {
+    let mut classes = classes().write().unwrap_or_else(|e| e.into_inner());
+    classes.local.clear();
+    classes.paths.clear();
+}
+
+// Whether the mount table changed since the last call, without blocking; the
+// kernel reports each change once per open file
+#[cfg(target_os = "linux")]
+fn mounts_changed() -> bool {
+    use std::os::fd::AsRawFd;
+    static MOUNTINFO: OnceLock<Option<std::fs::File>> = OnceLock::new();
+    let Some(file) = MOUNTINFO.get_or_init(|| std::fs::File::open("/proc/self/mountinfo").ok())
+    else {
+        return false;
+    };
+    let mut pollfd = libc::pollfd {
+        fd: file.as_raw_fd(),
+        events: libc::POLLPRI | libc::POLLERR,
+        revents: 0,
+    };
+    // a failed poll counts as a change, which only costs a dirty query
+    let ready = unsafe { libc::poll(&mut pollfd, 1, 0) };
+    ready < 0 || (ready > 0 && pollfd.revents & (libc::POLLPRI | libc::POLLERR) != 0)
+}
+
+#[cfg(not(target_os = "linux"))]
+fn mounts_changed() -> bool {
+    false
+}
+
+/// Query `path_cstr` if it was last seen on a local filesystem; `None` means
+/// the query has to run on a dirty scheduler.
+pub fn stat_if_local(path_cstr: &CStr, validate: bool) -> Option<StatResult> {
+    if mounts_changed() {
+        invalidate();
+        return None;
+    }
+    if !known_local(path_cstr.to_bytes()) {
+        return None;
+    }
+    Some(classify(path_cstr, validate, false))
+}
+
+/// Query `path_cstr` and remember which filesystem it is on.
+pub fn stat_and_classify(path_cstr: &CStr, validate: bool) -> StatResult {
+    classify(path_cstr, validate, true)
+}
+
+fn classify(path_cstr: &CStr, validate: bool, renew: bool) -> StatResult {
+    match stat_classified(path_cstr, validate) {
+        Ok((stats, key, local)) => {
+            remember(path_cstr.to_bytes(), key, local, renew);
+            Ok(stats)
+        }
+        Err(err) => {
+            forget(path_cstr.to_bytes());
+            Err(err)
+        }
+    }
+}
+
+// The extended query takes the same single syscall and names the type
+#[cfg(unix)]
+fn stat_classified(
+    path_cstr: &CStr,
+    validate: bool,
+) -> Result<(FsStats, FsKey, bool), stat::StatError> {
+    let (stats, details) = stat::stat_path_extended(path_cstr, validate)?;
+    let local = LOCAL_FS_TYPES.contains(&details.fs_type.as_slice());
+    Ok((stats, (details.fsid, details.fs_type), local))
+}
+
+#[cfg(windows)]
+fn stat_classified(
+    path_cstr: &CStr,
+    validate: bool,
+) -> Result<(FsStats, FsKey, bool), stat::StatError> {
+    stat::with_long_wpath(path_cstr, |long_wpath| {
+        let stats = stat::checked_disk_free_wide(long_wpath, validate)?;
+        let mut root = crate::volumes::root_of(long_wpath)?;
+        root.push(0);
+        let drive_type = unsafe { GetDriveTypeW(PCWSTR::from_raw(root.as_ptr())) };
+        root.pop();
+        let local = drive_type == DRIVE_FIXED || drive_type == DRIVE_RAMDISK;
+        Ok((stats, root, local))
+    })
+}
@@ -0,0 +1,280 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Native enumeration of the mount table, so that all mounted filesystems can
+//! be listed and queried in one dirty NIF call instead of shelling out to `df`.
+//!
+//! Linux parses `/proc/self/mountinfo`, macOS and the BSDs use
+//! `getmntinfo(MNT_NOWAIT)` (which does not wait on unresponsive mounts), and
+//! Windows walks the volumes with `FindFirstVolumeW`/`FindNextVolumeW`.
+
+use crate::stat::{self, Reason, StatError, StatResult};
+#[cfg(unix)]
+use std::ffi::OsStr;
+#[cfg(unix)]
+use std::os::unix::ffi::OsStrExt;
+#[cfg(unix)]
+use std::path::Path;
+#[cfg(windows)]
+use windows::core::PCWSTR;
+#[cfg(windows)]
+use windows::Win32::Storage::FileSystem::{
+    FindFirstVolumeW, FindNextVolumeW, FindVolumeClose, GetVolumeInformationW,
+    GetVolumePathNamesForVolumeNameW,
+};
+
+/// One mounted filesystem. Strings are raw bytes (UTF-8 on Windows), since
+/// Unix mount points need not be valid UTF-8.
+pub struct Mount {
+    pub mount_point: Vec<u8>,
+    pub device: Vec<u8>,
+    pub fs_type: Vec<u8>,
+    pub stats: StatResult,
+}
+
+/// Mount point, device and filesystem type, as read from the mount table.
+pub(crate) type MountEntry = (Vec<u8>, Vec<u8>, Vec<u8>);
+
+// Kernel-internal and layered filesystems that carry no meaningful space
+// figures of their own
+#[cfg(unix)]
+const PSEUDO_FS_TYPES: &[&str] = &[
+    "autofs",
+    "binfmt_misc",
+    "bpf",
+    "cgroup",
+    "cgroup2",
+    "configfs",
+    "debugfs",
+    "devfs",
+    "devpts",
+    "devtmpfs",
+    "efivarfs",
+    "fdescfs",
+    "fusectl",
+    "hugetlbfs",
+    "kernfs",
+    "linprocfs",
+    "linsysfs",
+    "mqueue",
+    "nsfs",
+    "nullfs",
+    "overlay",
+    "proc",
+    "procfs",
+    "pstore",
+    "ptyfs",
+    "rpc_pipefs",
+    "securityfs",
+    "selinuxfs",
+    "sysfs",
+    "tracefs",
+];
+
+#[cfg(unix)]
+fn is_pseudo(fs_type: &[u8]) -> bool {
+    PSEUDO_FS_TYPES.iter().any(|&t| t.as_bytes() == fs_type)
+}
+
+// Undo the octal escapes (`\040` for space etc.) the kernel uses in mountinfo
+#[cfg(all(unix, target_os = "linux"))]
+fn unescape(field: &str) -> Vec<u8> {
+    let bytes = field.as_bytes();
+    let mut out = Vec::with_capacity(bytes.len());
+    let mut i = 0;
+    while i < bytes.len() {
+        if bytes[i] == b'\\' && i + 3 < bytes.len() {
+            let digits = &bytes[i + 1..i + 4];
+            if digits.iter().all(|d| (b'0'..=b'7').contains(d)) {
+                let value = digits
+                    .iter()
+                    .fold(0u32, |acc, d| acc * 8 + (d - b'0') as u32);
+                out.push(value as u8);
+                i += 4;
+                continue;
+            }
+        }
+        out.push(bytes[i]);
+        i += 1;
+    }
+    out
+}
+
+// Fields: id parent major:minor root mount_point options [optional...] - fs_type source ...
+#[cfg(all(unix, target_os = "linux"))]
+fn parse_mountinfo_line(line: &str) -> Option<MountEntry> {
+    let mut fields = line.split(' ');
+    let mount_point = fields.nth(4)?;
+    let mut fields = fields.skip_while(|&f| f != "-").skip(1);
+    let fs_type = fields.next()?;
+    let source = fields.next()?;
+    Some((
+        unescape(mount_point),
+        unescape(source),
+        fs_type.as_bytes().to_vec(),
+    ))
+}
+
+#[cfg(all(unix, target_os = "linux"))]
+pub(crate) fn mount_entries() -> Result<Vec<MountEntry>, StatError> {
+    let content = std::fs::read_to_string("/proc/self/mountinfo").map_err(|e| {
+        StatError::os(
+            Reason::MountTableFailed,
+            e.raw_os_error().unwrap_or(0) as i64,
+        )
+    })?;
+    Ok(content.lines().filter_map(parse_mountinfo_line).collect())
+}
+
+#[cfg(all(
+    unix,
+    any(
+        target_os = "macos",
+        target_os = "freebsd",
+        target_os = "openbsd",
+        target_os = "dragonfly",
+        target_os = "netbsd"
+    )
+))]
+pub(crate) fn mount_entries() -> Result<Vec<MountEntry>, StatError> {
+    use std::ffi::CStr;
+    // NetBSD reports mounts as statvfs, the others as statfs; the name fields match
+    #[cfg(target_os = "netbsd")]
+    let mut buffer: *mut libc::statvfs = std::ptr::null_mut();
+    #[cfg(not(target_os = "netbsd"))]
+    let mut buffer: *mut libc::statfs = std::ptr::null_mut();
+    // The buffer is owned by libc and reused by later calls from this thread
+    let count = unsafe { libc::getmntinfo(&mut buffer, libc::MNT_NOWAIT) };
+    if count <= 0 || buffer.is_null() {
+        let errno = std::io::Error::last_os_error().raw_os_error().unwrap_or(0);
+        return Err(StatError::os(Reason::MountTableFailed, errno as i64));
+    }
+    let entries = unsafe { std::slice::from_raw_parts(buffer, count as usize) };
+    Ok(entries
+        .iter()
+        .map(|entry| unsafe {
+            (
+                CStr::from_ptr(entry.f_mntonname.as_ptr())
+                    .to_bytes()
+                    .to_vec(),
+                CStr::from_ptr(entry.f_mntfromname.as_ptr())
+                    .to_bytes()
+                    .to_vec(),
+                CStr::from_ptr(entry.f_fstypename.as_ptr())
+                    .to_bytes()
+                    .to_vec(),
+            )
+        })
+        .collect())
+}
+
+// Split a double-null-terminated list of wide strings
+#[cfg(windows)]
+fn wide_multi_sz(buffer: &[u16]) -> Vec<&[u16]> {
+    buffer
+        .split(|&c| c == 0)
+        .take_while(|s| !s.is_empty())
+        .collect()
+}
+
+#[cfg(windows)]
+fn wide_until_nul(buffer: &[u16]) -> &[u16] {
+    let len = buffer.iter().position(|&c| c == 0).unwrap_or(buffer.len());
+    &buffer[..len]
+}
+
+#[cfg(windows)]
+fn volume_entries(volume: &[u16], entries: &mut Vec<MountEntry>) {
+    // `volume` is null-terminated, e.g. `\\?\Volume{GUID}\`
+    let volume_ptr = PCWSTR::from_raw(volume.as_ptr());
+    let mut names = vec![0u16; 1024];
+    let mut needed: u32 = 0;
+    let mut listed =
+        unsafe { GetVolumePathNamesForVolumeNameW(volume_ptr, Some(&mut names), &mut needed) };
+    if listed.is_err() && needed as usize > names.len() {
+        names = vec![0u16; needed as usize];
+        listed =
+            unsafe { GetVolumePathNamesForVolumeNameW(volume_ptr, Some(&mut names), &mut needed) };
+    }
+    if listed.is_err() {
+        return;
+    }
+    let mut fs_name = [0u16; 64];
+    let fs_type = match unsafe {
+        GetVolumeInformationW(volume_ptr, None, None, None, None, Some(&mut fs_name))
+    } {
+        Ok(()) => String::from_utf16_lossy(wide_until_nul(&fs_name)),
+        // e.g. a card reader or optical drive without media
+        Err(_) => String::new(),
+    };
+    let device = String::from_utf16_lossy(wide_until_nul(volume));
+    // unmounted volumes have no path names and are skipped
+    for name in wide_multi_sz(&names) {
+        entries.push((
+            String::from_utf16_lossy(name).into_bytes(),
+            device.clone().into_bytes(),
+            fs_type.clone().into_bytes(),
+        ));
+    }
+}
+
+#[cfg(windows)]
+pub(crate) fn mount_entries() -> Result<Vec<MountEntry>, StatError> {
+    let mut volume = vec![0u16; 64];
+    let handle = match unsafe { FindFirstVolumeW(&mut volume) } {
+        Ok(handle) => handle,
+        Err(e) => {
+            let err_code = (e.code().0 & 0xFFFF) as u32;
+            return Err(StatError::os(Reason::MountTableFailed, err_code as i64));
+        }
+    };
+    let mut entries = Vec::new();
+    loop {
+        volume_entries(&volume, &mut entries);
+        volume.iter_mut().for_each(|c| *c = 0);
+        if unsafe { FindNextVolumeW(handle, &mut volume) }.is_err() {
+            break;
+        }
+    }
+    let _ = unsafe { FindVolumeClose(handle) };
+    Ok(entries)
+}
+
+// Windows has no pseudo filesystems
+#[cfg(windows)]
+fn is_pseudo(_fs_type: &[u8]) -> bool {
+    false
+}
+
+// Volumes are queried through their GUID path, which survives remounts
+#[cfg(windows)]
+fn stat_mount(_mount_point: &[u8], device: &[u8]) -> StatResult {
+    let device = String::from_utf8_lossy(device);
+    match widestring::WideCString::from_str(&*device) {
+        Ok(wide) => stat::disk_free_wide(PCWSTR::from_raw(wide.as_ptr())),
+        Err(_) => Err(StatError::new(Reason::PathConversionFailed)),
+    }
+}
+
+#[cfg(unix)]
+fn stat_mount(mount_point: &[u8], _device: &[u8]) -> StatResult {
+    stat::statfs_path(Path::new(OsStr::from_bytes(mount_point)))
+}
+
+/// List the mounted filesystems and query the space on each, skipping pseudo
+/// filesystems unless `include_pseudo` is set.
+pub fn list_mounts(include_pseudo: bool) -> Result<Vec<Mount>, StatError> {
+    Ok(mount_entries()?
+        .into_iter()
+        .filter(|(_, _, fs_type)| include_pseudo || !is_pseudo(fs_type))
+        .map(|(mount_point, device, fs_type)| {
+            let stats = stat_mount(&mount_point, &device);
+            Mount {
+                mount_point,
+                device,
+                fs_type,
+                stats,
+            }
+        })
+        .collect())
+}
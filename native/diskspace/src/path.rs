@@ -0,0 +1,96 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Path marshaling for the per-call NIF entry points without heap allocations
+//! at typical path lengths: NUL-terminated copies go to a stack buffer, and
+//! the `\\?\`-prefixed UTF-16 form used by the WinAPI calls to a buffer that
+//! each thread reuses. Free of `rustler` types, so that
+//! `benches/path_alloc.rs` can count the allocations.
+
+#[cfg(windows)]
+use std::cell::RefCell;
+use std::ffi::{CStr, CString};
+
+/// Paths shorter than this many bytes are copied to the stack.
+pub const INLINE_PATH: usize = 256;
+
+/// Hand `bytes` to `f` as a `&CStr`, copied to the stack unless longer than
+/// `INLINE_PATH`. `None` if `bytes` is empty or contains a NUL.
+pub fn with_cstr<R>(bytes: &[u8], f: impl FnOnce(&CStr) -> R) -> Option<R> {
+    if bytes.is_empty() || bytes.contains(&0) {
+        return None;
+    }
+    if bytes.len() < INLINE_PATH {
+        let mut buf = [0u8; INLINE_PATH];
+        buf[..bytes.len()].copy_from_slice(bytes);
+        // SAFETY: `bytes` has no NUL and `buf[bytes.len()]` is the terminator
+        let cstr = unsafe { CStr::from_bytes_with_nul_unchecked(&buf[..=bytes.len()]) };
+        return Some(f(cstr));
+    }
+    let mut owned = Vec::with_capacity(bytes.len() + 1);
+    owned.extend_from_slice(bytes);
+    // SAFETY: checked for NULs above; the terminator fits the capacity
+    let cstr = unsafe { CString::from_vec_unchecked(owned) };
+    Some(f(&cstr))
+}
+
+/// Copy `bytes` to an owned `CString`, for paths that outlive the call (a
+/// queued job, a snapshot slot, an open handle). `None` if `bytes` is empty
+/// or contains a NUL.
+pub fn to_cstring(bytes: &[u8]) -> Option<CString> {
+    if bytes.is_empty() {
+        return None;
+    }
+    CString::new(bytes).ok()
+}
+
+#[cfg_attr(not(windows), allow(dead_code))]
+const LONG_PREFIX: &str = "\\\\?\\";
+#[cfg_attr(not(windows), allow(dead_code))]
+const LONG_UNC_PREFIX: &str = "\\\\?\\UNC\\";
+
+/// Append the UTF-16 form of `path` to `buf`, with `\\?\` (or `\\?\UNC\` for
+/// a `\\server\share` path) prepended unless it is there already. No NUL is
+/// appended.
+#[cfg_attr(not(windows), allow(dead_code))]
+pub fn push_long_wide(path: &str, buf: &mut Vec<u16>) {
+    let rest = if path.starts_with(LONG_PREFIX) {
+        path
+    } else if let Some(share) = path.strip_prefix("\\\\") {
+        buf.extend(LONG_UNC_PREFIX.encode_utf16());
+        share
+    } else {
+        buf.extend(LONG_PREFIX.encode_utf16());
+        path
+    };
+    buf.extend(rest.encode_utf16());
+}
+
+#[cfg(windows)]
+thread_local! {
+    static WIDE: RefCell<Vec<u16>> = const { RefCell::new(Vec::new()) };
+}
+
+/// Hand the NUL-terminated long UTF-16 form of `path` to `f`, built in the
+/// calling thread's buffer. `None` if `path` is not UTF-8.
+#[cfg(windows)]
+pub fn with_long_wide<R>(path: &CStr, f: impl FnOnce(&[u16]) -> R) -> Option<R> {
+    let path = path.to_str().ok()?;
+    let fill = |buf: &mut Vec<u16>| {
+        buf.clear();
+        push_long_wide(path, buf);
+        buf.push(0);
+    };
+    WIDE.with(|cell| match cell.try_borrow_mut() {
+        Ok(mut buf) => {
+            fill(&mut buf);
+            Some(f(&buf))
+        }
+        // only reached if `f` itself converts a path
+        Err(_) => {
+            let mut buf = Vec::new();
+            fill(&mut buf);
+            Some(f(&buf))
+        }
+    })
+}
@@ -0,0 +1,227 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! A small bounded worker pool for syscalls that may block indefinitely (e.g.
+//! `statfs` on a dead NFS mount), so that they never occupy a BEAM scheduler.
+//!
+//! Workers are spawned on demand up to `max_workers` and exit after sitting
+//! idle for a while. Jobs beyond `max_queue` are rejected instead of queued, so
+//! a pile-up of stuck workers shows up as `Busy` errors, not unbounded growth.
+
+use std::collections::VecDeque;
+use std::sync::atomic::{AtomicU64, AtomicU8, AtomicUsize, Ordering};
+use std::sync::{Condvar, Mutex, OnceLock};
+use std::thread;
+use std::time::Duration;
+
+pub type Job = Box<dyn FnOnce() + Send + 'static>;
+
+const DEFAULT_MAX_WORKERS: usize = 16;
+const DEFAULT_MAX_QUEUE: usize = 1024;
+const IDLE_TIMEOUT: Duration = Duration::from_secs(30);
+
+/// Returned by `submit` when the queue is full.
+pub struct Busy;
+
+struct State {
+    queue: VecDeque<Job>,
+    workers: usize,
+    idle: usize,
+}
+
+pub struct Pool {
+    state: Mutex<State>,
+    available: Condvar,
+    max_workers: AtomicUsize,
+    max_queue: AtomicUsize,
+    busy: AtomicUsize,
+    stuck: AtomicUsize,
+    rejected: AtomicU64,
+}
+
+/// Point-in-time counters, as reported by `DiskSpace.async_pool_info/0`.
+pub struct PoolInfo {
+    pub max_workers: usize,
+    pub max_queue: usize,
+    pub workers: usize,
+    pub busy: usize,
+    pub queued: usize,
+    pub stuck: usize,
+    pub rejected: u64,
+}
+
+impl Pool {
+    fn new() -> Pool {
+        Pool {
+            state: Mutex::new(State {
+                queue: VecDeque::new(),
+                workers: 0,
+                idle: 0,
+            }),
+            available: Condvar::new(),
+            max_workers: AtomicUsize::new(DEFAULT_MAX_WORKERS),
+            max_queue: AtomicUsize::new(DEFAULT_MAX_QUEUE),
+            busy: AtomicUsize::new(0),
+            stuck: AtomicUsize::new(0),
+            rejected: AtomicU64::new(0),
+        }
+    }
+
+    /// The process-wide pool shared by all async NIFs.
+    pub fn global() -> &'static Pool {
+        static POOL: OnceLock<Pool> = OnceLock::new();
+        POOL.get_or_init(Pool::new)
+    }
+
+    pub fn configure(&self, max_workers: usize, max_queue: usize) {
+        self.max_workers
+            .store(max_workers.max(1), Ordering::Relaxed);
+        self.max_queue.store(max_queue, Ordering::Relaxed);
+    }
+
+    /// Queue `job`, spawning a worker if none is idle and the cap allows it.
+    pub fn submit(&'static self, job: Job) -> Result<(), Busy> {
+        let mut state = self.lock();
+        if state.queue.len() >= self.max_queue.load(Ordering::Relaxed) {
+            self.rejected.fetch_add(1, Ordering::Relaxed);
+            return Err(Busy);
+        }
+        state.queue.push_back(job);
+        if state.idle < state.queue.len()
+            && state.workers < self.max_workers.load(Ordering::Relaxed)
+        {
+            let spawned = thread::Builder::new()
+                .name("disk_space_async".to_string())
+                .spawn(move || self.work());
+            if spawned.is_ok() {
+                state.workers += 1;
+            } else if state.workers == 0 {
+                state.queue.pop_back();
+                self.rejected.fetch_add(1, Ordering::Relaxed);
+                return Err(Busy);
+            }
+        }
+        drop(state);
+        self.available.notify_one();
+        Ok(())
+    }
+
+    /// Record that a running job was abandoned by its caller, or that an
+    /// abandoned job has finished after all.
+    pub fn mark_stuck(&self) {
+        self.stuck.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn unmark_stuck(&self) {
+        self.stuck.fetch_sub(1, Ordering::Relaxed);
+    }
+
+    pub fn info(&self) -> PoolInfo {
+        let state = self.lock();
+        PoolInfo {
+            max_workers: self.max_workers.load(Ordering::Relaxed),
+            max_queue: self.max_queue.load(Ordering::Relaxed),
+            workers: state.workers,
+            busy: self.busy.load(Ordering::Relaxed),
+            queued: state.queue.len(),
+            stuck: self.stuck.load(Ordering::Relaxed),
+            rejected: self.rejected.load(Ordering::Relaxed),
+        }
+    }
+
+    fn lock(&self) -> std::sync::MutexGuard<'_, State> {
+        self.state.lock().unwrap_or_else(|e| e.into_inner())
+    }
+
+    fn work(&self) {
+        loop {
+            let mut state = self.lock();
+            let job = loop {
+                if let Some(job) = state.queue.pop_front() {
+                    break job;
+                }
+                state.idle += 1;
+                let (guard, timeout) = self
+                    .available
+                    .wait_timeout(state, IDLE_TIMEOUT)
+                    .unwrap_or_else(|e| e.into_inner());
+                state = guard;
+                state.idle -= 1;
+                if timeout.timed_out() && state.queue.is_empty() {
+                    state.workers -= 1;
+                    return;
+                }
+            };
+            drop(state);
+            self.busy.fetch_add(1, Ordering::Relaxed);
+            job();
+            self.busy.fetch_sub(1, Ordering::Relaxed);
+        }
+    }
+}
+
+const PENDING: u8 = 0;
+const RUNNING: u8 = 1;
+const DONE: u8 = 2;
+const CANCELLED: u8 = 3;
+const ABANDONED: u8 = 4;
+
+/// Hand-off between a queued job and the caller waiting for its result.
+///
+/// Exactly one side wins: either the job delivers its result (`finish`), or
+/// the caller cancels it first, in which case no message will ever be sent.
+pub struct Ticket {
+    state: AtomicU8,
+}
+
+impl Default for Ticket {
+    fn default() -> Self {
+        Ticket::new()
+    }
+}
+
+impl Ticket {
+    pub fn new() -> Ticket {
+        Ticket {
+            state: AtomicU8::new(PENDING),
+        }
+    }
+
+    /// Called by the worker before running; `false` means skip the job.
+    pub fn start(&self) -> bool {
+        self.transition(PENDING, RUNNING)
+    }
+
+    /// Called by the worker once the result is ready; `false` means the caller
+    /// gave up in the meantime, so the result must be dropped. Tickets that
+    /// joined a query already in flight are finished straight from pending.
+    pub fn finish(&self, pool: &Pool) -> bool {
+        if self.transition(RUNNING, DONE) || self.transition(PENDING, DONE) {
+            true
+        } else {
+            if self.state.load(Ordering::Acquire) == ABANDONED {
+                pool.unmark_stuck();
+            }
+            false
+        }
+    }
+
+    /// Called by the caller on timeout; `false` means the result has already
+    /// been (or is being) delivered and must be received.
+    pub fn cancel(&self, pool: &Pool) -> bool {
+        if self.transition(PENDING, CANCELLED) {
+            true
+        } else if self.transition(RUNNING, ABANDONED) {
+            pool.mark_stuck();
+            true
+        } else {
+            false
+        }
+    }
+
+    fn transition(&self, from: u8, to: u8) -> bool {
+        self.state
+            .compare_exchange(from, to, Ordering::AcqRel, Ordering::Acquire)
+            .is_ok()
+    }
+}
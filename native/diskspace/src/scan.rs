@@ -0,0 +1,197 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Usage walks that run on their own thread and report to the caller, so
+//! that a scan taking minutes neither occupies a dirty scheduler nor leaves
+//! the caller without news.
+//!
+//! The scan resource doubles as the reference in every message: progress
+//! arrives as `{disk_space_progress, Scan, #{files, bytes, dirs}}` at most
+//! once per interval (the native reporter thread samples the walkers'
+//! counters, so the mailbox sees one message per interval, not per entry),
+//! and the result as `{disk_space_usage, Scan, Result}`. Cancelling takes the
+//! send lock, so no message is sent once `usage_scan_cancel` has returned.
+//! The owner is monitored: if it exits, the scan is cancelled and its
+//! threads wind down, releasing the resource.
+
+use crate::stat::StatError;
+use crate::usage::{self, Progress, Report, Reporter};
+use crate::{
+    atoms, get_optional_path_from_term, get_path_from_term, make_error_tuple, make_ok_usage,
+    make_stat_error_tuple, top_option,
+};
+use rustler::resource::Monitor;
+use rustler::{Encoder, Env, LocalPid, NifResult, OwnedEnv, ResourceArc, Term};
+use std::ffi::CString;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Mutex, MutexGuard};
+use std::thread;
+use std::time::Duration;
+
+pub struct Scan {
+    cancelled: AtomicBool,
+    // held while sending, so that cancelling waits for a message in flight
+    sender: Mutex<OwnedEnv>,
+}
+
+fn lock<T>(mutex: &Mutex<T>) -> MutexGuard<'_, T> {
+    mutex.lock().unwrap_or_else(|e| e.into_inner())
+}
+
+impl Scan {
+    fn cancel(&self) {
+        let _sender = lock(&self.sender);
+        self.cancelled.store(true, Ordering::Relaxed);
+    }
+}
+
+#[rustler::resource_impl]
+impl rustler::Resource for Scan {
+    // The owner exited: nobody will read the results
+    fn down<'a>(&'a self, _env: Env<'a>, _pid: LocalPid, _monitor: Monitor) {
+        self.cancel();
+    }
+}
+
+// Send `{Tag, Scan, Payload}` to `owner`, unless the scan was cancelled
+fn send<F>(scan: &ResourceArc<Scan>, owner: &LocalPid, payload: F)
+where
+    F: for<'a> FnOnce(Env<'a>) -> NifResult<Term<'a>>,
+{
+    let mut sender = lock(&scan.sender);
+    if scan.cancelled.load(Ordering::Relaxed) {
+        return;
+    }
+    let sent = sender.send_and_clear(owner, |env| match payload(env) {
+        Ok(term) => term,
+        Err(_) => atoms::error().encode(env),
+    });
+    if sent.is_err() {
+        // the owner is gone
+        scan.cancelled.store(true, Ordering::Relaxed);
+    }
+}
+
+fn encode_progress<'a>(env: Env<'a>, scan: Term<'a>, progress: Progress) -> NifResult<Term<'a>> {
+    let map = rustler::types::map::map_new(env)
+        .map_put(atoms::files().to_term(env), progress.files)?
+        .map_put(atoms::bytes().to_term(env), progress.apparent)?
+        .map_put(atoms::dirs().to_term(env), progress.dirs)?;
+    Ok((atoms::disk_space_progress(), scan, map).encode(env))
+}
+
+// Build the result in the shape `DiskSpace.usage/2` returns, since the
+// message reaches the caller without passing through Elixir code
+fn encode_result<'a>(
+    env: Env<'a>,
+    scan: Term<'a>,
+    result: &Result<Report, StatError>,
+) -> NifResult<Term<'a>> {
+    let result = match result {
+        Ok(report) => make_ok_usage(env, report)?,
+        Err(err) => {
+            let elements = rustler::types::tuple::get_tuple(make_stat_error_tuple(env, err)?)?;
+            let info = match elements.get(2) {
+                Some(&info) => info,
+                None => rustler::types::atom::nil().to_term(env),
+            };
+            let map = rustler::types::map::map_new(env)
+                .map_put(atoms::reason().to_term(env), elements[1])?
+                .map_put(atoms::info().to_term(env), info)?;
+            (atoms::error(), map).encode(env)
+        }
+    };
+    Ok((atoms::disk_space_usage(), scan, result).encode(env))
+}
+
+fn run(
+    scan: ResourceArc<Scan>,
+    owner: LocalPid,
+    path_cstr: CString,
+    threads: usize,
+    one_file_system: bool,
+    io_uring: bool,
+    index: Option<CString>,
+    top: Option<usage::Top>,
+    progress_interval: Option<Duration>,
+) {
+    let report = |progress: Progress| {
+        send(&scan, &owner, |env| {
+            encode_progress(env, scan.encode(env), progress)
+        })
+    };
+    let options = usage::Options {
+        threads,
+        one_file_system,
+        cancel: Some(&scan.cancelled),
+        reporter: progress_interval.map(|interval| Reporter {
+            interval,
+            report: &report,
+        }),
+        io_uring,
+        index: index.as_deref(),
+        top,
+    };
+    let result = usage::usage(&path_cstr, &options);
+    send(&scan, &owner, |env| {
+        encode_result(env, scan.encode(env), &result)
+    });
+}
+
+// Start a scan on its own thread; returns {ok, Scan}. ProgressMs 0 disables progress
+#[rustler::nif]
+fn usage_scan_start<'a>(
+    env: Env<'a>,
+    path_term: Term<'a>,
+    threads: usize,
+    one_file_system: bool,
+    io_uring: bool,
+    index_term: Term<'a>,
+    top: usize,
+    rank_by: rustler::Atom,
+    progress_ms: u64,
+) -> NifResult<Term<'a>> {
+    let path_cstr = match get_path_from_term(env, path_term) {
+        Ok(path) => path,
+        Err(_) => return make_error_tuple(env, atoms::invalid_path()),
+    };
+    let index = match get_optional_path_from_term(env, index_term) {
+        Ok(index) => index,
+        Err(_) => return make_error_tuple(env, atoms::invalid_path()),
+    };
+    let scan = ResourceArc::new(Scan {
+        cancelled: AtomicBool::new(false),
+        sender: Mutex::new(OwnedEnv::new()),
+    });
+    let owner = env.pid();
+    let _ = scan.monitor(Some(env), &owner);
+    let top = top_option(top, rank_by);
+    let progress_interval = (progress_ms > 0).then(|| Duration::from_millis(progress_ms));
+    let thread_scan = scan.clone();
+    let spawned = thread::Builder::new()
+        .name("disk_space_scan".to_string())
+        .spawn(move || {
+            run(
+                thread_scan,
+                owner,
+                path_cstr,
+                threads,
+                one_file_system,
+                io_uring,
+                index,
+                top,
+                progress_interval,
+            )
+        });
+    match spawned {
+        Ok(_) => Ok((atoms::ok(), scan).encode(env)),
+        Err(_) => make_error_tuple(env, atoms::thread_spawn_failed()),
+    }
+}
+
+// Stop a scan; no message for it is sent after this returns
+#[rustler::nif]
+fn usage_scan_cancel(scan: ResourceArc<Scan>) -> rustler::Atom {
+    scan.cancel();
+    atoms::ok()
+}
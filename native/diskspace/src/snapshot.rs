@@ -0,0 +1,480 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! A fixed-size table of per-path space snapshots, refreshed in the background
+//! and read without locks or syscalls.
+//!
+//! One thread ticks once per interval and queues a query per registered path
+//! on the worker pool of `pool.rs`, so a hung mount only holds up its own
+//! slot (and one worker). A path whose query is still running is not queued
+//! again; once the query has run past the table's timeout, the slot reports
+//! `Reason::Timeout` until a result arrives.
+//!
+//! Each slot is a seqlock: the refresher bumps `seq` to an odd value, writes
+//! the fields and bumps it back to even; readers retry until they see the same
+//! even `seq` before and after copying the fields. Registration changes go
+//! through `paths`, which also serializes all writers. The thread is owned by
+//! the table resource: `snapshot_stop` stops and joins it, while dropping the
+//! resource only signals it, as that can happen on a normal scheduler. Queued
+//! queries skip the syscall once the table is stopped.
+//!
+//! Every successful refresh is also fed to the path's `FillRate`, a fixed-size
+//! window kept with its registration, for `snapshot_forecast`.
+
+use crate::forecast::{FillRate, Forecast};
+use crate::pool::Pool;
+use crate::stat::{self, FsStats, Reason, StatError, StatResult};
+use crate::{atoms, encode_stat_result_as, get_path_from_term, make_error_tuple};
+use rustler::{Encoder, Env, NifResult, ResourceArc, Term};
+use std::ffi::CString;
+use std::sync::atomic::{fence, AtomicBool, AtomicI64, AtomicU64, AtomicU8, Ordering};
+use std::sync::{Arc, Condvar, Mutex, MutexGuard};
+use std::thread::{self, JoinHandle};
+use std::time::{Duration, Instant};
+
+#[derive(Default)]
+struct Slot {
+    seq: AtomicU64,
+    generation: AtomicU64,
+    // milliseconds since `Table::epoch`, 0 while no refresh has completed
+    updated_at: AtomicU64,
+    // 0 for success, otherwise `reason_code`
+    reason: AtomicU8,
+    os_error: AtomicI64,
+    has_os_error: AtomicBool,
+    available: AtomicU64,
+    free: AtomicU64,
+    total: AtomicU64,
+    used: AtomicU64,
+}
+
+/// What a reader copies out of a slot.
+pub struct Reading {
+    pub generation: u64,
+    pub updated_at: u64,
+    pub result: StatResult,
+}
+
+struct Registration {
+    path: CString,
+    generation: u64,
+    fill: FillRate,
+    query: Option<Query>,
+}
+
+// A query of the path that is queued or running on the pool
+struct Query {
+    since: Instant,
+    timed_out: bool,
+}
+
+struct Table {
+    slots: Box<[Slot]>,
+    paths: Mutex<Vec<Option<Registration>>>,
+    next_generation: AtomicU64,
+    interval: Duration,
+    // how long a query may run before its slot reports a timeout
+    timeout: Duration,
+    // samples per fill-rate window
+    window: usize,
+    epoch: Instant,
+    control: Mutex<Control>,
+    wakeup: Condvar,
+}
+
+#[derive(Default)]
+struct Control {
+    stop: bool,
+    // set by `register` to refresh before the interval is up
+    wake: bool,
+}
+
+fn reason_code(reason: Reason) -> u8 {
+    match reason {
+        Reason::InvalidPath => 1,
+        Reason::PathConversionFailed => 2,
+        Reason::NotDirectory => 3,
+        Reason::WinapiFailed => 4,
+        Reason::StatvfsFailed => 5,
+        Reason::StatfsFailed => 6,
+        Reason::HandleClosed => 7,
+        Reason::MountTableFailed => 8,
+        Reason::Cancelled => 9,
+        Reason::IndexWriteFailed => 10,
+        Reason::Timeout => 11,
+    }
+}
+
+fn reason_from_code(code: u8) -> Reason {
+    match code {
+        1 => Reason::InvalidPath,
+        2 => Reason::PathConversionFailed,
+        3 => Reason::NotDirectory,
+        4 => Reason::WinapiFailed,
+        5 => Reason::StatvfsFailed,
+        6 => Reason::StatfsFailed,
+        8 => Reason::MountTableFailed,
+        9 => Reason::Cancelled,
+        10 => Reason::IndexWriteFailed,
+        11 => Reason::Timeout,
+        _ => Reason::HandleClosed,
+    }
+}
+
+impl Table {
+    fn lock_paths(&self) -> MutexGuard<'_, Vec<Option<Registration>>> {
+        self.paths.lock().unwrap_or_else(|e| e.into_inner())
+    }
+
+    fn now_ms(&self) -> u64 {
+        // never 0, which marks a slot that has not been refreshed yet
+        self.epoch.elapsed().as_millis() as u64 + 1
+    }
+
+    // Callers must hold `paths`, which makes them the only writer
+    fn write(&self, index: usize, generation: u64, updated_at: u64, result: &StatResult) {
+        let slot = &self.slots[index];
+        let seq = slot.seq.load(Ordering::Relaxed);
+        slot.seq.store(seq.wrapping_add(1), Ordering::Relaxed);
+        fence(Ordering::Release);
+        slot.generation.store(generation, Ordering::Relaxed);
+        slot.updated_at.store(updated_at, Ordering::Relaxed);
+        let stats = match result {
+            Ok(stats) => {
+                slot.reason.store(0, Ordering::Relaxed);
+                *stats
+            }
+            Err(err) => {
+                slot.reason
+                    .store(reason_code(err.reason), Ordering::Relaxed);
+                slot.has_os_error
+                    .store(err.os_error.is_some(), Ordering::Relaxed);
+                slot.os_error
+                    .store(err.os_error.unwrap_or(0), Ordering::Relaxed);
+                FsStats::default()
+            }
+        };
+        slot.available.store(stats.available, Ordering::Relaxed);
+        slot.free.store(stats.free, Ordering::Relaxed);
+        slot.total.store(stats.total, Ordering::Relaxed);
+        slot.used.store(stats.used, Ordering::Relaxed);
+        slot.seq.store(seq.wrapping_add(2), Ordering::Release);
+    }
+
+    fn read(&self, index: usize) -> Reading {
+        let slot = &self.slots[index];
+        loop {
+            let before = slot.seq.load(Ordering::Acquire);
+            if before & 1 == 1 {
+                std::hint::spin_loop();
+                continue;
+            }
+            let generation = slot.generation.load(Ordering::Relaxed);
+            let updated_at = slot.updated_at.load(Ordering::Relaxed);
+            let reason = slot.reason.load(Ordering::Relaxed);
+            let has_os_error = slot.has_os_error.load(Ordering::Relaxed);
+            let os_error = slot.os_error.load(Ordering::Relaxed);
+            let stats = FsStats {
+                available: slot.available.load(Ordering::Relaxed),
+                free: slot.free.load(Ordering::Relaxed),
+                total: slot.total.load(Ordering::Relaxed),
+                used: slot.used.load(Ordering::Relaxed),
+            };
+            fence(Ordering::Acquire);
+            if slot.seq.load(Ordering::Relaxed) != before {
+                continue;
+            }
+            let result = if reason == 0 {
+                Ok(stats)
+            } else {
+                Err(StatError {
+                    reason: reason_from_code(reason),
+                    os_error: has_os_error.then_some(os_error),
+                })
+            };
+            return Reading {
+                generation,
+                updated_at,
+                result,
+            };
+        }
+    }
+
+    fn register(&self, path: CString) -> Option<(usize, u64)> {
+        let mut paths = self.lock_paths();
+        let index = paths.iter().position(Option::is_none)?;
+        let generation = self.next_generation.fetch_add(1, Ordering::Relaxed);
+        paths[index] = Some(Registration {
+            path,
+            generation,
+            fill: FillRate::new(self.window),
+            query: None,
+        });
+        self.write(index, generation, 0, &Ok(FsStats::default()));
+        drop(paths);
+        // refresh right away instead of waiting for the next tick
+        self.lock_control().wake = true;
+        self.wakeup.notify_one();
+        Some((index, generation))
+    }
+
+    fn unregister(&self, index: usize, generation: u64) -> bool {
+        let mut paths = self.lock_paths();
+        match paths.get(index) {
+            Some(Some(registration)) if registration.generation == generation => {
+                paths[index] = None;
+                self.write(index, 0, 0, &Ok(FsStats::default()));
+                true
+            }
+            _ => false,
+        }
+    }
+
+    fn forecast(&self, index: usize, generation: u64) -> Option<Option<Forecast>> {
+        match self.lock_paths().get(index) {
+            Some(Some(registration)) if registration.generation == generation => {
+                Some(registration.fill.forecast())
+            }
+            _ => None,
+        }
+    }
+
+    // Queue a query for every registered path without one in flight, and
+    // report the queries that have run past the timeout
+    fn refresh(self: &Arc<Self>) {
+        let mut paths = self.lock_paths();
+        for (index, entry) in paths.iter_mut().enumerate() {
+            let Some(registration) = entry else {
+                continue;
+            };
+            let generation = registration.generation;
+            if let Some(query) = &mut registration.query {
+                // reported once; a late result still replaces the timeout
+                if !query.timed_out && query.since.elapsed() >= self.timeout {
+                    query.timed_out = true;
+                    let timeout = Err(StatError::new(Reason::Timeout));
+                    self.write(index, generation, self.now_ms(), &timeout);
+                }
+                continue;
+            }
+            let table = self.clone();
+            let path = registration.path.clone();
+            let job = Box::new(move || {
+                if !table.stopping() {
+                    table.complete(index, generation, stat::stat_path(&path));
+                }
+            });
+            // with the pool queue full, the path waits for the next tick
+            if Pool::global().submit(job).is_ok() {
+                registration.query = Some(Query {
+                    since: Instant::now(),
+                    timed_out: false,
+                });
+            }
+        }
+    }
+
+    fn complete(&self, index: usize, generation: u64, result: StatResult) {
+        let updated_at = self.now_ms();
+        let mut paths = self.lock_paths();
+        // skip paths that were unregistered while the syscall ran
+        if let Some(Some(registration)) = paths.get_mut(index) {
+            if registration.generation == generation {
+                registration.query = None;
+                if let Ok(stats) = &result {
+                    registration.fill.push(updated_at, stats);
+                }
+                self.write(index, generation, updated_at, &result);
+            }
+        }
+    }
+
+    fn lock_control(&self) -> MutexGuard<'_, Control> {
+        self.control.lock().unwrap_or_else(|e| e.into_inner())
+    }
+
+    fn stopping(&self) -> bool {
+        self.lock_control().stop
+    }
+
+    fn run(self: &Arc<Self>) {
+        loop {
+            self.refresh();
+            let control = self.lock_control();
+            let (mut control, _) = self
+                .wakeup
+                .wait_timeout_while(control, self.interval, |c| !c.stop && !c.wake)
+                .unwrap_or_else(|e| e.into_inner());
+            if control.stop {
+                return;
+            }
+            control.wake = false;
+        }
+    }
+}
+
+/// The NIF resource: the table plus the thread refreshing it.
+pub struct SnapshotTable {
+    table: Arc<Table>,
+    thread: Mutex<Option<JoinHandle<()>>>,
+}
+
+impl SnapshotTable {
+    fn new(
+        capacity: usize,
+        interval: Duration,
+        timeout: Duration,
+        window: usize,
+    ) -> Option<SnapshotTable> {
+        let table = Arc::new(Table {
+            slots: (0..capacity).map(|_| Slot::default()).collect(),
+            paths: Mutex::new((0..capacity).map(|_| None).collect()),
+            next_generation: AtomicU64::new(1),
+            interval,
+            timeout,
+            window,
+            epoch: Instant::now(),
+            control: Mutex::new(Control::default()),
+            wakeup: Condvar::new(),
+        });
+        let thread_table = table.clone();
+        let thread = thread::Builder::new()
+            .name("disk_space_snapshot".to_string())
+            .spawn(move || thread_table.run())
+            .ok()?;
+        Some(SnapshotTable {
+            table,
+            thread: Mutex::new(Some(thread)),
+        })
+    }
+
+    // Signal the thread to exit without waiting for it
+    fn signal_stop(&self) {
+        self.table.lock_control().stop = true;
+        self.table.wakeup.notify_all();
+    }
+
+    fn stop(&self) {
+        self.signal_stop();
+        let thread = self.thread.lock().unwrap_or_else(|e| e.into_inner()).take();
+        if let Some(thread) = thread {
+            let _ = thread.join();
+        }
+    }
+}
+
+// The last reference can go away on a normal scheduler, so the thread is
+// only signalled and left to exit on its own
+impl Drop for SnapshotTable {
+    fn drop(&mut self) {
+        self.signal_stop();
+    }
+}
+
+#[rustler::resource_impl]
+impl rustler::Resource for SnapshotTable {}
+
+#[rustler::nif]
+fn snapshot_new<'a>(
+    env: Env<'a>,
+    capacity: usize,
+    interval_ms: u64,
+    timeout_ms: u64,
+    window: usize,
+) -> NifResult<Term<'a>> {
+    let interval = Duration::from_millis(interval_ms.max(1));
+    let timeout = Duration::from_millis(timeout_ms);
+    match SnapshotTable::new(capacity, interval, timeout, window) {
+        Some(table) => Ok((atoms::ok(), ResourceArc::new(table)).encode(env)),
+        None => make_error_tuple(env, atoms::thread_spawn_failed()),
+    }
+}
+
+// Joins the thread; queries it already queued finish on the pool
+#[rustler::nif(schedule = "DirtyIo")]
+fn snapshot_stop(table: ResourceArc<SnapshotTable>) -> rustler::Atom {
+    table.stop();
+    atoms::ok()
+}
+
+// Returns {ok, Slot, Generation} or {error, full}
+#[rustler::nif]
+fn snapshot_register<'a>(
+    env: Env<'a>,
+    table: ResourceArc<SnapshotTable>,
+    path_term: Term<'a>,
+) -> NifResult<Term<'a>> {
+    let path_cstr = match get_path_from_term(env, path_term) {
+        Ok(path) => path,
+        Err(_) => return make_error_tuple(env, atoms::invalid_path()),
+    };
+    match table.table.register(path_cstr) {
+        Some((index, generation)) => Ok((atoms::ok(), index, generation).encode(env)),
+        None => make_error_tuple(env, atoms::full()),
+    }
+}
+
+#[rustler::nif]
+fn snapshot_unregister(table: ResourceArc<SnapshotTable>, index: usize, generation: u64) -> bool {
+    table.table.unregister(index, generation)
+}
+
+// Lock-free read: {Result, AgeMs}, or {error, pending | not_registered}
+#[rustler::nif]
+fn snapshot_read<'a>(
+    env: Env<'a>,
+    table: ResourceArc<SnapshotTable>,
+    index: usize,
+    generation: u64,
+    format: crate::Format,
+) -> NifResult<Term<'a>> {
+    if index >= table.table.slots.len() {
+        return make_error_tuple(env, atoms::not_registered());
+    }
+    let reading = table.table.read(index);
+    if reading.generation != generation {
+        return make_error_tuple(env, atoms::not_registered());
+    }
+    if reading.updated_at == 0 {
+        return make_error_tuple(env, atoms::pending());
+    }
+    let age = table.table.now_ms().saturating_sub(reading.updated_at);
+    let result = encode_stat_result_as(env, &reading.result, format)?;
+    Ok((result, age).encode(env))
+}
+
+// Returns {ok, #{rate, time_to_full, samples, window}}, {error, pending} with
+// fewer than two samples, or {error, not_registered}
+#[rustler::nif]
+fn snapshot_forecast<'a>(
+    env: Env<'a>,
+    table: ResourceArc<SnapshotTable>,
+    index: usize,
+    generation: u64,
+) -> NifResult<Term<'a>> {
+    let forecast = match table.table.forecast(index, generation) {
+        Some(Some(forecast)) => forecast,
+        Some(None) => return make_error_tuple(env, atoms::pending()),
+        None => return make_error_tuple(env, atoms::not_registered()),
+    };
+    let time_to_full = match forecast.time_to_full {
+        Some(seconds) => seconds.encode(env),
+        None => atoms::infinity().encode(env),
+    };
+    let map = Term::map_from_term_arrays(
+        env,
+        &[
+            atoms::rate().encode(env),
+            atoms::time_to_full().encode(env),
+            atoms::samples().encode(env),
+            atoms::window().encode(env),
+        ],
+        &[
+            forecast.rate.encode(env),
+            time_to_full,
+            forecast.samples.encode(env),
+            forecast.window_ms.encode(env),
+        ],
+    )?;
+    Ok((atoms::ok(), map).encode(env))
+}
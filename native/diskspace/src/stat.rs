@@ -0,0 +1,690 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Platform-specific filesystem space queries, free of any `rustler` types so
+//! that every NIF entry point (single, batch, ...) shares the same syscalls and
+//! error classification. Turning results into terms happens in `lib.rs`.
+
+#[cfg(windows)]
+use crate::path;
+#[cfg(windows)]
+use crate::volumes;
+use std::collections::HashMap;
+use std::ffi::{CStr, CString};
+use std::time::{Duration, Instant};
+// Unix-specific imports
+#[cfg(unix)]
+use std::ffi::OsStr;
+#[cfg(unix)]
+use std::os::unix::ffi::OsStrExt;
+#[cfg(unix)]
+use std::os::unix::fs::MetadataExt;
+#[cfg(unix)]
+use std::path::Path;
+// Windows-specific imports
+#[cfg(windows)]
+use widestring::WideCString;
+#[cfg(windows)]
+use windows::core::PCWSTR;
+#[cfg(windows)]
+use windows::Win32::Foundation::{
+    GetLastError, ERROR_DIRECTORY, ERROR_FILE_NOT_FOUND, ERROR_PATH_NOT_FOUND,
+};
+#[cfg(windows)]
+use windows::Win32::Storage::FileSystem::{
+    GetDiskFreeSpaceExW, GetDiskFreeSpaceW, GetFileAttributesW, GetVolumeInformationW,
+    GetVolumePathNameW, FILE_ATTRIBUTE_DIRECTORY, INVALID_FILE_ATTRIBUTES,
+};
+// nix imports with proper cfg to avoid unused warnings
+#[cfg(all(unix, target_os = "linux"))]
+use nix::sys::statfs::{statfs, Statfs};
+#[cfg(all(unix, not(target_os = "linux")))]
+use nix::sys::statvfs::{statvfs, Statvfs};
+
+/// Space figures in bytes, as returned to Elixir in the stats map.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct FsStats {
+    pub available: u64,
+    pub free: u64,
+    pub total: u64,
+    pub used: u64,
+}
+
+impl FsStats {
+    pub(crate) fn from_blocks(block_size: u64, available: u64, free: u64, total: u64) -> FsStats {
+        let total = total * block_size;
+        let free = free * block_size;
+        FsStats {
+            available: available * block_size,
+            free,
+            total,
+            used: total.saturating_sub(free),
+        }
+    }
+}
+
+/// Details of a filesystem that come with the same syscall as its space
+/// figures (`statfs` on Linux and most BSDs, `statvfs` on NetBSD and others;
+/// on Windows the volume root's `GetVolumeInformationW`/`GetDiskFreeSpaceW`).
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct FsDetails {
+    // `None` where the filesystem has no inode table to report (Windows)
+    pub inodes_total: Option<u64>,
+    pub inodes_free: Option<u64>,
+    pub block_size: u64,
+    // empty where the platform does not name it
+    pub fs_type: Vec<u8>,
+    pub fsid: u64,
+}
+
+// Both halves of an `fsid_t` (whose fields are private in the libc crate),
+// in the order `stat -f` prints them
+#[cfg(all(
+    unix,
+    any(
+        target_os = "linux",
+        target_os = "macos",
+        target_os = "freebsd",
+        target_os = "openbsd",
+        target_os = "dragonfly"
+    )
+))]
+fn fsid_from(fsid: libc::fsid_t) -> u64 {
+    let halves: [i32; 2] = unsafe { std::mem::transmute(fsid) };
+    ((halves[0] as u32 as u64) << 32) | (halves[1] as u32 as u64)
+}
+
+/// The name of a Linux filesystem by its `statfs` magic number (see
+/// `statfs(2)`), or the number in hex for types not listed here.
+#[cfg(all(unix, target_os = "linux"))]
+pub(crate) fn linux_fs_type_name(magic: u64) -> Vec<u8> {
+    let name = match magic {
+        // shared by ext2 and ext3
+        0xEF53 => "ext4",
+        0x58465342 => "xfs",
+        0x9123683E => "btrfs",
+        0x2FC12FC1 => "zfs",
+        0xF2F52010 => "f2fs",
+        0xCA451A4E => "bcachefs",
+        0x4D44 => "vfat",
+        0x2011BAB0 => "exfat",
+        0x7366746E => "ntfs3",
+        0x9660 => "iso9660",
+        0x73717368 => "squashfs",
+        0x01021994 => "tmpfs",
+        0x858458F6 => "ramfs",
+        0x794C7630 => "overlay",
+        0x6969 => "nfs",
+        0xFF534D42 => "cifs",
+        0xFE534D42 => "smb2",
+        0x00C36400 => "ceph",
+        0x65735546 => "fuse",
+        0x9FA0 => "proc",
+        0x62656572 => "sysfs",
+        0x27E0EB => "cgroup",
+        0x63677270 => "cgroup2",
+        _ => return format!("0x{magic:x}").into_bytes(),
+    };
+    name.as_bytes().to_vec()
+}
+
+/// Failure reasons; each one maps 1:1 to an atom of the same name in `lib.rs`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Reason {
+    InvalidPath,
+    PathConversionFailed,
+    NotDirectory,
+    WinapiFailed,
+    StatvfsFailed,
+    StatfsFailed,
+    HandleClosed,
+    MountTableFailed,
+    Cancelled,
+    IndexWriteFailed,
+    Timeout,
+}
+
+/// A failed query: the reason plus the raw OS error code (errno on Unix,
+/// WinAPI error code on Windows), if the OS reported one.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct StatError {
+    pub reason: Reason,
+    pub os_error: Option<i64>,
+}
+
+impl StatError {
+    pub fn new(reason: Reason) -> StatError {
+        StatError {
+            reason,
+            os_error: None,
+        }
+    }
+
+    pub fn os(reason: Reason, code: i64) -> StatError {
+        StatError {
+            reason,
+            os_error: Some(code),
+        }
+    }
+}
+
+pub type StatResult = Result<FsStats, StatError>;
+
+/// Identifies the filesystem a path lives on: `st_dev` on Unix, the volume
+/// root (as UTF-16, without terminator) on Windows.
+#[cfg(unix)]
+pub type DeviceKey = u64;
+#[cfg(windows)]
+pub type DeviceKey = Vec<u16>;
+
+/// Input positions of the paths that were found on the same device.
+pub struct DeviceGroup {
+    pub device: DeviceKey,
+    pub members: Vec<usize>,
+}
+
+/// Build the `\\?\`-prefixed wide path used by all WinAPI calls, for callers
+/// that keep it; per-call queries borrow it through `with_long_wpath`.
+#[cfg(windows)]
+pub fn long_wide_path(path_cstr: &CStr) -> Result<WideCString, StatError> {
+    let path_str = match path_cstr.to_str() {
+        Ok(s) => s,
+        Err(_) => return Err(StatError::new(Reason::PathConversionFailed)),
+    };
+    let mut wide = Vec::with_capacity(path_str.len() + 8);
+    path::push_long_wide(path_str, &mut wide);
+    WideCString::from_vec(wide).map_err(|_| StatError::new(Reason::PathConversionFailed))
+}
+
+// Run `f` on the long wide path of `path_cstr`, built without allocating
+#[cfg(windows)]
+pub(crate) fn with_long_wpath<T>(
+    path_cstr: &CStr,
+    f: impl FnOnce(PCWSTR) -> Result<T, StatError>,
+) -> Result<T, StatError> {
+    path::with_long_wide(path_cstr, |wide| f(PCWSTR::from_raw(wide.as_ptr())))
+        .unwrap_or_else(|| Err(StatError::new(Reason::PathConversionFailed)))
+}
+
+// Fail unless `long_wpath` exists and is a directory
+#[cfg(windows)]
+pub(crate) fn check_dir_wide(long_wpath: PCWSTR) -> Result<(), StatError> {
+    let attr = unsafe { GetFileAttributesW(long_wpath) };
+    if attr == INVALID_FILE_ATTRIBUTES {
+        let err = unsafe { GetLastError() };
+        let err_code = err.0;
+        let reason = if err_code == ERROR_FILE_NOT_FOUND.0 || err_code == ERROR_PATH_NOT_FOUND.0 {
+            Reason::InvalidPath
+        } else {
+            Reason::WinapiFailed
+        };
+        return Err(StatError::os(reason, err_code as i64));
+    }
+    if (attr & FILE_ATTRIBUTE_DIRECTORY.0) == 0 {
+        return Err(StatError::new(Reason::NotDirectory));
+    }
+    Ok(())
+}
+
+#[cfg(windows)]
+pub(crate) fn disk_free_wide(long_wpath: PCWSTR) -> StatResult {
+    let mut avail: u64 = 0;
+    let mut total: u64 = 0;
+    let mut free: u64 = 0;
+    let result = unsafe {
+        GetDiskFreeSpaceExW(
+            long_wpath,
+            Some(&mut avail),
+            Some(&mut total),
+            Some(&mut free),
+        )
+    };
+    if let Err(e) = result {
+        let err_code = (e.code().0 & 0xFFFF) as u32;
+        return Err(StatError::os(Reason::WinapiFailed, err_code as i64));
+    }
+    Ok(FsStats::from_blocks(1, avail, free, total))
+}
+
+// Without the attribute check, tell missing paths and files apart by the
+// error GetDiskFreeSpaceExW failed with
+#[cfg(windows)]
+fn unchecked_error(err: StatError) -> StatError {
+    let reason = match err.os_error {
+        Some(code)
+            if code == ERROR_FILE_NOT_FOUND.0 as i64 || code == ERROR_PATH_NOT_FOUND.0 as i64 =>
+        {
+            Reason::InvalidPath
+        }
+        Some(code) if code == ERROR_DIRECTORY.0 as i64 => Reason::NotDirectory,
+        _ => return err,
+    };
+    StatError { reason, ..err }
+}
+
+// Resolve the volume root (e.g. `\\?\C:\`) that `long_wpath` is mounted under
+#[cfg(windows)]
+pub(crate) fn volume_root_wide(long_wpath: PCWSTR) -> Result<Vec<u16>, StatError> {
+    let mut buffer = vec![0u16; 1024];
+    if let Err(e) = unsafe { GetVolumePathNameW(long_wpath, &mut buffer) } {
+        let err_code = (e.code().0 & 0xFFFF) as u32;
+        return Err(StatError::os(Reason::WinapiFailed, err_code as i64));
+    }
+    let len = buffer.iter().position(|&c| c == 0).unwrap_or(buffer.len());
+    buffer.truncate(len);
+    Ok(buffer)
+}
+
+/// Time spent in the directory check and in the space query of one call, on
+/// the monotonic clock. A step that did not run counts as zero.
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Timing {
+    pub check: Duration,
+    pub space: Duration,
+}
+
+// Run `f`, adding the time it took to `slot`
+fn timed<T>(slot: &mut Duration, f: impl FnOnce() -> T) -> T {
+    let started = Instant::now();
+    let value = f();
+    *slot += started.elapsed();
+    value
+}
+
+/// Query the filesystem holding the directory at `path_cstr`.
+pub fn stat_path(path_cstr: &CStr) -> StatResult {
+    stat_path_with(path_cstr, true)
+}
+
+/// Like `stat_path`, but with `validate` false, skip the directory check and
+/// classify failures by the error of the space query alone: one path lookup
+/// instead of two, which matters on network filesystems.
+#[cfg(windows)]
+pub fn stat_path_with(path_cstr: &CStr, validate: bool) -> StatResult {
+    with_long_wpath(path_cstr, |long_wpath| {
+        checked_disk_free_wide(long_wpath, validate)
+    })
+}
+
+/// Like `stat_path_with`, and times each syscall.
+#[cfg(windows)]
+pub fn stat_path_timed(path_cstr: &CStr, validate: bool) -> (StatResult, Timing) {
+    let mut timing = Timing::default();
+    let result = with_long_wpath(path_cstr, |long_wpath| {
+        if !validate {
+            return timed(&mut timing.space, || disk_free_wide(long_wpath))
+                .map_err(unchecked_error);
+        }
+        timed(&mut timing.check, || check_dir_wide(long_wpath))?;
+        timed(&mut timing.space, || disk_free_wide(long_wpath))
+    });
+    (result, timing)
+}
+
+#[cfg(windows)]
+pub(crate) fn checked_disk_free_wide(long_wpath: PCWSTR, validate: bool) -> StatResult {
+    if !validate {
+        return disk_free_wide(long_wpath).map_err(unchecked_error);
+    }
+    check_dir_wide(long_wpath)?;
+    disk_free_wide(long_wpath)
+}
+
+/// Like `stat_path_with`, plus the details of the volume the directory is on.
+/// A validated directory is queried through its (cached) volume root, which
+/// also gives the cluster size where `GetDiskSpaceInformationW` exists.
+#[cfg(windows)]
+pub fn stat_path_extended(
+    path_cstr: &CStr,
+    validate: bool,
+) -> Result<(FsStats, FsDetails), StatError> {
+    let (stats, cluster_size, mut root) = with_long_wpath(path_cstr, |long_wpath| {
+        if !validate {
+            let stats = disk_free_wide(long_wpath).map_err(unchecked_error)?;
+            return Ok((stats, None, volumes::root_of(long_wpath)?));
+        }
+        check_dir_wide(long_wpath)?;
+        let mut root = volumes::root_of(long_wpath)?;
+        root.push(0);
+        let (stats, cluster_size) = volumes::volume_space(PCWSTR::from_raw(root.as_ptr()))?;
+        root.pop();
+        Ok((stats, cluster_size, root))
+    })?;
+    root.push(0);
+    let root_wpath = PCWSTR::from_raw(root.as_ptr());
+    let winapi_failed =
+        |e: windows::core::Error| StatError::os(Reason::WinapiFailed, (e.code().0 & 0xFFFF) as i64);
+    let mut serial: u32 = 0;
+    let mut fs_name = [0u16; 64];
+    unsafe {
+        GetVolumeInformationW(
+            root_wpath,
+            None,
+            Some(&mut serial),
+            None,
+            None,
+            Some(&mut fs_name),
+        )
+    }
+    .map_err(winapi_failed)?;
+    let block_size = match cluster_size {
+        Some(cluster_size) => cluster_size,
+        None => {
+            let mut sectors_per_cluster: u32 = 0;
+            let mut bytes_per_sector: u32 = 0;
+            unsafe {
+                GetDiskFreeSpaceW(
+                    root_wpath,
+                    Some(&mut sectors_per_cluster),
+                    Some(&mut bytes_per_sector),
+                    None,
+                    None,
+                )
+            }
+            .map_err(winapi_failed)?;
+            sectors_per_cluster as u64 * bytes_per_sector as u64
+        }
+    };
+    let name_len = fs_name
+        .iter()
+        .position(|&c| c == 0)
+        .unwrap_or(fs_name.len());
+    let details = FsDetails {
+        inodes_total: None,
+        inodes_free: None,
+        block_size,
+        fs_type: String::from_utf16_lossy(&fs_name[..name_len]).into_bytes(),
+        fsid: serial as u64,
+    };
+    Ok((stats, details))
+}
+
+/// Validate the directory at `path_cstr` and return the device it lives on.
+#[cfg(windows)]
+pub fn device_of(path_cstr: &CStr) -> Result<DeviceKey, StatError> {
+    with_long_wpath(path_cstr, |long_wpath| {
+        check_dir_wide(long_wpath)?;
+        volumes::root_of(long_wpath)
+    })
+}
+
+// Query a device by its key; on Windows that is the volume root itself
+#[cfg(windows)]
+fn stat_device(device: &DeviceKey, _path_cstr: &CStr) -> StatResult {
+    let mut root = device.clone();
+    root.push(0);
+    volumes::volume_space(PCWSTR::from_raw(root.as_ptr())).map(|(stats, _)| stats)
+}
+
+// Fail unless `os_path` exists and is a directory
+#[cfg(unix)]
+fn check_dir(os_path: &Path) -> Result<std::fs::Metadata, StatError> {
+    let metadata = match std::fs::metadata(os_path) {
+        Ok(m) => m,
+        Err(e) => {
+            return Err(StatError::os(
+                Reason::NotDirectory,
+                e.raw_os_error().unwrap_or(0) as i64,
+            ))
+        }
+    };
+    if !metadata.is_dir() {
+        return Err(StatError::new(Reason::NotDirectory));
+    }
+    Ok(metadata)
+}
+
+// Without the metadata check, report the errors it would have caught while
+// resolving the path the same way. A regular file still succeeds: the space
+// syscalls accept any path and report the filesystem holding it.
+#[cfg(unix)]
+fn unchecked_error(err: StatError) -> StatError {
+    match err.os_error.map(|code| code as i32) {
+        Some(libc::ENOENT | libc::ENOTDIR | libc::ELOOP | libc::ENAMETOOLONG | libc::EACCES) => {
+            StatError {
+                reason: Reason::NotDirectory,
+                ..err
+            }
+        }
+        _ => err,
+    }
+}
+
+#[cfg(unix)]
+fn os_path(path_cstr: &CStr) -> &Path {
+    Path::new(OsStr::from_bytes(path_cstr.to_bytes()))
+}
+
+/// Like `stat_path`, but with `validate` false, skip the directory check and
+/// classify failures by the errno of the space syscall alone: one path lookup
+/// instead of two, which matters on network filesystems.
+#[cfg(unix)]
+pub fn stat_path_with(path_cstr: &CStr, validate: bool) -> StatResult {
+    let os_path = os_path(path_cstr);
+    if !validate {
+        return statfs_path(os_path).map_err(unchecked_error);
+    }
+    check_dir(os_path)?;
+    statfs_path(os_path)
+}
+
+/// Like `stat_path_with`, and times each syscall.
+#[cfg(unix)]
+pub fn stat_path_timed(path_cstr: &CStr, validate: bool) -> (StatResult, Timing) {
+    let os_path = os_path(path_cstr);
+    let mut timing = Timing::default();
+    if !validate {
+        let result = timed(&mut timing.space, || statfs_path(os_path)).map_err(unchecked_error);
+        return (result, timing);
+    }
+    if let Err(err) = timed(&mut timing.check, || check_dir(os_path)) {
+        return (Err(err), timing);
+    }
+    (timed(&mut timing.space, || statfs_path(os_path)), timing)
+}
+
+/// Like `stat_path_with`, plus the details of the filesystem, from the same
+/// syscall.
+#[cfg(unix)]
+pub fn stat_path_extended(
+    path_cstr: &CStr,
+    validate: bool,
+) -> Result<(FsStats, FsDetails), StatError> {
+    if !validate {
+        return statfs_path_extended(path_cstr).map_err(unchecked_error);
+    }
+    check_dir(os_path(path_cstr))?;
+    statfs_path_extended(path_cstr)
+}
+
+#[cfg(all(unix, target_os = "linux"))]
+fn statfs_path_extended(path_cstr: &CStr) -> Result<(FsStats, FsDetails), StatError> {
+    let buf = statfs(os_path(path_cstr))
+        .map_err(|err| StatError::os(Reason::StatfsFailed, err as i64))?;
+    let details = FsDetails {
+        inodes_total: Some(buf.files() as u64),
+        inodes_free: Some(buf.files_free() as u64),
+        block_size: buf.block_size() as u64,
+        fs_type: linux_fs_type_name(buf.filesystem_type().0 as u64),
+        fsid: fsid_from(buf.filesystem_id()),
+    };
+    Ok((stats_from_statfs(&buf), details))
+}
+
+// statvfs lacks the type name here, but statfs has everything in one call
+#[cfg(all(
+    unix,
+    any(
+        target_os = "macos",
+        target_os = "freebsd",
+        target_os = "openbsd",
+        target_os = "dragonfly"
+    )
+))]
+fn statfs_path_extended(path_cstr: &CStr) -> Result<(FsStats, FsDetails), StatError> {
+    let mut buf: libc::statfs = unsafe { std::mem::zeroed() };
+    if unsafe { libc::statfs(path_cstr.as_ptr(), &mut buf) } != 0 {
+        let errno = std::io::Error::last_os_error().raw_os_error().unwrap_or(0);
+        return Err(StatError::os(Reason::StatfsFailed, errno as i64));
+    }
+    let block_size = buf.f_bsize as u64;
+    // signed on the BSDs, where the reserve can leave them below zero
+    let available = (buf.f_bavail as i64).max(0) as u64;
+    let inodes_free = (buf.f_ffree as i64).max(0) as u64;
+    let stats = FsStats::from_blocks(
+        block_size,
+        available,
+        buf.f_bfree as u64,
+        buf.f_blocks as u64,
+    );
+    let details = FsDetails {
+        inodes_total: Some(buf.f_files as u64),
+        inodes_free: Some(inodes_free),
+        block_size,
+        fs_type: unsafe { CStr::from_ptr(buf.f_fstypename.as_ptr()) }
+            .to_bytes()
+            .to_vec(),
+        fsid: fsid_from(buf.f_fsid),
+    };
+    Ok((stats, details))
+}
+
+// nix does not expose NetBSD's type name, so read the raw struct
+#[cfg(all(unix, target_os = "netbsd"))]
+fn statfs_path_extended(path_cstr: &CStr) -> Result<(FsStats, FsDetails), StatError> {
+    let mut buf: libc::statvfs = unsafe { std::mem::zeroed() };
+    if unsafe { libc::statvfs(path_cstr.as_ptr(), &mut buf) } != 0 {
+        let errno = std::io::Error::last_os_error().raw_os_error().unwrap_or(0);
+        return Err(StatError::os(Reason::StatvfsFailed, errno as i64));
+    }
+    let block_size = buf.f_frsize as u64;
+    let stats = FsStats::from_blocks(
+        block_size,
+        buf.f_bavail as u64,
+        buf.f_bfree as u64,
+        buf.f_blocks as u64,
+    );
+    let details = FsDetails {
+        inodes_total: Some(buf.f_files as u64),
+        inodes_free: Some(buf.f_ffree as u64),
+        block_size,
+        fs_type: unsafe { CStr::from_ptr(buf.f_fstypename.as_ptr()) }
+            .to_bytes()
+            .to_vec(),
+        fsid: buf.f_fsid as u64,
+    };
+    Ok((stats, details))
+}
+
+#[cfg(all(
+    unix,
+    not(any(
+        target_os = "linux",
+        target_os = "macos",
+        target_os = "freebsd",
+        target_os = "openbsd",
+        target_os = "dragonfly",
+        target_os = "netbsd"
+    ))
+))]
+fn statfs_path_extended(path_cstr: &CStr) -> Result<(FsStats, FsDetails), StatError> {
+    let buf = statvfs(os_path(path_cstr))
+        .map_err(|err| StatError::os(Reason::StatvfsFailed, err as i64))?;
+    let details = FsDetails {
+        inodes_total: Some(buf.files() as u64),
+        inodes_free: Some(buf.files_free() as u64),
+        block_size: buf.fragment_size() as u64,
+        fs_type: Vec::new(),
+        fsid: buf.filesystem_id() as u64,
+    };
+    Ok((stats_from_statvfs(&buf), details))
+}
+
+/// Validate the directory at `path_cstr` and return the device it lives on.
+#[cfg(unix)]
+pub fn device_of(path_cstr: &CStr) -> Result<DeviceKey, StatError> {
+    Ok(check_dir(os_path(path_cstr))?.dev())
+}
+
+// Query a device through any path that lives on it
+#[cfg(unix)]
+fn stat_device(_device: &DeviceKey, path_cstr: &CStr) -> StatResult {
+    statfs_path(os_path(path_cstr))
+}
+
+#[cfg(all(unix, target_os = "linux"))]
+pub(crate) fn stats_from_statfs(statfs_buf: &Statfs) -> FsStats {
+    FsStats::from_blocks(
+        statfs_buf.block_size() as u64,
+        statfs_buf.blocks_available() as u64,
+        statfs_buf.blocks_free() as u64,
+        statfs_buf.blocks() as u64,
+    )
+}
+
+#[cfg(all(unix, not(target_os = "linux")))]
+pub(crate) fn stats_from_statvfs(statvfs_buf: &Statvfs) -> FsStats {
+    FsStats::from_blocks(
+        statvfs_buf.fragment_size() as u64,
+        statvfs_buf.blocks_available() as u64,
+        statvfs_buf.blocks_free() as u64,
+        statvfs_buf.blocks() as u64,
+    )
+}
+
+#[cfg(all(unix, target_os = "linux"))]
+pub(crate) fn statfs_path(os_path: &Path) -> StatResult {
+    match statfs(os_path) {
+        Ok(buf) => Ok(stats_from_statfs(&buf)),
+        Err(err) => Err(StatError::os(Reason::StatfsFailed, err as i64)),
+    }
+}
+
+#[cfg(all(unix, not(target_os = "linux")))]
+pub(crate) fn statfs_path(os_path: &Path) -> StatResult {
+    match statvfs(os_path) {
+        Ok(buf) => Ok(stats_from_statvfs(&buf)),
+        Err(err) => Err(StatError::os(Reason::StatvfsFailed, err as i64)),
+    }
+}
+
+/// Query every path, but issue the space syscall only once per device and fan
+/// the result out to all paths on it. `None` entries are paths that could not
+/// be decoded. Results keep input order; groups are in order of first sighting.
+pub fn stat_many_by_device(paths: &[Option<CString>]) -> (Vec<StatResult>, Vec<DeviceGroup>) {
+    let mut results: Vec<StatResult> = Vec::with_capacity(paths.len());
+    let mut groups: Vec<DeviceGroup> = Vec::new();
+    let mut group_index: HashMap<DeviceKey, usize> = HashMap::new();
+    for (index, path) in paths.iter().enumerate() {
+        let device = match path {
+            Some(path_cstr) => device_of(path_cstr),
+            None => Err(StatError::new(Reason::InvalidPath)),
+        };
+        match device {
+            Ok(device) => {
+                // placeholder, overwritten once the group has been queried
+                results.push(Ok(FsStats::default()));
+                match group_index.get(&device) {
+                    Some(&g) => groups[g].members.push(index),
+                    None => {
+                        group_index.insert(device.clone(), groups.len());
+                        groups.push(DeviceGroup {
+                            device,
+                            members: vec![index],
+                        });
+                    }
+                }
+            }
+            Err(err) => results.push(Err(err)),
+        }
+    }
+    for group in &groups {
+        let first = group.members[0];
+        let path_cstr = paths[first].as_ref().expect("grouped paths were decoded");
+        let result = stat_device(&group.device, path_cstr);
+        for &member in &group.members {
+            results[member] = result;
+        }
+    }
+    (results, groups)
+}
@@ -0,0 +1,320 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! A minimal io_uring ring for batched `statx`, used by the usage walker on
+//! Linux to query a whole directory's entries with one syscall instead of one
+//! `fstatat` per entry.
+//!
+//! Only what the walker needs is implemented: setting up a ring with raw
+//! syscalls, filling `IORING_OP_STATX` submissions and waiting for all of them
+//! to complete. `Ring::new` fails when the kernel is too old or io_uring is
+//! blocked (e.g. by seccomp or `kernel.io_uring_disabled`), and callers fall
+//! back to `fstatat`.
+
+use std::ffi::CStr;
+use std::io;
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
+use std::ptr;
+use std::sync::atomic::{AtomicU32, Ordering};
+
+const IORING_OP_STATX: u8 = 21;
+const IORING_ENTER_GETEVENTS: u32 = 1;
+const IORING_FEAT_SINGLE_MMAP: u32 = 1;
+const IORING_OFF_SQ_RING: i64 = 0;
+const IORING_OFF_CQ_RING: i64 = 0x8000000;
+const IORING_OFF_SQES: i64 = 0x10000000;
+
+// STATX_TYPE | STATX_NLINK | STATX_INO | STATX_SIZE | STATX_BLOCKS: the fields
+// the walker reads
+const STATX_MASK: u32 = 0x0001 | 0x0004 | 0x0100 | 0x0200 | 0x0400;
+
+/// `struct statx`, declared here (like the constants above) because not every
+/// libc target exports it.
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct Statx {
+    pub mask: u32,
+    blksize: u32,
+    attributes: u64,
+    pub nlink: u32,
+    uid: u32,
+    gid: u32,
+    pub mode: u16,
+    pad1: u16,
+    pub ino: u64,
+    pub size: u64,
+    pub blocks: u64,
+    attributes_mask: u64,
+    // atime, btime, ctime, mtime: { i64 sec, u32 nsec, i32 pad } each
+    timestamps: [[u64; 2]; 4],
+    rdev_major: u32,
+    rdev_minor: u32,
+    pub dev_major: u32,
+    pub dev_minor: u32,
+    spare: [u64; 14],
+}
+
+impl Default for Statx {
+    fn default() -> Statx {
+        // all fields are plain integers
+        unsafe { std::mem::zeroed() }
+    }
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct SqRingOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    flags: u32,
+    dropped: u32,
+    array: u32,
+    resv1: u32,
+    user_addr: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct CqRingOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    overflow: u32,
+    cqes: u32,
+    flags: u32,
+    resv1: u32,
+    user_addr: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct Params {
+    sq_entries: u32,
+    cq_entries: u32,
+    flags: u32,
+    sq_thread_cpu: u32,
+    sq_thread_idle: u32,
+    features: u32,
+    wq_fd: u32,
+    resv: [u32; 3],
+    sq_off: SqRingOffsets,
+    cq_off: CqRingOffsets,
+}
+
+#[repr(C)]
+struct Sqe {
+    opcode: u8,
+    flags: u8,
+    ioprio: u16,
+    fd: i32,
+    // the statx buffer for IORING_OP_STATX
+    off: u64,
+    // the path for IORING_OP_STATX
+    addr: u64,
+    // the statx mask for IORING_OP_STATX
+    len: u32,
+    op_flags: u32,
+    user_data: u64,
+    buf_index: u16,
+    personality: u16,
+    splice_fd_in: i32,
+    addr3: u64,
+    pad: u64,
+}
+
+#[repr(C)]
+struct Cqe {
+    user_data: u64,
+    res: i32,
+    flags: u32,
+}
+
+struct Mapping {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Mapping {
+    fn new(fd: RawFd, len: usize, offset: i64) -> io::Result<Mapping> {
+        let ptr = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                len,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED | libc::MAP_POPULATE,
+                fd,
+                offset,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(Mapping { ptr, len })
+    }
+
+    fn at<T>(&self, offset: u32) -> *mut T {
+        unsafe { (self.ptr as *mut u8).add(offset as usize) as *mut T }
+    }
+}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        unsafe { libc::munmap(self.ptr, self.len) };
+    }
+}
+
+/// One ring, owned and used by a single walker thread. If `statx_batch`
+/// fails, the ring must be dropped: closing it cancels what is in flight.
+pub struct Ring {
+    // fields drop in order: close the ring before unmapping or freeing
+    // anything the kernel may still write to
+    fd: OwnedFd,
+    sq: Mapping,
+    cq: Option<Mapping>,
+    sqes: Mapping,
+    params: Params,
+    buffers: Vec<Statx>,
+}
+
+// The mappings are only ever touched by the thread that owns the ring
+unsafe impl Send for Ring {}
+
+impl Ring {
+    pub fn new(entries: u32) -> io::Result<Ring> {
+        let mut params = Params::default();
+        let fd = unsafe {
+            libc::syscall(
+                libc::SYS_io_uring_setup,
+                entries,
+                &mut params as *mut Params,
+            )
+        };
+        if fd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let fd = unsafe { OwnedFd::from_raw_fd(fd as RawFd) };
+        let sq_len = params.sq_off.array as usize + params.sq_entries as usize * 4;
+        let cq_len =
+            params.cq_off.cqes as usize + params.cq_entries as usize * std::mem::size_of::<Cqe>();
+        let single = params.features & IORING_FEAT_SINGLE_MMAP != 0;
+        let sq_map_len = if single { sq_len.max(cq_len) } else { sq_len };
+        let sq = Mapping::new(fd.as_raw_fd(), sq_map_len, IORING_OFF_SQ_RING)?;
+        let cq = if single {
+            None
+        } else {
+            Some(Mapping::new(fd.as_raw_fd(), cq_len, IORING_OFF_CQ_RING)?)
+        };
+        let sqes = Mapping::new(
+            fd.as_raw_fd(),
+            params.sq_entries as usize * std::mem::size_of::<Sqe>(),
+            IORING_OFF_SQES,
+        )?;
+        let buffers = vec![Statx::default(); params.sq_entries as usize];
+        Ok(Ring {
+            fd,
+            sq,
+            cq,
+            sqes,
+            params,
+            buffers,
+        })
+    }
+
+    /// How many submissions fit in one batch.
+    pub fn capacity(&self) -> usize {
+        self.params.sq_entries as usize
+    }
+
+    /// `statx(dirfd, names[i], AT_SYMLINK_NOFOLLOW, STATX_MASK, &mut out[i])`
+    /// for every `i`, in one submission. `out[i]` is `Err(errno)` for entries
+    /// that failed. At most `capacity()` names may be passed.
+    pub fn statx_batch(
+        &mut self,
+        dirfd: RawFd,
+        names: &[&CStr],
+        out: &mut [Result<Statx, i32>],
+    ) -> io::Result<()> {
+        debug_assert!(names.len() <= self.capacity() && out.len() >= names.len());
+        let off = &self.params.sq_off;
+        let sq_tail = unsafe { &*self.sq.at::<AtomicU32>(off.tail) };
+        let sq_mask = unsafe { *self.sq.at::<u32>(off.ring_mask) };
+        let array = self.sq.at::<u32>(off.array);
+        let sqes = self.sqes.ptr as *mut Sqe;
+        let mut tail = sq_tail.load(Ordering::Relaxed);
+        for (i, name) in names.iter().enumerate() {
+            let index = tail & sq_mask;
+            unsafe {
+                sqes.add(index as usize).write(Sqe {
+                    opcode: IORING_OP_STATX,
+                    flags: 0,
+                    ioprio: 0,
+                    fd: dirfd,
+                    off: self.buffers.as_mut_ptr().add(i) as u64,
+                    addr: name.as_ptr() as u64,
+                    len: STATX_MASK,
+                    op_flags: libc::AT_SYMLINK_NOFOLLOW as u32,
+                    user_data: i as u64,
+                    buf_index: 0,
+                    personality: 0,
+                    splice_fd_in: 0,
+                    addr3: 0,
+                    pad: 0,
+                });
+                *array.add(index as usize) = index;
+            }
+            tail = tail.wrapping_add(1);
+        }
+        sq_tail.store(tail, Ordering::Release);
+
+        let cq = self.cq.as_ref().unwrap_or(&self.sq);
+        let coff = &self.params.cq_off;
+        let cq_head = unsafe { &*cq.at::<AtomicU32>(coff.head) };
+        let cq_tail = unsafe { &*cq.at::<AtomicU32>(coff.tail) };
+        let cq_mask = unsafe { *cq.at::<u32>(coff.ring_mask) };
+        let cqes = cq.at::<Cqe>(coff.cqes);
+        let mut to_submit = names.len() as u32;
+        let mut remaining = names.len();
+        while remaining > 0 {
+            let entered = unsafe {
+                libc::syscall(
+                    libc::SYS_io_uring_enter,
+                    self.fd.as_raw_fd(),
+                    to_submit,
+                    1u32,
+                    IORING_ENTER_GETEVENTS,
+                    ptr::null::<libc::c_void>(),
+                    0usize,
+                )
+            };
+            if entered < 0 {
+                let err = io::Error::last_os_error();
+                if err.kind() == io::ErrorKind::Interrupted {
+                    continue;
+                }
+                // submitted statx calls may still complete into the buffers,
+                // even after the ring is closed: leak them
+                std::mem::forget(std::mem::take(&mut self.buffers));
+                return Err(err);
+            }
+            to_submit -= (entered as u32).min(to_submit);
+            let mut head = cq_head.load(Ordering::Relaxed);
+            let tail = cq_tail.load(Ordering::Acquire);
+            while head != tail {
+                let cqe = unsafe { &*cqes.add((head & cq_mask) as usize) };
+                let i = cqe.user_data as usize;
+                out[i] = if cqe.res < 0 {
+                    Err(-cqe.res)
+                } else {
+                    Ok(self.buffers[i])
+                };
+                head = head.wrapping_add(1);
+                remaining -= 1;
+            }
+            cq_head.store(head, Ordering::Release);
+        }
+        Ok(())
+    }
+}
@@ -0,0 +1,1052 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! A parallel `du`: walks a directory tree on several threads and sums up the
+//! apparent and allocated sizes of everything below it, counting hard-linked
+//! files only once.
+//!
+//! Every directory is one task. Each worker keeps its own deque, pushes the
+//! subdirectories it finds to the back and pops from the back (depth-first,
+//! which keeps the number of open parent descriptors low); idle workers steal
+//! from the front of the others' deques. The walk is over once no task is
+//! queued or running. Workers sum into their own `Usage`, merged at the end;
+//! after each directory they also add their progress to shared counters that
+//! an optional reporter thread samples, and they check the cancel flag before
+//! each task and between entries.
+//!
+//! On Unix, directories are opened with `openat` relative to their parent's
+//! descriptor, read with `readdir` (batched `getdents64` on Linux) and their
+//! entries queried with `fstatat`, so paths are never resolved from the root
+//! again. On Windows, `FindFirstFileExW` with `FIND_FIRST_EX_LARGE_FETCH`
+//! returns the sizes along with the names; allocated sizes are rounded up to
+//! the volume's cluster size, hard links are not detected and reparse points
+//! (symlinks, junctions, mounted folders) are not followed.
+//!
+//! With an index (Unix only, see `index.rs`), every directory is also
+//! `fstat`ed once it is opened and counts itself instead of being counted by
+//! its parent; directories whose record is still valid are not listed, and
+//! all records are written to a new index once the walk has finished.
+//!
+//! To rank the largest files and directories, workers keep bounded min-heaps
+//! merged at the end. A directory's recursive size is known once its own
+//! listing and all its subdirectories are done: each queued directory holds
+//! a `Node` that counts what is still open below it, and whichever worker
+//! closes the last one adds the total to the parent, so only the directories
+//! on the way from the root to queued work are kept in memory.
+
+#[cfg(unix)]
+use crate::index::{self, Cached, Index, Link, Record, Stamp, Totals};
+#[cfg(windows)]
+use crate::stat::long_wide_path;
+use crate::stat::{Reason, StatError};
+#[cfg(target_os = "linux")]
+use crate::uring::{Ring, Statx};
+#[cfg(unix)]
+use nix::dir::Dir;
+#[cfg(unix)]
+use nix::fcntl::{openat, AtFlags, OFlag};
+#[cfg(unix)]
+use nix::sys::stat::{fstat, fstatat, FileStat, Mode, SFlag};
+use std::cmp::Reverse;
+use std::collections::{BinaryHeap, HashSet, VecDeque};
+use std::ffi::CStr;
+#[cfg(unix)]
+use std::ffi::CString;
+#[cfg(target_os = "linux")]
+use std::os::fd::AsRawFd;
+#[cfg(unix)]
+use std::os::fd::OwnedFd;
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex, MutexGuard};
+use std::thread;
+use std::time::Duration;
+#[cfg(windows)]
+use windows::core::PCWSTR;
+#[cfg(windows)]
+use windows::Win32::Storage::FileSystem::{
+    FindClose, FindExInfoBasic, FindExSearchNameMatch, FindFirstFileExW, FindNextFileW,
+    GetDiskFreeSpaceW, FILE_ATTRIBUTE_DIRECTORY, FILE_ATTRIBUTE_REPARSE_POINT,
+    FIND_FIRST_EX_LARGE_FETCH, WIN32_FIND_DATAW,
+};
+
+/// Totals for a scanned tree, in bytes and entries.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct Usage {
+    pub apparent: u64,
+    pub allocated: u64,
+    pub files: u64,
+    pub dirs: u64,
+    // entries that could not be read or queried
+    pub errors: u64,
+}
+
+impl Usage {
+    fn add(&mut self, other: &Usage) {
+        self.apparent += other.apparent;
+        self.allocated += other.allocated;
+        self.files += other.files;
+        self.dirs += other.dirs;
+        self.errors += other.errors;
+    }
+}
+
+/// Running totals, as reported while a walk is in progress.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct Progress {
+    pub files: u64,
+    pub apparent: u64,
+    pub dirs: u64,
+}
+
+/// A callback invoked every `interval` from a reporter thread.
+pub struct Reporter<'a> {
+    pub interval: Duration,
+    pub report: &'a (dyn Fn(Progress) + Sync),
+}
+
+pub struct Options<'a> {
+    pub threads: usize,
+    // do not descend into directories on other devices, like `du -x`
+    pub one_file_system: bool,
+    // once set, workers stop and the walk fails with `Reason::Cancelled`
+    pub cancel: Option<&'a AtomicBool>,
+    pub reporter: Option<Reporter<'a>>,
+    // batch each directory's `statx` calls through io_uring (Linux only)
+    pub io_uring: bool,
+    // reuse and rewrite the index at this path (Unix only)
+    pub index: Option<&'a CStr>,
+    // rank the largest files and directories
+    pub top: Option<Top>,
+}
+
+/// Which size to rank entries by.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Rank {
+    Apparent,
+    Allocated,
+}
+
+/// How many of the largest files and directories to keep.
+#[derive(Clone, Copy, Debug)]
+pub struct Top {
+    pub count: usize,
+    pub by: Rank,
+}
+
+/// A file or directory and its size, as ranked. Paths are raw bytes on Unix
+/// and UTF-8 on Windows, starting with the root as given.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Ranked {
+    pub path: Vec<u8>,
+    pub size: u64,
+}
+
+/// What a walk returns: the totals, plus the rankings if requested.
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct Report {
+    pub usage: Usage,
+    pub largest: Option<Largest>,
+}
+
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct Largest {
+    // largest first
+    pub files: Vec<Ranked>,
+    pub dirs: Vec<Ranked>,
+}
+
+/// The `count` largest entries offered so far.
+struct TopK {
+    count: usize,
+    heap: BinaryHeap<Reverse<(u64, Vec<u8>)>>,
+}
+
+impl TopK {
+    fn new(count: usize) -> TopK {
+        TopK {
+            count,
+            heap: BinaryHeap::with_capacity(count.min(1024) + 1),
+        }
+    }
+
+    // `path` is only built for entries that make it into the heap
+    fn offer<F: FnOnce() -> Vec<u8>>(&mut self, size: u64, path: F) {
+        if self.heap.len() >= self.count {
+            match self.heap.peek() {
+                Some(Reverse((smallest, _))) if size > *smallest => {}
+                _ => return,
+            }
+        }
+        self.heap.push(Reverse((size, path())));
+        if self.heap.len() > self.count {
+            self.heap.pop();
+        }
+    }
+
+    fn merge(&mut self, other: &mut TopK) {
+        for Reverse((size, path)) in std::mem::take(&mut other.heap) {
+            self.offer(size, || path);
+        }
+    }
+
+    fn into_ranked(self) -> Vec<Ranked> {
+        let mut entries: Vec<Ranked> = self
+            .heap
+            .into_iter()
+            .map(|Reverse((size, path))| Ranked { path, size })
+            .collect();
+        entries.sort_unstable_by(|a, b| b.size.cmp(&a.size).then_with(|| a.path.cmp(&b.path)));
+        entries
+    }
+}
+
+/// A directory whose recursive size is still being summed up.
+struct Node {
+    parent: Option<Arc<Node>>,
+    path: Vec<u8>,
+    size: AtomicU64,
+    // its own listing plus its subdirectories that are not closed yet
+    open: AtomicUsize,
+}
+
+impl Node {
+    fn new(parent: Option<Arc<Node>>, path: Vec<u8>, size: u64) -> Arc<Node> {
+        if let Some(parent) = &parent {
+            parent.open.fetch_add(1, Ordering::AcqRel);
+        }
+        Arc::new(Node {
+            parent,
+            path,
+            size: AtomicU64::new(size),
+            open: AtomicUsize::new(1),
+        })
+    }
+
+    fn child(self: &Arc<Node>, name: &[u8]) -> Arc<Node> {
+        Node::new(Some(self.clone()), join(&self.path, name), 0)
+    }
+}
+
+#[cfg(unix)]
+const SEPARATOR: u8 = b'/';
+#[cfg(windows)]
+const SEPARATOR: u8 = b'\\';
+
+fn join(dir: &[u8], name: &[u8]) -> Vec<u8> {
+    let mut path = Vec::with_capacity(dir.len() + 1 + name.len());
+    path.extend_from_slice(dir);
+    if path.last() != Some(&SEPARATOR) {
+        path.push(SEPARATOR);
+    }
+    path.extend_from_slice(name);
+    path
+}
+
+/// What the walker needs to know about an entry.
+#[cfg(unix)]
+struct Entry {
+    is_dir: bool,
+    size: u64,
+    blocks: u64,
+    nlink: u64,
+    dev: u64,
+    ino: u64,
+}
+
+#[cfg(unix)]
+impl From<&FileStat> for Entry {
+    fn from(stat: &FileStat) -> Entry {
+        Entry {
+            is_dir: SFlag::from_bits_truncate(stat.st_mode) & SFlag::S_IFMT == SFlag::S_IFDIR,
+            size: stat.st_size as u64,
+            blocks: stat.st_blocks as u64,
+            nlink: stat.st_nlink as u64,
+            dev: stat.st_dev as u64,
+            ino: stat.st_ino as u64,
+        }
+    }
+}
+
+#[cfg(target_os = "linux")]
+impl From<&Statx> for Entry {
+    fn from(statx: &Statx) -> Entry {
+        Entry {
+            is_dir: statx.mode as u32 & libc::S_IFMT == libc::S_IFDIR,
+            size: statx.size,
+            blocks: statx.blocks,
+            nlink: statx.nlink as u64,
+            dev: libc::makedev(statx.dev_major, statx.dev_minor) as u64,
+            ino: statx.ino,
+        }
+    }
+}
+
+/// What the walker gathers while listing one directory.
+#[cfg(unix)]
+struct Listing {
+    fd: Arc<OwnedFd>,
+    node: Option<Arc<Node>>,
+    // entries that an index record can stand in for
+    usage: Usage,
+    // hard-linked files counted here for the first time
+    linked: Usage,
+    // when indexing and the directory has settled
+    record: Option<Record>,
+}
+
+#[cfg(unix)]
+impl Listing {
+    fn totals(&self) -> Totals {
+        Totals {
+            apparent: self.usage.apparent,
+            allocated: self.usage.allocated,
+            files: self.usage.files,
+            dirs: self.usage.dirs,
+        }
+    }
+}
+
+/// Names collected for one io_uring submission, stored back to back with
+/// their terminators to avoid one allocation per entry.
+#[cfg(target_os = "linux")]
+struct Batch {
+    bytes: Vec<u8>,
+    ends: Vec<usize>,
+    capacity: usize,
+}
+
+#[cfg(target_os = "linux")]
+impl Batch {
+    fn push(&mut self, name: &CStr) {
+        self.bytes.extend_from_slice(name.to_bytes_with_nul());
+        self.ends.push(self.bytes.len());
+    }
+
+    fn len(&self) -> usize {
+        self.ends.len()
+    }
+
+    fn is_empty(&self) -> bool {
+        self.ends.is_empty()
+    }
+
+    fn names(&self) -> Vec<&CStr> {
+        let mut start = 0;
+        self.ends
+            .iter()
+            .map(|&end| {
+                let name = CStr::from_bytes_with_nul(&self.bytes[start..end]).expect("terminated");
+                start = end;
+                name
+            })
+            .collect()
+    }
+
+    fn clear(&mut self) {
+        self.bytes.clear();
+        self.ends.clear();
+    }
+}
+
+/// Per-worker state kept for the whole walk.
+struct Scratch {
+    #[cfg(target_os = "linux")]
+    ring: Option<Ring>,
+    #[cfg(target_os = "linux")]
+    batch: Batch,
+    #[cfg(unix)]
+    records: Vec<Record>,
+    files: TopK,
+    dirs: TopK,
+}
+
+impl Scratch {
+    #[cfg(target_os = "linux")]
+    fn new(io_uring: bool, top: usize) -> Scratch {
+        let ring = if io_uring {
+            Ring::new(RING_ENTRIES).ok()
+        } else {
+            None
+        };
+        let capacity = ring.as_ref().map_or(0, Ring::capacity);
+        Scratch {
+            ring,
+            batch: Batch {
+                bytes: Vec::new(),
+                ends: Vec::with_capacity(capacity),
+                capacity,
+            },
+            records: Vec::new(),
+            files: TopK::new(top),
+            dirs: TopK::new(top),
+        }
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    fn new(_io_uring: bool, top: usize) -> Scratch {
+        Scratch {
+            #[cfg(unix)]
+            records: Vec::new(),
+            files: TopK::new(top),
+            dirs: TopK::new(top),
+        }
+    }
+}
+
+#[cfg(target_os = "linux")]
+const RING_ENTRIES: u32 = 256;
+
+const LINK_SHARDS: usize = 64;
+
+/// A directory still to be listed: the already opened root, or an entry of
+/// a listed directory, opened relative to it.
+#[cfg(unix)]
+enum Task {
+    Root(OwnedFd),
+    At { parent: Arc<OwnedFd>, name: CString },
+}
+
+/// A directory still to be listed, as a `\\?\` path without terminator.
+#[cfg(windows)]
+struct Task {
+    path: Vec<u16>,
+}
+
+/// A task and, when ranking directories, the node it adds its size to.
+struct Queued {
+    task: Task,
+    node: Option<Arc<Node>>,
+}
+
+struct Walker<'a> {
+    deques: Vec<Mutex<VecDeque<Queued>>>,
+    // tasks queued or running; the walk is done when this drops to zero
+    pending: AtomicUsize,
+    // (device, inode) of files with more than one link, sharded by inode
+    links: Vec<Mutex<HashSet<(u64, u64)>>>,
+    one_file_system: bool,
+    cancel: Option<&'a AtomicBool>,
+    io_uring: bool,
+    top: Option<Top>,
+    // the workers' rankings, merged as they finish
+    largest: Mutex<(TopK, TopK)>,
+    // shared running totals: files, apparent size, dirs
+    progress: [AtomicU64; 3],
+    #[cfg(unix)]
+    root_dev: u64,
+    // the previous index, and the records for the next one
+    #[cfg(unix)]
+    index: Option<Index>,
+    #[cfg(unix)]
+    records: Mutex<Vec<Record>>,
+    // directories changed since then are not recorded
+    #[cfg(unix)]
+    cutoff: i64,
+    #[cfg(windows)]
+    cluster_size: u64,
+}
+
+fn lock<T>(mutex: &Mutex<T>) -> MutexGuard<'_, T> {
+    mutex.lock().unwrap_or_else(|e| e.into_inner())
+}
+
+impl<'a> Walker<'a> {
+    fn new(options: &Options<'a>, threads: usize) -> Walker<'a> {
+        let top = options.top.map_or(0, |top| top.count);
+        Walker {
+            deques: (0..threads).map(|_| Mutex::new(VecDeque::new())).collect(),
+            pending: AtomicUsize::new(0),
+            links: (0..LINK_SHARDS)
+                .map(|_| Mutex::new(HashSet::new()))
+                .collect(),
+            one_file_system: options.one_file_system,
+            cancel: options.cancel,
+            io_uring: options.io_uring,
+            top: options.top,
+            largest: Mutex::new((TopK::new(top), TopK::new(top))),
+            progress: Default::default(),
+            #[cfg(unix)]
+            root_dev: 0,
+            #[cfg(unix)]
+            index: options
+                .index
+                .map(|path| Index::open(path, options.one_file_system)),
+            #[cfg(unix)]
+            records: Mutex::new(Vec::new()),
+            #[cfg(unix)]
+            cutoff: index::cutoff(),
+            #[cfg(windows)]
+            cluster_size: 1,
+        }
+    }
+
+    fn push(&self, worker: usize, task: Task, node: Option<Arc<Node>>) {
+        self.pending.fetch_add(1, Ordering::AcqRel);
+        lock(&self.deques[worker]).push_back(Queued { task, node });
+    }
+
+    // Own deque from the back, then the others' from the front
+    fn next(&self, worker: usize) -> Option<Queued> {
+        if let Some(task) = lock(&self.deques[worker]).pop_back() {
+            return Some(task);
+        }
+        let count = self.deques.len();
+        (1..count).find_map(|offset| lock(&self.deques[(worker + offset) % count]).pop_front())
+    }
+
+    // Returns `false` for a hard link to a file that was already counted
+    #[cfg(unix)]
+    fn first_link(&self, dev: u64, ino: u64) -> bool {
+        lock(&self.links[(ino as usize) % LINK_SHARDS]).insert((dev, ino))
+    }
+
+    fn cancelled(&self) -> bool {
+        self.cancel.is_some_and(|c| c.load(Ordering::Relaxed))
+    }
+
+    // Publish what this worker counted since its last flush
+    fn flush(&self, usage: &Usage, flushed: &mut Usage) {
+        self.progress[0].fetch_add(usage.files - flushed.files, Ordering::Relaxed);
+        self.progress[1].fetch_add(usage.apparent - flushed.apparent, Ordering::Relaxed);
+        self.progress[2].fetch_add(usage.dirs - flushed.dirs, Ordering::Relaxed);
+        *flushed = *usage;
+    }
+
+    fn snapshot(&self) -> Progress {
+        Progress {
+            files: self.progress[0].load(Ordering::Relaxed),
+            apparent: self.progress[1].load(Ordering::Relaxed),
+            dirs: self.progress[2].load(Ordering::Relaxed),
+        }
+    }
+
+    // The size entries are ranked by
+    fn ranked_size(&self, apparent: u64, allocated: u64) -> u64 {
+        match self.top.map(|top| top.by) {
+            Some(Rank::Allocated) => allocated,
+            _ => apparent,
+        }
+    }
+
+    // Add `size` to `node`; if that was the last open part of it, rank it and
+    // add its total to its parent, and so on up the tree
+    fn close(&self, node: Arc<Node>, size: u64, dirs: &mut TopK) {
+        let mut node = node;
+        let mut size = size;
+        loop {
+            node.size.fetch_add(size, Ordering::AcqRel);
+            if node.open.fetch_sub(1, Ordering::AcqRel) != 1 {
+                return;
+            }
+            let total = node.size.load(Ordering::Acquire);
+            dirs.offer(total, || node.path.clone());
+            match node.parent.clone() {
+                Some(parent) => {
+                    node = parent;
+                    size = total;
+                }
+                None => return,
+            }
+        }
+    }
+
+    fn work(&self, worker: usize) -> Usage {
+        let top = self.top.map_or(0, |top| top.count);
+        let mut scratch = Scratch::new(self.io_uring, top);
+        let mut usage = Usage::default();
+        let mut flushed = Usage::default();
+        let mut idle_rounds: u32 = 0;
+        loop {
+            if self.cancelled() {
+                return usage;
+            }
+            match self.next(worker) {
+                Some(Queued { task, node }) => {
+                    idle_rounds = 0;
+                    let before = self.ranked_size(usage.apparent, usage.allocated);
+                    self.scan(worker, task, node.as_ref(), &mut usage, &mut scratch);
+                    if let Some(node) = node {
+                        let after = self.ranked_size(usage.apparent, usage.allocated);
+                        self.close(node, after - before, &mut scratch.dirs);
+                    }
+                    self.flush(&usage, &mut flushed);
+                    self.pending.fetch_sub(1, Ordering::AcqRel);
+                }
+                None if self.pending.load(Ordering::Acquire) == 0 => {
+                    #[cfg(unix)]
+                    lock(&self.records).append(&mut scratch.records);
+                    if self.top.is_some() {
+                        let mut largest = lock(&self.largest);
+                        largest.0.merge(&mut scratch.files);
+                        largest.1.merge(&mut scratch.dirs);
+                    }
+                    return usage;
+                }
+                None => {
+                    // others are still listing and may push more work
+                    idle_rounds += 1;
+                    if idle_rounds < 64 {
+                        thread::yield_now();
+                    } else {
+                        thread::sleep(Duration::from_micros(200));
+                    }
+                }
+            }
+        }
+    }
+
+    #[cfg(unix)]
+    fn count(&self, entry: &Entry, usage: &mut Usage) {
+        usage.apparent += entry.size;
+        usage.allocated += entry.blocks * 512;
+    }
+
+    // Directories count themselves once opened (with their own `fstat`) when
+    // an index records or a ranking needs what each one holds
+    #[cfg(unix)]
+    fn self_counting(&self) -> bool {
+        self.index.is_some() || self.top.is_some()
+    }
+
+    #[cfg(unix)]
+    fn visit(
+        &self,
+        worker: usize,
+        listing: &mut Listing,
+        name: &CStr,
+        entry: Entry,
+        files: &mut TopK,
+    ) {
+        if entry.is_dir {
+            let descend = !self.one_file_system || entry.dev == self.root_dev;
+            if descend {
+                let task = Task::At {
+                    parent: listing.fd.clone(),
+                    name: name.to_owned(),
+                };
+                let node = listing
+                    .node
+                    .as_ref()
+                    .map(|node| node.child(name.to_bytes()));
+                self.push(worker, task, node);
+                if let Some(record) = &mut listing.record {
+                    record.push_subdir(name);
+                }
+            }
+            if !descend || !self.self_counting() {
+                listing.usage.dirs += 1;
+                self.count(&entry, &mut listing.usage);
+            }
+            return;
+        }
+        let counted = if entry.nlink <= 1 {
+            listing.usage.files += 1;
+            self.count(&entry, &mut listing.usage);
+            true
+        } else {
+            if let Some(record) = &mut listing.record {
+                record.push_link(&Link {
+                    dev: entry.dev,
+                    ino: entry.ino,
+                    size: entry.size,
+                    blocks: entry.blocks,
+                });
+            }
+            let first = self.first_link(entry.dev, entry.ino);
+            if first {
+                listing.linked.files += 1;
+                self.count(&entry, &mut listing.linked);
+            }
+            first
+        };
+        if let (true, Some(node)) = (counted, &listing.node) {
+            let size = self.ranked_size(entry.size, entry.blocks * 512);
+            files.offer(size, || join(&node.path, name.to_bytes()));
+        }
+    }
+
+    // Count a directory from its index record instead of listing it
+    #[cfg(unix)]
+    fn reuse(
+        &self,
+        worker: usize,
+        fd: &Arc<OwnedFd>,
+        stamp: Stamp,
+        cached: Cached<'_>,
+        usage: &mut Usage,
+        scratch: &mut Scratch,
+    ) {
+        usage.apparent += cached.totals.apparent;
+        usage.allocated += cached.totals.allocated;
+        usage.files += cached.totals.files;
+        usage.dirs += cached.totals.dirs;
+        for link in cached.links() {
+            if self.first_link(link.dev, link.ino) {
+                usage.files += 1;
+                usage.apparent += link.size;
+                usage.allocated += link.blocks * 512;
+            }
+        }
+        for name in cached.subdirs() {
+            // checked by the lookup: not empty, no NUL
+            let name = CString::new(name).expect("valid name");
+            let task = Task::At {
+                parent: fd.clone(),
+                name,
+            };
+            // rankings list every directory, so no node is needed here
+            self.push(worker, task, None);
+        }
+        scratch.records.push(cached.to_record(stamp));
+    }
+
+    #[cfg(unix)]
+    fn stat_at(&self, fd: &OwnedFd, name: &CStr) -> Option<Entry> {
+        fstatat(fd, name, AtFlags::AT_SYMLINK_NOFOLLOW)
+            .ok()
+            .map(|stat| Entry::from(&stat))
+    }
+
+    #[cfg(unix)]
+    fn scan(
+        &self,
+        worker: usize,
+        task: Task,
+        node: Option<&Arc<Node>>,
+        usage: &mut Usage,
+        scratch: &mut Scratch,
+    ) {
+        let is_root = matches!(task, Task::Root(_));
+        let fd = match task {
+            Task::Root(fd) => Arc::new(fd),
+            Task::At { parent, name } => {
+                let flags =
+                    OFlag::O_RDONLY | OFlag::O_DIRECTORY | OFlag::O_NOFOLLOW | OFlag::O_CLOEXEC;
+                match openat(&*parent, name.as_c_str(), flags, Mode::empty()) {
+                    Ok(fd) => Arc::new(fd),
+                    Err(_) => {
+                        usage.errors += 1;
+                        return;
+                    }
+                }
+            }
+        };
+        let mut listing = Listing {
+            fd,
+            node: node.cloned(),
+            usage: Usage::default(),
+            linked: Usage::default(),
+            record: None,
+        };
+        if self.self_counting() {
+            let stat = match fstat(&*listing.fd) {
+                Ok(stat) => stat,
+                Err(_) => {
+                    usage.errors += 1;
+                    return;
+                }
+            };
+            if !is_root {
+                usage.dirs += 1;
+                self.count(&Entry::from(&stat), usage);
+            }
+            if let Some(index) = &self.index {
+                let stamp = Stamp::from(&stat);
+                // a ranking needs every file, so nothing is reused for it
+                let cached = self.top.is_none().then(|| index.lookup(&stamp)).flatten();
+                if let Some(cached) = cached {
+                    self.reuse(worker, &listing.fd, stamp, cached, usage, scratch);
+                    return;
+                }
+                if stamp.settled(self.cutoff) {
+                    listing.record = Some(Record::new(stamp));
+                }
+            }
+        }
+        self.list(worker, &mut listing, scratch);
+        usage.add(&listing.usage);
+        usage.add(&listing.linked);
+        if let Some(mut record) = listing.record.take() {
+            // a directory that was not read completely must be listed again
+            if listing.usage.errors == 0 && !self.cancelled() {
+                record.set_totals(listing.totals());
+                scratch.records.push(record);
+            }
+        }
+    }
+
+    #[cfg(unix)]
+    fn list(&self, worker: usize, listing: &mut Listing, scratch: &mut Scratch) {
+        let dir = match nix::unistd::dup(&*listing.fd).map(Dir::from_fd) {
+            Ok(Ok(dir)) => dir,
+            _ => {
+                listing.usage.errors += 1;
+                return;
+            }
+        };
+        for entry in dir {
+            if self.cancelled() {
+                return;
+            }
+            let entry = match entry {
+                Ok(entry) => entry,
+                Err(_) => {
+                    listing.usage.errors += 1;
+                    break;
+                }
+            };
+            let name = entry.file_name();
+            if name.to_bytes() == b"." || name.to_bytes() == b".." {
+                continue;
+            }
+            #[cfg(target_os = "linux")]
+            if scratch.ring.is_some() {
+                scratch.batch.push(name);
+                if scratch.batch.len() == scratch.batch.capacity {
+                    self.stat_batch(worker, listing, scratch);
+                }
+                continue;
+            }
+            match self.stat_at(&listing.fd, name) {
+                Some(entry) => self.visit(worker, listing, name, entry, &mut scratch.files),
+                None => listing.usage.errors += 1,
+            }
+        }
+        #[cfg(target_os = "linux")]
+        self.stat_batch(worker, listing, scratch);
+        #[cfg(not(target_os = "linux"))]
+        let _ = scratch;
+    }
+
+    // Query the batched names with one io_uring submission, falling back to
+    // `fstatat` (for good) if the ring fails or the kernel lacks IORING_OP_STATX
+    #[cfg(target_os = "linux")]
+    fn stat_batch(&self, worker: usize, listing: &mut Listing, scratch: &mut Scratch) {
+        if scratch.batch.is_empty() {
+            return;
+        }
+        let fd = listing.fd.clone();
+        let names = scratch.batch.names();
+        let mut results = vec![Err(0); names.len()];
+        let submitted = match scratch.ring.as_mut() {
+            Some(ring) => ring
+                .statx_batch(fd.as_raw_fd(), &names, &mut results)
+                .is_ok(),
+            None => false,
+        };
+        if !submitted {
+            scratch.ring = None;
+        }
+        for (name, result) in names.iter().zip(results) {
+            let entry = match result {
+                Ok(statx) => Some(Entry::from(&statx)),
+                Err(errno) if !submitted || errno == libc::EINVAL => {
+                    scratch.ring = None;
+                    self.stat_at(&fd, name)
+                }
+                Err(_) => None,
+            };
+            match entry {
+                Some(entry) => self.visit(worker, listing, name, entry, &mut scratch.files),
+                None => listing.usage.errors += 1,
+            }
+        }
+        drop(names);
+        scratch.batch.clear();
+    }
+
+    #[cfg(windows)]
+    fn scan(
+        &self,
+        worker: usize,
+        task: Task,
+        node: Option<&Arc<Node>>,
+        usage: &mut Usage,
+        scratch: &mut Scratch,
+    ) {
+        let mut pattern = task.path.clone();
+        pattern.extend("\\*".encode_utf16());
+        pattern.push(0);
+        let mut data = WIN32_FIND_DATAW::default();
+        let handle = match unsafe {
+            FindFirstFileExW(
+                PCWSTR::from_raw(pattern.as_ptr()),
+                FindExInfoBasic,
+                &mut data as *mut WIN32_FIND_DATAW as *mut core::ffi::c_void,
+                FindExSearchNameMatch,
+                None,
+                FIND_FIRST_EX_LARGE_FETCH,
+            )
+        } {
+            Ok(handle) => handle,
+            Err(_) => {
+                usage.errors += 1;
+                return;
+            }
+        };
+        while !self.cancelled() {
+            let len = data
+                .cFileName
+                .iter()
+                .position(|&c| c == 0)
+                .unwrap_or(data.cFileName.len());
+            let name = &data.cFileName[..len];
+            let dot = [b'.' as u16];
+            let dot_dot = [b'.' as u16, b'.' as u16];
+            if name != dot && name != dot_dot {
+                let attributes = data.dwFileAttributes;
+                if attributes & FILE_ATTRIBUTE_DIRECTORY.0 != 0 {
+                    usage.dirs += 1;
+                    if attributes & FILE_ATTRIBUTE_REPARSE_POINT.0 == 0 {
+                        let mut path = task.path.clone();
+                        path.push(b'\\' as u16);
+                        path.extend_from_slice(name);
+                        let node =
+                            node.map(|node| node.child(String::from_utf16_lossy(name).as_bytes()));
+                        self.push(worker, Task { path }, node);
+                    }
+                } else {
+                    let size = ((data.nFileSizeHigh as u64) << 32) | data.nFileSizeLow as u64;
+                    let allocated = size.div_ceil(self.cluster_size) * self.cluster_size;
+                    usage.files += 1;
+                    usage.apparent += size;
+                    usage.allocated += allocated;
+                    if let Some(node) = node {
+                        scratch.files.offer(self.ranked_size(size, allocated), || {
+                            join(&node.path, String::from_utf16_lossy(name).as_bytes())
+                        });
+                    }
+                }
+            }
+            if unsafe { FindNextFileW(handle, &mut data) }.is_err() {
+                break;
+            }
+        }
+        let _ = unsafe { FindClose(handle) };
+    }
+}
+
+// Open the root and account for it; returns the task that lists it
+#[cfg(unix)]
+fn root_task(walker: &mut Walker<'_>, root: &CStr, usage: &mut Usage) -> Result<Task, StatError> {
+    let flags = OFlag::O_RDONLY | OFlag::O_DIRECTORY | OFlag::O_CLOEXEC;
+    let not_directory = |e: nix::Error| StatError::os(Reason::NotDirectory, e as i64);
+    let fd = nix::fcntl::open(root, flags, Mode::empty()).map_err(not_directory)?;
+    let stat = fstat(&fd).map_err(not_directory)?;
+    walker.root_dev = stat.st_dev as u64;
+    usage.dirs += 1;
+    walker.count(&Entry::from(&stat), usage);
+    Ok(Task::Root(fd))
+}
+
+#[cfg(windows)]
+fn root_task(walker: &mut Walker<'_>, root: &CStr, usage: &mut Usage) -> Result<Task, StatError> {
+    let wide = long_wide_path(root)?;
+    let long_wpath = PCWSTR::from_raw(wide.as_ptr());
+    crate::stat::check_dir_wide(long_wpath)?;
+    let mut volume = crate::stat::volume_root_wide(long_wpath)?;
+    volume.push(0);
+    let mut sectors_per_cluster: u32 = 0;
+    let mut bytes_per_sector: u32 = 0;
+    let queried = unsafe {
+        GetDiskFreeSpaceW(
+            PCWSTR::from_raw(volume.as_ptr()),
+            Some(&mut sectors_per_cluster),
+            Some(&mut bytes_per_sector),
+            None,
+            None,
+        )
+    };
+    if queried.is_ok() {
+        walker.cluster_size = (sectors_per_cluster as u64 * bytes_per_sector as u64).max(1);
+    }
+    usage.dirs += 1;
+    let mut path = wide.as_slice().to_vec();
+    while path.last() == Some(&(b'\\' as u16)) {
+        path.pop();
+    }
+    Ok(Task { path })
+}
+
+// Call the reporter every interval until `done` is set
+fn report(walker: &Walker<'_>, reporter: &Reporter<'_>, done: &(Mutex<bool>, Condvar)) {
+    let (lock_done, wakeup) = done;
+    let mut finished = lock(lock_done);
+    loop {
+        finished = wakeup
+            .wait_timeout_while(finished, reporter.interval, |finished| !*finished)
+            .unwrap_or_else(|e| e.into_inner())
+            .0;
+        if *finished || walker.cancelled() {
+            return;
+        }
+        (reporter.report)(walker.snapshot());
+    }
+}
+
+/// Walk the tree below the directory `root` with `options.threads` workers.
+pub fn usage(root: &CStr, options: &Options<'_>) -> Result<Report, StatError> {
+    let threads = options.threads.max(1);
+    let mut walker = Walker::new(options, threads);
+    let mut total = Usage::default();
+    let task = root_task(&mut walker, root, &mut total)?;
+    walker.flush(&total, &mut Usage::default());
+    let node = walker.top.map(|_| {
+        let size = walker.ranked_size(total.apparent, total.allocated);
+        Node::new(None, root.to_bytes().to_vec(), size)
+    });
+    walker.push(0, task, node);
+    let walker = &walker;
+    let done = (Mutex::new(false), Condvar::new());
+    thread::scope(|scope| {
+        if let Some(reporter) = &options.reporter {
+            let done = &done;
+            let _ = thread::Builder::new()
+                .name("disk_space_usage".to_string())
+                .spawn_scoped(scope, move || report(walker, reporter, done));
+        }
+        let handles: Vec<_> = (1..threads)
+            .filter_map(|worker| {
+                thread::Builder::new()
+                    .name("disk_space_usage".to_string())
+                    .spawn_scoped(scope, move || walker.work(worker))
+                    .ok()
+            })
+            .collect();
+        // the calling thread is worker 0; if no thread could be spawned it
+        // simply does all the work
+        total.add(&walker.work(0));
+        for handle in handles {
+            if let Ok(usage) = handle.join() {
+                total.add(&usage);
+            }
+        }
+        *lock(&done.0) = true;
+        done.1.notify_all();
+    });
+    if walker.cancelled() {
+        return Err(StatError::new(Reason::Cancelled));
+    }
+    #[cfg(unix)]
+    if let Some(path) = options.index {
+        let records = std::mem::take(&mut *lock(&walker.records));
+        index::write(path, options.one_file_system, records).map_err(|e| {
+            StatError::os(
+                Reason::IndexWriteFailed,
+                e.raw_os_error().unwrap_or(0) as i64,
+            )
+        })?;
+    }
+    let largest = walker.top.map(|_| {
+        let (files, dirs) =
+            std::mem::replace(&mut *lock(&walker.largest), (TopK::new(0), TopK::new(0)));
+        Largest {
+            files: files.into_ranked(),
+            dirs: dirs.into_ranked(),
+        }
+    });
+    Ok(Report {
+        usage: total,
+        largest,
+    })
+}
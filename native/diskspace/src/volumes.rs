@@ -0,0 +1,110 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! Windows volume roots, cached per path, and the space query of a volume
+//! root in a single call.
+//!
+//! `GetVolumePathNameW` is a path lookup of its own, a network round trip on
+//! SMB, so the root of each long path is kept for `ROOT_TTL`: batches grouped
+//! by device then cost one attribute check per path and one space query per
+//! volume. The cache is cleared whenever the mount watcher sees the volume
+//! list change.
+//!
+//! `GetDiskSpaceInformationW` (Windows 10 1809 and later) returns the space
+//! figures and the allocation unit of a volume at once. It is looked up at
+//! runtime so that the NIF still loads on older versions, which fall back to
+//! `GetDiskFreeSpaceExW`.
+
+use crate::stat::{self, FsStats, StatError};
+use std::collections::HashMap;
+use std::sync::{OnceLock, RwLock};
+use std::time::{Duration, Instant};
+use windows::core::{s, w, HRESULT, PCWSTR};
+use windows::Win32::Storage::FileSystem::DISK_SPACE_INFORMATION;
+use windows::Win32::System::LibraryLoader::{GetModuleHandleW, GetProcAddress};
+
+/// Beyond this many cached paths the cache starts over.
+const MAX_ROOTS: usize = 4096;
+/// How long a resolved root is trusted without a volume notification.
+const ROOT_TTL: Duration = Duration::from_secs(60);
+
+struct Root {
+    root: Vec<u16>,
+    resolved_at: Instant,
+}
+
+// long path (without the NUL) -> its volume root
+fn roots() -> &'static RwLock<HashMap<Vec<u16>, Root>> {
+    static ROOTS: OnceLock<RwLock<HashMap<Vec<u16>, Root>>> = OnceLock::new();
+    ROOTS.get_or_init(|| RwLock::new(HashMap::new()))
+}
+
+/// The volume root (e.g. `\\?\C:\`, without the NUL) that `long_wpath` is
+/// mounted under, from the cache unless unknown or expired.
+pub fn root_of(long_wpath: PCWSTR) -> Result<Vec<u16>, StatError> {
+    // SAFETY: the long paths are NUL-terminated buffers that outlive the call
+    let key = unsafe { long_wpath.as_wide() };
+    let cached = roots()
+        .read()
+        .unwrap_or_else(|e| e.into_inner())
+        .get(key)
+        .filter(|entry| entry.resolved_at.elapsed() < ROOT_TTL)
+        .map(|entry| entry.root.clone());
+    if let Some(root) = cached {
+        return Ok(root);
+    }
+    let root = stat::volume_root_wide(long_wpath)?;
+    let mut roots = roots().write().unwrap_or_else(|e| e.into_inner());
+    if roots.len() >= MAX_ROOTS {
+        roots.clear();
+    }
+    let entry = Root {
+        root: root.clone(),
+        resolved_at: Instant::now(),
+    };
+    roots.insert(key.to_vec(), entry);
+    Ok(root)
+}
+
+/// Forget every cached root, e.g. after a volume was mounted or removed.
+pub fn invalidate() {
+    roots().write().unwrap_or_else(|e| e.into_inner()).clear();
+}
+
+type GetDiskSpaceInformationW =
+    unsafe extern "system" fn(PCWSTR, *mut DISK_SPACE_INFORMATION) -> HRESULT;
+
+fn get_disk_space_information() -> Option<GetDiskSpaceInformationW> {
+    static FUNCTION: OnceLock<Option<GetDiskSpaceInformationW>> = OnceLock::new();
+    *FUNCTION.get_or_init(|| {
+        let kernel32 = unsafe { GetModuleHandleW(w!("kernel32.dll")) }.ok()?;
+        let address = unsafe { GetProcAddress(kernel32, s!("GetDiskSpaceInformationW")) }?;
+        // SAFETY: the signature documented for GetDiskSpaceInformationW
+        Some(unsafe {
+            std::mem::transmute::<unsafe extern "system" fn() -> isize, GetDiskSpaceInformationW>(
+                address,
+            )
+        })
+    })
+}
+
+/// The space figures of the volume at the NUL-terminated `root`, with its
+/// allocation unit in bytes when the OS reports both in one call.
+pub fn volume_space(root: PCWSTR) -> Result<(FsStats, Option<u64>), StatError> {
+    if let Some(get_disk_space_information) = get_disk_space_information() {
+        let mut info = DISK_SPACE_INFORMATION::default();
+        // a failure here (e.g. from a file system driver without support)
+        // is left to the older call to report
+        if unsafe { get_disk_space_information(root, &mut info) }.is_ok() {
+            let unit = info.SectorsPerAllocationUnit as u64 * info.BytesPerSector as u64;
+            let stats = FsStats::from_blocks(
+                unit,
+                info.CallerAvailableAllocationUnits,
+                info.ActualAvailableAllocationUnits,
+                info.CallerTotalAllocationUnits,
+            );
+            return Ok((stats, Some(unit)));
+        }
+    }
+    Ok((stat::disk_free_wide(root)?, None))
+}
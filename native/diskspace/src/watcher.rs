@@ -0,0 +1,315 @@
+// SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+// SPDX-License-Identifier: Apache-2.0
+
+//! A background thread that tells its owner process when the mount table
+//! changes, so that mount lists and device groupings are rebuilt only then.
+//!
+//! Linux waits for the `POLLPRI` the kernel raises on `/proc/self/mountinfo`,
+//! macOS waits for `VQ_MOUNT`/`VQ_UNMOUNT` on a kqueue `EVFILT_FS` filter.
+//! Elsewhere (and if either fails) the thread re-reads the mount table every
+//! interval and reports differences. Stopping wakes the thread at once: the
+//! poll and the kqueue also wait on a pipe that `stop` writes to, and the
+//! rescan sleeps on a condition variable. Each change sends
+//! `{disk_space, mounts_changed}` to the owner, after dropping the filesystem
+//! classes of `local.rs` (and on Windows the cached volume roots of
+//! `volumes.rs`); the thread exits when the resource is stopped or dropped,
+//! or when the owner is gone. Dropping the resource, which can happen on any
+//! scheduler, only signals the thread and does not wait for it.
+
+use crate::atoms;
+use crate::mounts::{self, MountEntry};
+use rustler::{Encoder, Env, LocalPid, NifResult, OwnedEnv, ResourceArc, Term};
+#[cfg(any(target_os = "linux", target_os = "macos"))]
+use std::os::fd::AsRawFd;
+#[cfg(any(target_os = "linux", target_os = "macos"))]
+use std::os::fd::{FromRawFd, OwnedFd};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread::{self, JoinHandle};
+use std::time::Duration;
+
+// Not exported by the libc crate; see <sys/mount.h>
+#[cfg(target_os = "macos")]
+const VQ_MOUNT: u32 = 0x0008;
+#[cfg(target_os = "macos")]
+const VQ_UNMOUNT: u32 = 0x0010;
+
+struct Shared {
+    stop: Mutex<bool>,
+    wakeup: Condvar,
+    // read and write end of the pipe that interrupts a poll or kevent wait
+    #[cfg(any(target_os = "linux", target_os = "macos"))]
+    waker: Option<(OwnedFd, OwnedFd)>,
+}
+
+#[cfg(any(target_os = "linux", target_os = "macos"))]
+fn waker_pipe() -> Option<(OwnedFd, OwnedFd)> {
+    let mut fds = [0; 2];
+    if unsafe { libc::pipe(fds.as_mut_ptr()) } < 0 {
+        return None;
+    }
+    // SAFETY: both descriptors were just created and are owned here only
+    Some(unsafe { (OwnedFd::from_raw_fd(fds[0]), OwnedFd::from_raw_fd(fds[1])) })
+}
+
+impl Shared {
+    fn new() -> Shared {
+        Shared {
+            stop: Mutex::new(false),
+            wakeup: Condvar::new(),
+            #[cfg(any(target_os = "linux", target_os = "macos"))]
+            waker: waker_pipe(),
+        }
+    }
+
+    // Signal the thread to exit without waiting for it
+    fn signal_stop(&self) {
+        *self.stop.lock().unwrap_or_else(|e| e.into_inner()) = true;
+        self.wakeup.notify_all();
+        #[cfg(any(target_os = "linux", target_os = "macos"))]
+        if let Some((_, write)) = &self.waker {
+            let byte = 1u8;
+            let _ = unsafe { libc::write(write.as_raw_fd(), (&byte as *const u8).cast(), 1) };
+        }
+    }
+
+    // The descriptor that becomes readable on stop, if the pipe exists
+    #[cfg(any(target_os = "linux", target_os = "macos"))]
+    fn waker_fd(&self) -> Option<i32> {
+        self.waker.as_ref().map(|(read, _)| read.as_raw_fd())
+    }
+
+    fn stopping(&self) -> bool {
+        *self.stop.lock().unwrap_or_else(|e| e.into_inner())
+    }
+
+    // Sleep for `interval` unless stopped first
+    fn sleep(&self, interval: Duration) {
+        let stop = self.stop.lock().unwrap_or_else(|e| e.into_inner());
+        let _ = self
+            .wakeup
+            .wait_timeout_while(stop, interval, |stop| !*stop)
+            .unwrap_or_else(|e| e.into_inner());
+    }
+}
+
+enum Backend {
+    #[cfg(target_os = "linux")]
+    MountInfo(std::fs::File),
+    #[cfg(target_os = "macos")]
+    Kqueue(OwnedFd),
+    Rescan(Vec<MountEntry>),
+}
+
+impl Backend {
+    fn rescan() -> Backend {
+        Backend::Rescan(mounts::mount_entries().unwrap_or_default())
+    }
+
+    #[cfg(target_os = "linux")]
+    fn open(_shared: &Shared) -> Backend {
+        match std::fs::File::open("/proc/self/mountinfo") {
+            Ok(file) => Backend::MountInfo(file),
+            Err(_) => Backend::rescan(),
+        }
+    }
+
+    #[cfg(target_os = "macos")]
+    fn open(shared: &Shared) -> Backend {
+        let kq = unsafe { libc::kqueue() };
+        if kq < 0 {
+            return Backend::rescan();
+        }
+        let kq = unsafe { OwnedFd::from_raw_fd(kq) };
+        let change = libc::kevent {
+            ident: 0,
+            filter: libc::EVFILT_FS,
+            flags: libc::EV_ADD | libc::EV_CLEAR,
+            fflags: VQ_MOUNT | VQ_UNMOUNT,
+            data: 0,
+            udata: std::ptr::null_mut(),
+        };
+        let added = unsafe {
+            libc::kevent(
+                kq.as_raw_fd(),
+                &change,
+                1,
+                std::ptr::null_mut(),
+                0,
+                std::ptr::null(),
+            )
+        };
+        if added < 0 {
+            return Backend::rescan();
+        }
+        if let Some(fd) = shared.waker_fd() {
+            let change = libc::kevent {
+                ident: fd as libc::uintptr_t,
+                filter: libc::EVFILT_READ,
+                flags: libc::EV_ADD,
+                fflags: 0,
+                data: 0,
+                udata: std::ptr::null_mut(),
+            };
+            let added = unsafe {
+                libc::kevent(
+                    kq.as_raw_fd(),
+                    &change,
+                    1,
+                    std::ptr::null_mut(),
+                    0,
+                    std::ptr::null(),
+                )
+            };
+            if added < 0 {
+                return Backend::rescan();
+            }
+        }
+        Backend::Kqueue(kq)
+    }
+
+    #[cfg(not(any(target_os = "linux", target_os = "macos")))]
+    fn open(_shared: &Shared) -> Backend {
+        Backend::rescan()
+    }
+
+    /// Wait up to `interval` and return whether the mount table changed.
+    fn wait(&mut self, shared: &Shared, interval: Duration) -> bool {
+        match self {
+            #[cfg(target_os = "linux")]
+            Backend::MountInfo(file) => {
+                // a negative descriptor is ignored by poll
+                let pollfds = &mut [
+                    libc::pollfd {
+                        fd: file.as_raw_fd(),
+                        events: libc::POLLPRI | libc::POLLERR,
+                        revents: 0,
+                    },
+                    libc::pollfd {
+                        fd: shared.waker_fd().unwrap_or(-1),
+                        events: libc::POLLIN,
+                        revents: 0,
+                    },
+                ];
+                let timeout = interval.as_millis().min(i32::MAX as u128) as i32;
+                let ready = unsafe { libc::poll(pollfds.as_mut_ptr(), 2, timeout) };
+                if ready < 0 {
+                    if std::io::Error::last_os_error().kind() != std::io::ErrorKind::Interrupted {
+                        *self = Backend::rescan();
+                    }
+                    return false;
+                }
+                // the kernel resets the event once poll has reported it
+                ready > 0 && pollfds[0].revents & (libc::POLLPRI | libc::POLLERR) != 0
+            }
+            #[cfg(target_os = "macos")]
+            Backend::Kqueue(kq) => {
+                let timeout = libc::timespec {
+                    tv_sec: interval.as_secs() as libc::time_t,
+                    tv_nsec: interval.subsec_nanos() as libc::c_long,
+                };
+                let mut event: libc::kevent = unsafe { std::mem::zeroed() };
+                let ready = unsafe {
+                    libc::kevent(kq.as_raw_fd(), std::ptr::null(), 0, &mut event, 1, &timeout)
+                };
+                if ready < 0 {
+                    if std::io::Error::last_os_error().kind() != std::io::ErrorKind::Interrupted {
+                        *self = Backend::rescan();
+                    }
+                    return false;
+                }
+                ready > 0 && event.filter == libc::EVFILT_FS
+            }
+            Backend::Rescan(previous) => {
+                shared.sleep(interval);
+                if shared.stopping() {
+                    return false;
+                }
+                match mounts::mount_entries() {
+                    Ok(current) if current != *previous => {
+                        *previous = current;
+                        true
+                    }
+                    _ => false,
+                }
+            }
+        }
+    }
+}
+
+fn run(shared: &Shared, owner: LocalPid, interval: Duration) {
+    let mut backend = Backend::open(shared);
+    let mut owned_env = OwnedEnv::new();
+    while !shared.stopping() {
+        if !backend.wait(shared, interval) || shared.stopping() {
+            continue;
+        }
+        // a mounted or removed volume can move paths to another root, or
+        // put a local path on a network filesystem
+        #[cfg(windows)]
+        crate::volumes::invalidate();
+        crate::local::invalidate();
+        let sent = owned_env.send_and_clear(&owner, |env| {
+            (atoms::disk_space(), atoms::mounts_changed()).encode(env)
+        });
+        if sent.is_err() {
+            // the owner has exited, nobody is listening anymore
+            return;
+        }
+    }
+}
+
+/// The NIF resource: the thread watching the mount table.
+pub struct MountWatcher {
+    shared: Arc<Shared>,
+    thread: Mutex<Option<JoinHandle<()>>>,
+}
+
+impl MountWatcher {
+    fn start(owner: LocalPid, interval: Duration) -> Option<MountWatcher> {
+        let shared = Arc::new(Shared::new());
+        let thread_shared = shared.clone();
+        let thread = thread::Builder::new()
+            .name("disk_space_mounts".to_string())
+            .spawn(move || run(&thread_shared, owner, interval))
+            .ok()?;
+        Some(MountWatcher {
+            shared,
+            thread: Mutex::new(Some(thread)),
+        })
+    }
+
+    // Waits for the thread, which may be finishing a rescan of the mount table
+    fn stop(&self) {
+        self.shared.signal_stop();
+        let thread = self.thread.lock().unwrap_or_else(|e| e.into_inner()).take();
+        if let Some(thread) = thread {
+            let _ = thread.join();
+        }
+    }
+}
+
+// The last reference can go away on a normal scheduler, so the thread is
+// only signalled and left to exit on its own
+impl Drop for MountWatcher {
+    fn drop(&mut self) {
+        self.shared.signal_stop();
+    }
+}
+
+#[rustler::resource_impl]
+impl rustler::Resource for MountWatcher {}
+
+// Returns {ok, Watcher}; change messages go to the calling process
+#[rustler::nif]
+fn mount_watcher_start<'a>(env: Env<'a>, interval_ms: u64) -> NifResult<Term<'a>> {
+    match MountWatcher::start(env.pid(), Duration::from_millis(interval_ms.max(1))) {
+        Some(watcher) => Ok((atoms::ok(), ResourceArc::new(watcher)).encode(env)),
+        None => crate::make_error_tuple(env, atoms::thread_spawn_failed()),
+    }
+}
+
+#[rustler::nif(schedule = "DirtyIo")]
+fn mount_watcher_stop(watcher: ResourceArc<MountWatcher>) -> rustler::Atom {
+    watcher.stop();
+    atoms::ok()
+}
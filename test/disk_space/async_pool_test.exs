@@ -0,0 +1,37 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.AsyncPoolTest do
+  # reconfigures the worker pool that all tests share
+  use ExUnit.Case, async: false
+  import DiskSpace.TestHelpers
+
+  setup do
+    %{max_workers: max_workers, max_queue: max_queue} = DiskSpace.async_pool_info()
+    on_exit(fn -> DiskSpace.configure_async(max_workers: max_workers, max_queue: max_queue) end)
+    %{path: valid_directory_path()}
+  end
+
+  test "answers every coalesced caller when the queue is full", %{path: path} do
+    DiskSpace.configure_async(max_queue: 0)
+
+    results =
+      1..50
+      |> Enum.map(fn _ -> Task.async(fn -> DiskSpace.stat(path, coalesce: true) end) end)
+      |> Task.await_many(5000)
+
+    assert Enum.all?(results, &(&1 == {:error, %{reason: :busy, info: nil}}))
+  end
+
+  test "coalesces concurrent calls for the same path", %{path: path} do
+    DiskSpace.configure_async(max_workers: 1, max_queue: 10_000)
+    %{coalesced: coalesced} = DiskSpace.async_pool_info()
+
+    # a backlog in front of the shared query keeps it in flight while the others join
+    backlog = for _ <- 1..500, do: Task.async(fn -> DiskSpace.stat_async(path) end)
+    joined = for _ <- 1..50, do: Task.async(fn -> DiskSpace.stat(path, coalesce: true) end)
+
+    assert Enum.all?(Task.await_many(backlog ++ joined, 10_000), &match?({:ok, _}, &1))
+    assert DiskSpace.async_pool_info().coalesced > coalesced
+  end
+end
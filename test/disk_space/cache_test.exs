@@ -0,0 +1,52 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.CacheTest do
+  use ExUnit.Case, async: true
+  import DiskSpace.TestHelpers
+
+  setup do
+    name = :"disk_space_cache_#{System.unique_integer([:positive])}"
+    start_supervised!({DiskSpace.Cache, name: name, ttl: 60_000})
+    %{name: name, path: valid_directory_path()}
+  end
+
+  test "serves repeated calls from the cache", %{name: name, path: path} do
+    assert {:ok, stats} = DiskSpace.Cache.stat(path, name: name)
+    assert Enum.sort(Map.keys(stats)) == [:available, :free, :total, :used]
+    assert {:ok, ^stats} = DiskSpace.Cache.stat(path, name: name)
+    assert %{hits: 1, misses: 1, size: 1} = DiskSpace.Cache.info(name)
+  end
+
+  test "refreshes when the entry is older than the ttl", %{name: name, path: path} do
+    assert {:ok, _} = DiskSpace.Cache.stat(path, name: name)
+    assert {:ok, _} = DiskSpace.Cache.stat(path, name: name, ttl: -1)
+    assert %{hits: 0, misses: 2} = DiskSpace.Cache.info(name)
+  end
+
+  test "shares one refresh among concurrent misses", %{name: name, path: path} do
+    results =
+      1..20
+      |> Enum.map(fn _ -> Task.async(fn -> DiskSpace.Cache.stat(path, name: name) end) end)
+      |> Task.await_many()
+
+    assert [_] = Enum.uniq(results)
+    # late misses are answered from ETS by the cache process, without another refresh
+    assert %{hits: hits, misses: misses, refreshes: 1, waits: waits} = DiskSpace.Cache.info(name)
+    assert hits + misses == 20
+    assert waits < misses
+  end
+
+  test "caches errors and supports invalidation", %{name: name, path: path} do
+    missing = Path.join(path, "nonexistent_#{System.unique_integer()}")
+    assert {:error, %{reason: _}} = DiskSpace.Cache.stat(missing, name: name)
+    assert [{^missing, {:error, _}}] = DiskSpace.Cache.entries(name)
+    assert :ok = DiskSpace.Cache.invalidate(missing, name)
+    assert [] = DiskSpace.Cache.entries(name)
+  end
+
+  test "humanizes cached results", %{name: name, path: path} do
+    assert %{available: available} = DiskSpace.Cache.stat!(path, name: name, humanize: :binary)
+    assert is_binary(available)
+  end
+end
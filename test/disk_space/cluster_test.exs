@@ -0,0 +1,31 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.ClusterTest do
+  use ExUnit.Case, async: true
+  import DiskSpace.TestHelpers
+
+  setup do
+    name = :"disk_space_cluster_cache_#{System.unique_integer([:positive])}"
+    start_supervised!({DiskSpace.Cache, name: name, ttl: 60_000, stat_opts: [extended: true]})
+    %{name: name, path: valid_directory_path()}
+  end
+
+  test "answers from the local cache and aggregates", %{name: name, path: path} do
+    assert %{results: results, timed_out: [], aggregate: aggregate} =
+             DiskSpace.Cluster.stat(path, nodes: [node()], name: name)
+
+    assert {:ok, %{total: total, fsid: _}} = results[node()]
+    assert %{total: ^total, filesystems: 1} = aggregate
+    assert %{misses: 1} = DiskSpace.Cache.info(name)
+  end
+
+  test "reports unreachable nodes without failing the rest", %{name: name, path: path} do
+    down = :"disk_space_down_#{System.unique_integer([:positive])}@nohost"
+
+    assert %{results: %{^down => {:error, %{reason: :rpc_failed}}}, aggregate: aggregate} =
+             DiskSpace.Cluster.stat(path, nodes: [node(), down], name: name, timeout: 1_000)
+
+    assert %{filesystems: 1} = aggregate
+  end
+end
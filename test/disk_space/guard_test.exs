@@ -0,0 +1,78 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.GuardTest do
+  use ExUnit.Case, async: true
+  import DiskSpace.TestHelpers
+
+  test "allows writes while above the threshold" do
+    name = start_guard(threshold: {:bytes, 0})
+    assert DiskSpace.Guard.ok?(name)
+    assert %{ok?: true, value: value} = DiskSpace.Guard.status(name)
+    assert is_integer(value)
+  end
+
+  test "blocks writes below the threshold" do
+    percent = available_percent()
+    name = start_guard(threshold: {:percent, percent + 1})
+    refute DiskSpace.Guard.ok?(name)
+    refute DiskSpace.Guard.check(name)
+  end
+
+  test "hysteresis only applies to turning writes back on" do
+    percent = available_percent()
+    # already open: stays open while above the threshold, whatever the band
+    assert DiskSpace.Guard.ok?(start_guard(threshold: {:percent, percent - 1}, hysteresis: 100))
+  end
+
+  test "follows :on_error for paths that cannot be queried" do
+    missing = Path.join(valid_directory_path(), "nonexistent_#{System.unique_integer()}")
+    refute DiskSpace.Guard.ok?(start_guard(path: missing, threshold: {:bytes, 0}))
+
+    assert DiskSpace.Guard.ok?(
+             start_guard(path: missing, threshold: {:bytes, 0}, on_error: :allow)
+           )
+  end
+
+  test "answers status before the first poll completes" do
+    name = :"disk_space_guard_#{System.unique_integer([:positive])}"
+    opts = [name: name, path: valid_directory_path(), threshold: {:bytes, 0}]
+    start_supervised!({DiskSpace.Guard, opts})
+    assert %{threshold: {:bytes, 0}} = DiskSpace.Guard.status(name)
+    assert DiskSpace.Guard.check(name)
+  end
+
+  test "answers every caller that checks while a poll is running" do
+    name = start_guard(threshold: {:bytes, 0})
+
+    results =
+      1..20
+      |> Enum.map(fn _ -> Task.async(fn -> DiskSpace.Guard.check(name) end) end)
+      |> Task.await_many()
+
+    assert Enum.all?(results)
+  end
+
+  test "rejects an invalid threshold" do
+    opts = [name: :disk_space_guard_invalid, path: valid_directory_path(), threshold: {:kb, 1}]
+
+    assert {:error, {%ArgumentError{message: message}, _stacktrace}} =
+             GenServer.start(DiskSpace.Guard, opts)
+
+    assert message =~ "{:kb, 1}"
+  end
+
+  # waits for the first poll, so that the flag reflects the path
+  defp start_guard(opts) do
+    name = :"disk_space_guard_#{System.unique_integer([:positive])}"
+    opts = Keyword.merge([name: name, path: valid_directory_path(), interval: 60_000], opts)
+    start_supervised!({DiskSpace.Guard, opts})
+    DiskSpace.Guard.check(name)
+    name
+  end
+
+  defp available_percent do
+    {:ok, stats} = DiskSpace.stat(valid_directory_path())
+    stats.available * 100 / max(stats.total, 1)
+  end
+end
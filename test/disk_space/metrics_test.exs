@@ -0,0 +1,43 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.MetricsTest do
+  use ExUnit.Case, async: true
+  import DiskSpace.TestHelpers
+
+  setup do
+    name = :"disk_space_metrics_#{System.unique_integer([:positive])}"
+    start_supervised!({DiskSpace.Cache, name: name, ttl: 60_000, stat_opts: [extended: true]})
+    %{name: name, path: valid_directory_path()}
+  end
+
+  test "renders the cached results as OpenMetrics text", %{name: name, path: path} do
+    assert {:ok, stats} = DiskSpace.Cache.stat(path, name: name)
+    text = IO.iodata_to_binary(DiskSpace.Metrics.render(name: name))
+
+    labels =
+      case stats.fs_type do
+        nil -> ~s({path="#{escape(path)}"})
+        fs_type -> ~s({path="#{escape(path)}",fstype="#{fs_type}"})
+      end
+
+    assert text =~
+             "# TYPE disk_space_available_bytes gauge\n# UNIT disk_space_available_bytes bytes\n"
+
+    assert text =~ "\ndisk_space_available_bytes#{labels} #{stats.available}\n"
+    assert text =~ "\ndisk_space_size_bytes#{labels} #{stats.total}\n"
+    assert text =~ "\ndisk_space_up#{labels} 1\n"
+    assert String.ends_with?(text, "\n# EOF\n")
+  end
+
+  test "escapes labels and reports failed paths as down", %{name: name, path: path} do
+    missing = Path.join(path, "quote\"d_#{System.unique_integer([:positive])}")
+    assert {:error, _} = DiskSpace.Cache.stat(missing, name: name)
+    text = IO.iodata_to_binary(DiskSpace.Metrics.render(name: name))
+
+    assert text =~ ~s(disk_space_up{path="#{escape(missing)}"} 0\n)
+    refute text =~ "disk_space_available_bytes{"
+  end
+
+  defp escape(label), do: label |> String.replace("\\", "\\\\") |> String.replace("\"", "\\\"")
+end
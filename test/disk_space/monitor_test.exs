@@ -0,0 +1,96 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.MonitorTest do
+  use ExUnit.Case, async: true
+  import DiskSpace.TestHelpers
+
+  defp start_monitor(opts) do
+    name = :"disk_space_monitor_#{System.unique_integer([:positive])}"
+    start_supervised!({DiskSpace.Monitor, Keyword.put(opts, :name, name)})
+    :ok = DiskSpace.Monitor.subscribe(name)
+    name
+  end
+
+  test "alerts once when a path crosses a level" do
+    # every volume has less than 101% available
+    name = start_monitor(levels: [full: {:percent, 101}], min_interval: 10, max_interval: 10)
+    path = valid_directory_path()
+    :ok = DiskSpace.Monitor.register(path, name)
+
+    assert_receive {:disk_space_alert, ^path, :full, %{available: _}}, 1_000
+    refute_receive {:disk_space_alert, ^path, _, _}, 100
+    assert %{^path => %{level: :full, result: {:ok, _}}} = DiskSpace.Monitor.status(name)
+  end
+
+  test "polls rarely with plenty of headroom" do
+    name = start_monitor(levels: [low: {:bytes, 1}], min_interval: 100, max_interval: 5_000)
+    path = valid_directory_path()
+    {:ok, %{available: available}} = DiskSpace.stat(path)
+    :ok = DiskSpace.Monitor.register(path, name)
+
+    if available >= 2 do
+      Process.sleep(200)
+      assert %{^path => %{level: :ok, interval: 5_000}} = DiskSpace.Monitor.status(name)
+    end
+
+    refute_received {:disk_space_alert, ^path, _, _}
+  end
+
+  test "survives timer messages that arrive while a poll is running" do
+    name = start_monitor(min_interval: 10, max_interval: 10)
+    path = valid_directory_path()
+    :ok = DiskSpace.Monitor.register(path, name)
+    pid = GenServer.whereis(name)
+    for _ <- 1..20, do: send(pid, :poll)
+
+    Process.sleep(100)
+    assert %{^path => %{result: {:ok, _}}} = DiskSpace.Monitor.status(name)
+    assert Process.alive?(pid)
+  end
+
+  test "times out a path that never answers and keeps polling the others" do
+    path = valid_directory_path()
+    hung = Path.join(path, "hung_#{System.unique_integer([:positive])}")
+
+    stat_many = fn paths ->
+      if hung in paths, do: Process.sleep(:infinity)
+      DiskSpace.stat_many(paths, dedupe_by_device: true)
+    end
+
+    name =
+      start_monitor(
+        levels: [full: {:percent, 101}],
+        min_interval: 10,
+        max_interval: 10,
+        timeout: 50,
+        stat_many: stat_many
+      )
+
+    :ok = DiskSpace.Monitor.register(hung, name)
+    :ok = DiskSpace.Monitor.register(path, name)
+
+    assert_receive {:disk_space_alert, ^hung, :error, %{reason: :timeout, info: nil}}, 1_000
+    assert_receive {:disk_space_alert, ^path, :full, %{available: _}}, 1_000
+    assert %{^path => %{result: {:ok, _}}} = DiskSpace.Monitor.status(name)
+  end
+
+  test "rejects invalid levels with the offending entry" do
+    opts = [name: :disk_space_monitor_invalid, levels: [warning: {:percent, 10}, low: {:kb, 1}]]
+
+    assert {:error, {%ArgumentError{message: message}, _stacktrace}} =
+             GenServer.start(DiskSpace.Monitor, opts)
+
+    assert message =~ "{:low, {:kb, 1}}"
+  end
+
+  test "alerts with :error for paths that cannot be queried" do
+    name = start_monitor(min_interval: 10)
+    missing = Path.join(valid_directory_path(), "nonexistent_#{System.unique_integer()}")
+    :ok = DiskSpace.Monitor.register(missing, name)
+
+    assert_receive {:disk_space_alert, ^missing, :error, %{reason: _}}, 1_000
+    :ok = DiskSpace.Monitor.unregister(missing, name)
+    assert DiskSpace.Monitor.status(name) == %{}
+  end
+end
@@ -0,0 +1,35 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.MountWatcherTest do
+  use ExUnit.Case, async: true
+
+  setup do
+    name = :"disk_space_mount_watcher_#{System.unique_integer([:positive])}"
+    pid = start_supervised!({DiskSpace.MountWatcher, name: name, interval: 50})
+    %{name: name, pid: pid}
+  end
+
+  test "relays change notifications to subscribers", %{name: name, pid: pid} do
+    assert :ok = DiskSpace.MountWatcher.subscribe(name)
+    assert :ok = DiskSpace.MountWatcher.subscribe(name)
+    send(pid, {:disk_space, :mounts_changed})
+    assert_receive {:disk_space, :mounts_changed}
+    refute_received {:disk_space, :mounts_changed}
+  end
+
+  test "stops relaying after unsubscribe", %{name: name, pid: pid} do
+    :ok = DiskSpace.MountWatcher.subscribe(name)
+    :ok = DiskSpace.MountWatcher.unsubscribe(name)
+    send(pid, {:disk_space, :mounts_changed})
+    refute_receive {:disk_space, :mounts_changed}, 100
+  end
+
+  test "drops subscribers that exit", %{name: name, pid: pid} do
+    subscriber = spawn(fn -> DiskSpace.MountWatcher.subscribe(name) end)
+    ref = Process.monitor(subscriber)
+    assert_receive {:DOWN, ^ref, :process, _, _}
+    %{subscribers: subscribers} = :sys.get_state(pid)
+    refute Map.has_key?(subscribers, subscriber)
+  end
+end
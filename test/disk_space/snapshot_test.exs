@@ -0,0 +1,94 @@
+# SPDX-FileCopyrightText: 2025 Isaak Tsalicoglou <isaak@overbring.com>
+# SPDX-License-Identifier: Apache-2.0
+
+defmodule DiskSpace.SnapshotTest do
+  use ExUnit.Case, async: true
+  import DiskSpace.TestHelpers
+
+  setup do
+    name = :"disk_space_snapshot_#{System.unique_integer([:positive])}"
+    start_supervised!({DiskSpace.Snapshot, name: name, interval: 20, capacity: 2})
+    %{name: name, path: valid_directory_path()}
+  end
+
+  test "publishes snapshots of registered paths", %{name: name, path: path} do
+    assert :ok = DiskSpace.Snapshot.register(path, name)
+    assert [^path] = DiskSpace.Snapshot.paths(name)
+    assert {:ok, stats, age} = await_snapshot(path, name)
+    assert Enum.sort(Map.keys(stats)) == [:available, :free, :total, :used]
+    assert is_integer(age) and age >= 0
+  end
+
+  test "publishes errors with the same shape as DiskSpace.stat/2", %{name: name, path: path} do
+    missing = Path.join(path, "nonexistent_#{System.unique_integer()}")
+    assert :ok = DiskSpace.Snapshot.register(missing, name)
+    {:error, info} = DiskSpace.stat(missing)
+    assert {:error, ^info, _age} = await_snapshot(missing, name)
+  end
+
+  test "unregisters paths and reports a full table", %{name: name, path: path} do
+    assert :ok = DiskSpace.Snapshot.register(path, name)
+    assert :ok = DiskSpace.Snapshot.register(path <> "/a", name)
+    assert {:error, %{reason: :full}} = DiskSpace.Snapshot.register(path <> "/b", name)
+    assert :ok = DiskSpace.Snapshot.unregister(path, name)
+
+    assert {:error, %{reason: :not_registered, info: nil}} =
+             DiskSpace.Snapshot.read(path, name)
+
+    assert :ok = DiskSpace.Snapshot.register(path <> "/b", name)
+  end
+
+  test "forecasts the fill rate from the sampled window", %{name: name, path: path} do
+    assert {:error, %{reason: :not_registered}} = DiskSpace.forecast(path, name: name)
+    assert :ok = DiskSpace.Snapshot.register(path, name)
+    assert {:ok, forecast} = await_forecast(path, name)
+    assert %{rate: rate, time_to_full: time_to_full, samples: samples, window: window} = forecast
+    assert is_float(rate)
+    assert time_to_full == :infinity or (is_float(time_to_full) and time_to_full >= 0)
+    assert samples >= 2 and window > 0
+  end
+
+  test "replaces a timeout with the late result of the query", %{path: path} do
+    name = :"disk_space_snapshot_#{System.unique_integer([:positive])}"
+    start_supervised!({DiskSpace.Snapshot, name: name, interval: 5, timeout: 0}, id: name)
+    assert :ok = DiskSpace.Snapshot.register(path, name)
+    assert {:ok, _stats, _age} = await_result(path, name)
+  end
+
+  defp await_result(path, name, attempts \\ 100) do
+    case DiskSpace.Snapshot.read(path, name) do
+      {:error, %{reason: :timeout}, _age} when attempts > 0 ->
+        Process.sleep(10)
+        await_result(path, name, attempts - 1)
+
+      {:error, %{reason: :pending}} when attempts > 0 ->
+        Process.sleep(10)
+        await_result(path, name, attempts - 1)
+
+      result ->
+        result
+    end
+  end
+
+  defp await_forecast(path, name, attempts \\ 100) do
+    case DiskSpace.Snapshot.forecast(path, name) do
+      {:error, %{reason: :pending}} when attempts > 0 ->
+        Process.sleep(10)
+        await_forecast(path, name, attempts - 1)
+
+      result ->
+        result
+    end
+  end
+
+  defp await_snapshot(path, name, attempts \\ 100) do
+    case DiskSpace.Snapshot.read(path, name) do
+      {:error, %{reason: :pending}} when attempts > 0 ->
+        Process.sleep(10)
+        await_snapshot(path, name, attempts - 1)
+
+      result ->
+        result
+    end
+  end
+end
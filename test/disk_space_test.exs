@@ -3,6 +3,7 @@
 
 defmodule DiskSpaceTest do
   use ExUnit.Case, async: true
+  import DiskSpace.TestHelpers
   doctest DiskSpace
 
   describe "NIF loading" do
@@ -26,6 +27,79 @@ defmodule DiskSpaceTest do
       assert stats.total >= stats.used
     end
 
+    test "adds filesystem details with extended: true" do
+      path = valid_directory_path()
+      assert {:ok, stats} = DiskSpace.stat(path, extended: true)
+
+      assert Enum.sort(Map.keys(stats)) ==
+               [:available, :block_size, :free, :fs_type, :fsid, :inodes_free, :inodes_total] ++
+                 [:total, :used]
+
+      assert is_integer(stats.block_size) and stats.block_size > 0
+      assert is_integer(stats.fsid)
+      assert is_binary(stats.fs_type) or is_nil(stats.fs_type)
+      assert is_nil(stats.inodes_total) or stats.inodes_total >= stats.inodes_free
+
+      assert {:ok, %{available: available, block_size: block_size}} =
+               DiskSpace.stat(path, extended: true, humanize: :binary)
+
+      assert is_binary(available) and is_integer(block_size)
+    end
+
+    test "returns the requested shape with :format" do
+      path = valid_directory_path()
+
+      assert {:ok, {available, free, total, used}} = DiskSpace.stat(path, format: :tuple)
+      assert Enum.all?([available, free, total, used], &is_integer/1)
+      assert total >= used
+
+      assert {:ok, stats} = DiskSpace.stat(path, format: {:fields, [:available, :total]})
+      assert Enum.sort(Map.keys(stats)) == [:available, :total]
+
+      assert {:ok, {available, _, _, _}} = DiskSpace.stat(path, format: :tuple, humanize: :binary)
+      assert is_binary(available)
+
+      assert {:ok, %{used: _}} = DiskSpace.stat(path, format: {:fields, [:used]}, coalesce: true)
+
+      assert_raise ArgumentError, fn -> DiskSpace.stat(path, format: {:fields, [:size]}) end
+    end
+
+    test "gives the same results with adaptive: true" do
+      path = valid_directory_path()
+
+      # the first query classifies the filesystem, the second may run inline
+      assert {:ok, %{total: total}} = DiskSpace.stat(path, adaptive: true)
+      assert {:ok, %{total: ^total}} = DiskSpace.stat(path, adaptive: true)
+
+      missing = Path.join(path, "nonexistent_#{System.unique_integer()}")
+      assert {:error, %{reason: _}} = DiskSpace.stat(missing, adaptive: true)
+    end
+
+    test "leaves out the errstr with errstr: false" do
+      missing = Path.join(valid_directory_path(), "nonexistent_#{System.unique_integer()}")
+
+      case DiskSpace.stat(missing, errstr: false) do
+        {:error, %{info: nil}} -> :ok
+        {:error, %{info: info}} -> assert Map.keys(info) == [:errno]
+      end
+
+      assert [{:error, %{info: info}}] = DiskSpace.stat_many([missing], errstr: true)
+      assert is_nil(info) or Map.has_key?(info, :errstr)
+    end
+
+    test "skips the directory check with validate: false" do
+      path = valid_directory_path()
+      assert {:ok, %{available: _}} = DiskSpace.stat(path, validate: false)
+      assert {:ok, %{fs_type: _}} = DiskSpace.stat(path, validate: false, extended: true)
+
+      missing = Path.join(path, "nonexistent_#{System.unique_integer()}")
+
+      assert {:error, %{reason: reason}} = DiskSpace.stat(missing, validate: false)
+      assert reason in [:not_directory, :invalid_path]
+
+      assert [{:ok, _}, {:error, _}] = DiskSpace.stat_many([path, missing], validate: false)
+    end
+
     test "returns error tuple for non-existent path" do
       path = Path.join(valid_directory_path(), "nonexistent_#{System.unique_integer()}")
       assert {:error, %{reason: reason, info: info}} = DiskSpace.stat(path)
@@ -109,6 +183,242 @@ defmodule DiskSpaceTest do
     end
   end
 
+  describe "stat_many/2" do
+    test "returns one result per path, in input order" do
+      path = valid_directory_path()
+      missing = Path.join(path, "nonexistent_#{System.unique_integer()}")
+
+      assert [{:ok, first}, {:error, %{reason: reason, info: _}}, {:ok, last}] =
+               DiskSpace.stat_many([path, missing, path])
+
+      assert Enum.sort(Map.keys(first)) == [:available, :free, :total, :used]
+      assert Enum.sort(Map.keys(last)) == [:available, :free, :total, :used]
+      assert is_atom(reason)
+    end
+
+    test "matches the error shape of stat/2" do
+      missing = Path.join(valid_directory_path(), "nonexistent_#{System.unique_integer()}")
+      assert [DiskSpace.stat(missing)] == DiskSpace.stat_many([missing])
+    end
+
+    test "dedupe_by_device groups paths that share a device" do
+      path = valid_directory_path()
+      missing = Path.join(path, "nonexistent_#{System.unique_integer()}")
+
+      assert {[{:ok, first}, {:error, _}, {:ok, second}], devices} =
+               DiskSpace.stat_many([path, missing, path], dedupe_by_device: true)
+
+      assert first == second
+      assert [{_device, [^path, ^path]}] = devices
+    end
+
+    test "humanizes every successful result" do
+      assert [{:ok, stats}] = DiskSpace.stat_many([valid_directory_path()], humanize: :binary)
+      assert is_binary(stats.available)
+    end
+  end
+
+  describe "stream/2" do
+    test "samples all paths at most once per interval" do
+      path = valid_directory_path()
+      started = System.monotonic_time(:millisecond)
+
+      assert [[{:ok, _}, {:ok, _}], [{:ok, _}, {:ok, _}], [{:ok, stats}, {:ok, _}]] =
+               DiskSpace.stream([path, path], interval: 20) |> Enum.take(3)
+
+      assert System.monotonic_time(:millisecond) - started >= 40
+      assert Enum.sort(Map.keys(stats)) == [:available, :free, :total, :used]
+    end
+
+    test "reads from a DiskSpace.Snapshot process with source: :snapshot" do
+      name = :"disk_space_stream_#{System.unique_integer([:positive])}"
+      path = valid_directory_path()
+      start_supervised!({DiskSpace.Snapshot, name: name, interval: 20, paths: [path]})
+
+      assert [[{:error, %{reason: :not_registered, info: nil}}]] =
+               DiskSpace.stream([path <> "/unregistered"], source: :snapshot, name: name)
+               |> Enum.take(1)
+    end
+  end
+
+  describe "stat_async/2" do
+    test "returns the same shape as stat/2" do
+      path = valid_directory_path()
+      assert {:ok, stats} = DiskSpace.stat_async(path)
+      assert Enum.sort(Map.keys(stats)) == [:available, :free, :total, :used]
+
+      missing = Path.join(path, "nonexistent_#{System.unique_integer()}")
+      assert DiskSpace.stat(missing) == DiskSpace.stat_async(missing)
+    end
+
+    test "applies :format, :validate and :errstr" do
+      path = valid_directory_path()
+      assert {:ok, {_, _, _, _}} = DiskSpace.stat_async(path, format: :tuple)
+      assert {:ok, stats} = DiskSpace.stat_async(path, format: {:fields, [:available]})
+      assert Map.keys(stats) == [:available]
+      assert {:ok, _} = DiskSpace.stat_async(path, validate: false, coalesce: true)
+
+      missing = Path.join(path, "nonexistent_#{System.unique_integer()}")
+      assert {:error, %{info: info}} = DiskSpace.stat_async(missing, errstr: false)
+      assert is_nil(info) or Map.keys(info) == [:errno]
+    end
+
+    test "leaves no stray messages behind on timeout" do
+      result = DiskSpace.stat_async(valid_directory_path(), timeout: 0)
+      assert match?({:ok, _}, result) or result == {:error, %{reason: :timeout, info: nil}}
+      refute_receive {:disk_space_stat, _, _}, 100
+    end
+
+    test "reports pool counters" do
+      info = DiskSpace.async_pool_info()
+
+      keys = [:max_workers, :max_queue, :workers, :busy, :queued, :stuck, :rejected, :coalesced]
+
+      for key <- keys do
+        assert is_integer(Map.fetch!(info, key))
+      end
+    end
+  end
+
+  describe "open/1 and stat_handle/2" do
+    test "queries an open directory repeatedly" do
+      assert {:ok, handle} = DiskSpace.open(valid_directory_path())
+      assert {:ok, stats} = DiskSpace.stat_handle(handle)
+      assert Enum.sort(Map.keys(stats)) == [:available, :free, :total, :used]
+      assert stats.total >= stats.used
+      assert {:ok, _} = DiskSpace.stat_handle(handle, humanize: :binary)
+      assert :ok = DiskSpace.close(handle)
+    end
+
+    test "reports :closed after close/1" do
+      assert {:ok, handle} = DiskSpace.open(valid_directory_path())
+      assert :ok = DiskSpace.close(handle)
+      assert :ok = DiskSpace.close(handle)
+      assert {:error, %{reason: :closed, info: nil}} = DiskSpace.stat_handle(handle)
+    end
+
+    test "returns error tuple for non-existent path" do
+      path = Path.join(valid_directory_path(), "nonexistent_#{System.unique_integer()}")
+      assert {:error, %{reason: reason, info: _}} = DiskSpace.open(path)
+      assert is_atom(reason)
+    end
+  end
+
+  describe "mounts/1" do
+    test "lists mounted filesystems with stats" do
+      assert {:ok, [_ | _] = mounts} = DiskSpace.mounts()
+
+      for mount <- mounts do
+        assert %{mount_point: mount_point, device: device, fs_type: fs_type, result: result} =
+                 mount
+
+        assert is_binary(mount_point) and is_binary(device) and is_binary(fs_type)
+        assert match?({:ok, %{total: _}}, result) or match?({:error, %{reason: _}}, result)
+      end
+    end
+
+    test "skips pseudo filesystems unless asked for" do
+      {:ok, mounts} = DiskSpace.mounts()
+      {:ok, all} = DiskSpace.mounts(include_pseudo: true)
+      refute Enum.any?(mounts, &(&1.fs_type in ["proc", "sysfs", "cgroup2", "overlay"]))
+      assert length(all) >= length(mounts)
+    end
+  end
+
+  describe "usage/2" do
+    setup do
+      root =
+        Path.join(System.tmp_dir!(), "disk_space_usage_#{System.unique_integer([:positive])}")
+
+      File.mkdir_p!(Path.join(root, "a/b"))
+      File.write!(Path.join(root, "one"), String.duplicate("x", 1000))
+      File.write!(Path.join(root, "a/b/two"), String.duplicate("x", 2000))
+      on_exit(fn -> File.rm_rf!(root) end)
+      %{root: root}
+    end
+
+    test "sums sizes and counts entries below the path", %{root: root} do
+      for threads <- [1, 4] do
+        assert {:ok, usage} = DiskSpace.usage(root, threads: threads)
+        assert %{files: 2, dirs: 3, errors: 0} = usage
+        assert usage.apparent_size >= 3000
+        assert is_integer(usage.allocated_size)
+      end
+    end
+
+    test "counts hard links once", %{root: root} do
+      {:ok, before} = DiskSpace.usage(root)
+
+      case File.ln(Path.join(root, "one"), Path.join(root, "a/one_again")) do
+        :ok ->
+          assert {:ok, %{files: 2} = usage} = DiskSpace.usage(root)
+          assert usage.apparent_size == before.apparent_size
+
+        {:error, _} ->
+          :ok
+      end
+    end
+
+    test "gives the same totals with io_uring: true", %{root: root} do
+      assert DiskSpace.usage(root, io_uring: true) == DiskSpace.usage(root)
+    end
+
+    test "reuses and rewrites an index", %{root: root} do
+      index = root <> ".index"
+      on_exit(fn -> File.rm(index) end)
+      {:ok, expected} = DiskSpace.usage(root)
+
+      assert DiskSpace.usage(root, index: index) == {:ok, expected}
+      assert File.exists?(index)
+      assert DiskSpace.usage(root, index: index) == {:ok, expected}
+
+      File.write!(Path.join(root, "a/b/three"), String.duplicate("x", 3000))
+      assert {:ok, %{files: 3}} = DiskSpace.usage(root, index: index)
+    end
+
+    test "ranks the largest files and directories", %{root: root} do
+      assert {:ok, usage} = DiskSpace.usage(root, top: 2)
+      assert [{two, 2000}, {one, 1000}] = usage.largest_files
+      assert Path.basename(two) == "two" and Path.basename(one) == "one"
+      assert [{^root, total}, {_, _}] = usage.largest_dirs
+      assert total == usage.apparent_size
+
+      assert {:ok, %{largest_files: [_]}} =
+               DiskSpace.usage(root, top: 1, rank_by: :allocated_size)
+      refute Map.has_key?(elem(DiskSpace.usage(root), 1), :largest_files)
+    end
+
+    test "humanizes sizes but not counts", %{root: root} do
+      assert {:ok, %{apparent_size: size, files: 2}} = DiskSpace.usage(root, humanize: :binary)
+      assert is_binary(size)
+    end
+
+    test "returns error tuple for non-existent path" do
+      assert {:error, %{reason: :not_directory}} =
+               DiskSpace.usage("/nonexistent/disk_space/usage/path")
+    end
+  end
+
+  describe "usage_async/2" do
+    test "delivers the same result as usage/2" do
+      path = valid_directory_path()
+      {:ok, scan} = DiskSpace.usage_async(path, one_file_system: true, progress_interval: 10)
+      assert_receive {:disk_space_usage, ^scan, {:ok, %{files: _, dirs: _}}}, 60_000
+    end
+
+    test "reports errors in the final message" do
+      {:ok, scan} = DiskSpace.usage_async("/nonexistent/disk_space/usage/path")
+      assert_receive {:disk_space_usage, ^scan, {:error, %{reason: :not_directory}}}
+    end
+
+    test "sends nothing after cancel/1" do
+      {:ok, scan} = DiskSpace.usage_async(valid_directory_path(), progress_interval: 1)
+      assert :ok = DiskSpace.cancel(scan)
+      refute_receive {:disk_space_progress, ^scan, _}, 50
+      refute_received {:disk_space_usage, ^scan, _}
+    end
+  end
+
   describe "humanize/2" do
     test "returns {:error, reason} unchanged" do
       assert {:error, :eio} = DiskSpace.humanize({:error, :eio}, :binary)
@@ -127,13 +437,90 @@ defmodule DiskSpaceTest do
       assert is_binary(result.total)
       assert String.contains?(result.total, "MB")
     end
+
+    test "rounds to the requested precision and drops all-zero decimals" do
+      assert %{a: "0 B", b: "1023 B", c: "1 KiB", d: "1.50 KiB", e: "1024 KiB"} =
+               DiskSpace.humanize(%{a: 0, b: 1023, c: 1024, d: 1536, e: 1_048_575}, :binary)
+
+      assert %{free: "117.738 MiB"} =
+               DiskSpace.humanize(%{free: 123_456_789}, :binary, precision: 3)
+
+      assert {:ok, {"1 kB", "1.5 kB", _, _}} =
+               DiskSpace.humanize({:ok, {1000, 1500, 0, 0}}, :decimal, precision: 1)
+    end
+
+    test "humanize_many/2 keeps the devices of dedupe_by_device results" do
+      devices = [{1, ["/a", "/b"]}]
+
+      assert {[{:ok, %{free: "2 KiB"}}], ^devices} =
+               DiskSpace.humanize_many({[{:ok, %{free: 2048}}], devices})
+    end
   end
 
-  defp valid_directory_path do
-    if :os.type() == {:win32, :nt} do
-      "C:\\"
-    else
-      "/tmp"
+  describe "telemetry" do
+    setup %{test: test} do
+      path = valid_directory_path()
+
+      names = [[:stat], [:stat_many], [:open], [:mounts], [:cache, :stat], [:cluster, :stat]]
+      events = for name <- names, kind <- [:start, :stop], do: [:disk_space | name] ++ [kind]
+
+      :ok = :telemetry.attach_many(test, events, &__MODULE__.handle_telemetry/4, self())
+      on_exit(fn -> :telemetry.detach(test) end)
+      %{path: path}
     end
+
+    test "stat/2 emits a span with the native timing of each syscall", %{path: path} do
+      assert {:ok, _} = result = DiskSpace.stat(path, native_timing: true)
+      assert_received {:telemetry, [:disk_space, :stat, :start], %{system_time: _},
+                       %{path: ^path}}
+
+      assert_received {:telemetry, [:disk_space, :stat, :stop], measurements,
+                       %{path: ^path, result: ^result}}
+
+      assert %{duration: _, check_time: check_time, space_time: space_time} = measurements
+      assert check_time >= 0 and space_time >= 0
+    end
+
+    test "stat_many/2 emits a span without native timing", %{path: path} do
+      assert [{:ok, _}] = DiskSpace.stat_many([path])
+      assert_received {:telemetry, [:disk_space, :stat_many, :stop], measurements,
+                       %{paths: [^path]}}
+
+      refute Map.has_key?(measurements, :check_time)
+    end
+
+    test "open/1 and mounts/1 emit spans", %{path: path} do
+      assert {:ok, handle} = result = DiskSpace.open(path)
+      DiskSpace.close(handle)
+      assert_received {:telemetry, [:disk_space, :open, :stop], _,
+                       %{path: ^path, result: ^result}}
+
+      assert {:ok, _} = result = DiskSpace.mounts()
+      assert_received {:telemetry, [:disk_space, :mounts, :stop], _, %{opts: [], result: ^result}}
+    end
+
+    test "the cache and the cluster emit spans with hit and timeout metadata", %{path: path} do
+      name = :"disk_space_telemetry_cache_#{System.unique_integer([:positive])}"
+      start_supervised!({DiskSpace.Cache, name: name, ttl: 60_000})
+
+      assert {:ok, _} = DiskSpace.Cache.stat(path, name: name)
+      assert {:ok, _} = DiskSpace.Cache.stat(path, name: name)
+
+      assert_received {:telemetry, [:disk_space, :cache, :stat, :stop], _,
+                       %{path: ^path, cache: ^name, hit: false}}
+
+      assert_received {:telemetry, [:disk_space, :cache, :stat, :stop], _,
+                       %{path: ^path, cache: ^name, hit: true}}
+
+      assert %{timed_out: []} = DiskSpace.Cluster.stat(path, nodes: [node()], name: name)
+
+      assert_received {:telemetry, [:disk_space, :cluster, :stat, :stop], _,
+                       %{path: ^path, nodes: [_], timed_out: []}}
+    end
+  end
+
+  # handlers are global but run in the emitting process, so keep only this test's events
+  def handle_telemetry(event, measurements, metadata, pid) do
+    if self() == pid, do: send(pid, {:telemetry, event, measurements, metadata})
   end
 end
@@ -1 +1,9 @@
+defmodule DiskSpace.TestHelpers do
+  @moduledoc false
+
+  def valid_directory_path do
+    if :os.type() == {:win32, :nt}, do: "C:\\", else: "/tmp"
+  end
+end
+
 ExUnit.start()